@@ -0,0 +1,734 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+/*
+ * Benchmarks of the fontconfig library.
+ *
+ *    fcbench [-n <fonts>[,<fonts>...]] [-t <ms>] [benchmark...]
+ *
+ * runs the named benchmarks, or all of them. The matching and listing
+ * benchmarks run on a synthetic font list of every size given with -n
+ * (default 0,100,1000,10000), 0 being the fonts of FC_FONT_PATH. The
+ * synthetic lists have families with the mix of styles, scripts and
+ * coverage of a real system, so the results show how the library scales
+ * with the number of fonts. The FcInit() benchmarks run on the fonts of
+ * FC_FONT_PATH, with a cache file of their own.
+ *
+ * The results are one line per benchmark and font list,
+ *
+ *    <benchmark> <fonts> <operations> <ns/op> <allocations/op>
+ *
+ * after a header line starting with '#'. Allocations are the calls of
+ * malloc(), calloc(), realloc() and strdup() by the library and FreeType,
+ * which the Makefile links through the wrappers below. Every benchmark runs
+ * for at least -t milliseconds (default BENCH_MIN_MS). Only the operation
+ * itself is timed, not what has to happen before or after it, like the
+ * FcFini() after an FcInit().
+ */
+
+#include <unistd.h>
+
+#include "fcint.h"
+
+#define BENCH_MIN_MS    300
+
+/* the patterns of a text with style runs and fallback probes */
+#define NUM_RUNS        256
+/* the patterns FcFontSort() and FcFontList() are asked for */
+#define NUM_SORTS       16
+
+static FcPattern *apRuns[NUM_RUNS];
+static FcPattern *apResults[NUM_RUNS];
+static FcPattern *apMatched[NUM_RUNS];
+static FcPattern *apFamilies[NUM_SORTS];
+
+static volatile long lAllocs;
+static char achCacheFile[CCHMAXPATH];
+
+/*
+ * Count the allocations, linked with -Wl,--wrap=malloc etc., which sends
+ * every call of malloc() of the other objects here.
+ */
+void *__real_malloc(size_t cb);
+void *__real_calloc(size_t n, size_t cb);
+void *__real_realloc(void *p, size_t cb);
+char *__real_strdup(const char *pch);
+
+void *__wrap_malloc(size_t cb)
+{
+  __sync_fetch_and_add(&lAllocs, 1);
+  return __real_malloc(cb);
+}
+
+void *__wrap_calloc(size_t n, size_t cb)
+{
+  __sync_fetch_and_add(&lAllocs, 1);
+  return __real_calloc(n, cb);
+}
+
+void *__wrap_realloc(void *p, size_t cb)
+{
+  __sync_fetch_and_add(&lAllocs, 1);
+  return __real_realloc(p, cb);
+}
+
+char *__wrap_strdup(const char *pch)
+{
+  __sync_fetch_and_add(&lAllocs, 1);
+  return __real_strdup(pch);
+}
+
+static double Now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Synthetic font lists.
+ *
+ * A family has the first few of the styles below, most of them up to the
+ * four standard ones and some the whole range of weights and widths of a
+ * superfamily. Families cover one script, mostly Latin, some the other
+ * European ones, a few CJK and the scripts of South and West Asia. The
+ * default families of the substitution rules are always there, like on a
+ * real system.
+ */
+typedef struct FcBenchStyle_s
+{
+  const char *pchName;
+  int         iWeight;
+  int         iSlant;
+  int         iWidth;
+} FcBenchStyle_t;
+
+static const FcBenchStyle_t aStyles[] =
+{
+  { "Regular",                FC_WEIGHT_REGULAR,    FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Bold",                   FC_WEIGHT_BOLD,       FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Italic",                 FC_WEIGHT_REGULAR,    FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "Bold Italic",            FC_WEIGHT_BOLD,       FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "Light",                  FC_WEIGHT_LIGHT,      FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Light Italic",           FC_WEIGHT_LIGHT,      FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "SemiBold",               FC_WEIGHT_SEMIBOLD,   FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "SemiBold Italic",        FC_WEIGHT_SEMIBOLD,   FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "Medium",                 FC_WEIGHT_MEDIUM,     FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Medium Italic",          FC_WEIGHT_MEDIUM,     FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "Black",                  FC_WEIGHT_BLACK,      FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Black Italic",           FC_WEIGHT_BLACK,      FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "ExtraLight",             FC_WEIGHT_EXTRALIGHT, FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "ExtraLight Italic",      FC_WEIGHT_EXTRALIGHT, FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "ExtraBold",              FC_WEIGHT_EXTRABOLD,  FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "ExtraBold Italic",       FC_WEIGHT_EXTRABOLD,  FC_SLANT_ITALIC, FC_WIDTH_NORMAL },
+  { "Condensed",              FC_WEIGHT_REGULAR,    FC_SLANT_ROMAN,  FC_WIDTH_CONDENSED },
+  { "Condensed Bold",         FC_WEIGHT_BOLD,       FC_SLANT_ROMAN,  FC_WIDTH_CONDENSED },
+  { "Condensed Italic",       FC_WEIGHT_REGULAR,    FC_SLANT_ITALIC, FC_WIDTH_CONDENSED },
+  { "Condensed Bold Italic",  FC_WEIGHT_BOLD,       FC_SLANT_ITALIC, FC_WIDTH_CONDENSED },
+  { "Condensed Light",        FC_WEIGHT_LIGHT,      FC_SLANT_ROMAN,  FC_WIDTH_CONDENSED },
+  { "Condensed SemiBold",     FC_WEIGHT_SEMIBOLD,   FC_SLANT_ROMAN,  FC_WIDTH_CONDENSED },
+  { "Condensed Black",        FC_WEIGHT_BLACK,      FC_SLANT_ROMAN,  FC_WIDTH_CONDENSED },
+  { "Thin",                   FC_WEIGHT_THIN,       FC_SLANT_ROMAN,  FC_WIDTH_NORMAL },
+  { "Expanded",               FC_WEIGHT_REGULAR,    FC_SLANT_ROMAN,  FC_WIDTH_EXPANDED },
+  { "Expanded Bold",          FC_WEIGHT_BOLD,       FC_SLANT_ROMAN,  FC_WIDTH_EXPANDED },
+};
+
+#define NUM_STYLES (sizeof(aStyles) / sizeof(aStyles[0]))
+
+/* the scripts a family is made for: its name suffix, its share of the
+ * families in percent and the ranges it covers */
+typedef struct FcBenchScript_s
+{
+  const char *pchSuffix;
+  int         iPercent;
+  FcChar32    aulRanges[12];  /* first, last, ..., 0 */
+  FcCharSet  *pCharSet;
+  FcChar32    aulLangs[FC_LANG_MAP_SIZE];
+} FcBenchScript_t;
+
+static FcBenchScript_t aScripts[] =
+{
+  { "",             62, { 0x20, 0x7e, 0xa0, 0x17f, 0 } },
+  { "",             20, { 0x20, 0x7e, 0xa0, 0x24f, 0x370, 0x3ff, 0x400, 0x4ff, 0 } },
+  { " CJK JP",       4, { 0x20, 0x7e, 0x3000, 0x30ff, 0x4e00, 0x9fff, 0xff00, 0xffef, 0 } },
+  { " CJK SC",       3, { 0x20, 0x7e, 0x3000, 0x303f, 0x4e00, 0x9fff, 0xff00, 0xffef, 0 } },
+  { " Arabic",       4, { 0x20, 0x7e, 0x600, 0x6ff, 0xfe70, 0xfeff, 0 } },
+  { " Devanagari",   3, { 0x20, 0x7e, 0x900, 0x97f, 0 } },
+  { " Hebrew",       2, { 0x20, 0x7e, 0x590, 0x5ff, 0 } },
+  { " Thai",         2, { 0x20, 0x7e, 0xe00, 0xe7f, 0 } },
+};
+
+#define NUM_SCRIPTS (sizeof(aScripts) / sizeof(aScripts[0]))
+
+static const char *apchFamilyNames[] =
+{
+  "Noto", "Source", "DejaVu", "Liberation", "Droid", "Open", "Fira", "IBM Plex",
+  "Roboto", "Ubuntu", "Cantarell", "Lato", "Merriweather", "Montserrat",
+  "Oswald", "Raleway", "PT", "Bitstream", "Linux", "Gentium", "Charis",
+  "Libertinus", "Inter", "Work", "Titillium", "Crimson", "EB", "Alegreya",
+  "Cormorant", "Josefin", "Nunito", "Quicksand", "Karla", "Rubik", "Heebo",
+  "Barlow", "Manrope", "Spectral", "Vollkorn", "Zilla",
+};
+
+static const char *apchFamilyKinds[] =
+{
+  "Sans", "Serif", "Mono", "Display", "Text", "Slab", "Rounded", "Script",
+};
+
+#define NUM_FAMILY_NAMES  (sizeof(apchFamilyNames) / sizeof(apchFamilyNames[0]))
+#define NUM_FAMILY_KINDS  (sizeof(apchFamilyKinds) / sizeof(apchFamilyKinds[0]))
+
+/* the families every list has: name, styles, script */
+static const struct
+{
+  const char *pchName;
+  int         iNumStyles;
+  int         iScript;
+} aDefaultFamilies[] =
+{
+  { DEFAULT_SERIF_FONT,       4, 0 },
+  { DEFAULT_SANSSERIF_FONT,   4, 0 },
+  { DEFAULT_MONOSPACED_FONT,  4, 0 },
+  { DEFAULT_SERIF_FONTJA,     1, 2 },
+  { DEFAULT_SYMBOL_FONT,      1, 0 },
+  { DEFAULT_DINGBATS_FONT,    4, 1 },
+};
+
+#define NUM_DEFAULT_FAMILIES (sizeof(aDefaultFamilies) / sizeof(aDefaultFamilies[0]))
+
+static FcChar32 ulRandom;
+
+/* xorshift, the lists of the same size are always the same */
+static FcChar32 Random(void)
+{
+  ulRandom ^= ulRandom << 13;
+  ulRandom ^= ulRandom >> 17;
+  ulRandom ^= ulRandom << 5;
+  return ulRandom;
+}
+
+static FcBool InitScripts(void)
+{
+  unsigned i;
+  int j;
+  FcChar32 ulChar;
+
+  for (i = 0; i < NUM_SCRIPTS; i++)
+  {
+    aScripts[i].pCharSet = FcCharSetCreate();
+    if (!aScripts[i].pCharSet)
+      return FcFalse;
+    for (j = 0; aScripts[i].aulRanges[j]; j += 2)
+      for (ulChar = aScripts[i].aulRanges[j]; ulChar <= aScripts[i].aulRanges[j + 1]; ulChar++)
+        FcCharSetAddChar(aScripts[i].pCharSet, ulChar);
+    FcLangMapOfCharSet(aScripts[i].pCharSet, aScripts[i].aulLangs);
+  }
+  return FcTrue;
+}
+
+static void DoneScripts(void)
+{
+  unsigned i;
+
+  for (i = 0; i < NUM_SCRIPTS; i++)
+    if (aScripts[i].pCharSet)
+      FcCharSetDestroy(aScripts[i].pCharSet);
+}
+
+/* how many styles a new family has */
+static int RandomStyleCount(void)
+{
+  int iPercent = Random() % 100;
+
+  if (iPercent < 30)
+    return 1;
+  if (iPercent < 40)
+    return 2;
+  if (iPercent < 75)
+    return 4;
+  if (iPercent < 90)
+    return 8;
+  if (iPercent < 97)
+    return 16;
+  return NUM_STYLES;
+}
+
+static int RandomScript(void)
+{
+  int iPercent = Random() % 100;
+  unsigned i;
+
+  for (i = 0; i < NUM_SCRIPTS - 1 && iPercent >= aScripts[i].iPercent; i++)
+    iPercent -= aScripts[i].iPercent;
+  return i;
+}
+
+/* Add the faces of a family to the front of a description list */
+static int AddFamily(FontDescriptionCache_p *ppHead, const char *pchFamily,
+                     int iNumStyles, int iScript)
+{
+  FontDescriptionCache_p pDesc;
+  int i;
+
+  for (i = 0; i < iNumStyles; i++)
+  {
+    pDesc = (FontDescriptionCache_p) calloc(1, sizeof(FontDescriptionCache_t));
+    if (!pDesc)
+      return i;
+    snprintf(pDesc->achFamilyName, sizeof(pDesc->achFamilyName), "%s", pchFamily);
+    snprintf(pDesc->achStyleName, sizeof(pDesc->achStyleName), "%s", aStyles[i].pchName);
+    snprintf(pDesc->achFileName, sizeof(pDesc->achFileName), "/synthetic/%s-%s.ttf",
+             pchFamily, aStyles[i].pchName);
+    pDesc->FileStatus.st_size = 100000 + Random() % 1000000;
+    pDesc->FileStatus.st_mtime = 1500000000;
+    pDesc->iWeight = aStyles[i].iWeight;
+    pDesc->iSlant = aStyles[i].iSlant;
+    pDesc->iWidth = aStyles[i].iWidth;
+    pDesc->pCharSet = FcCharSetFreeze(aScripts[iScript].pCharSet);
+    memcpy(pDesc->aulLangs, aScripts[iScript].aulLangs, sizeof(pDesc->aulLangs));
+    pDesc->pNext = *ppHead;
+    *ppHead = pDesc;
+  }
+  return iNumStyles;
+}
+
+/* Publish a synthetic font list of about iNumFonts fonts */
+static FcBool PublishSynthetic(int iNumFonts)
+{
+  FontDescriptionCache_p pHead = NULL, pDesc;
+  FcCatalog_t *pCatalog;
+  char achFamily[128];
+  unsigned uFamily;
+  int iFonts = 0;
+  int iScript;
+
+  ulRandom = 2463534242UL;
+  for (uFamily = 0; uFamily < NUM_DEFAULT_FAMILIES && iFonts < iNumFonts; uFamily++)
+    iFonts += AddFamily(&pHead, aDefaultFamilies[uFamily].pchName,
+                        aDefaultFamilies[uFamily].iNumStyles, aDefaultFamilies[uFamily].iScript);
+
+  for (uFamily = 0; iFonts < iNumFonts; uFamily++)
+  {
+    unsigned uRound = uFamily / (NUM_FAMILY_NAMES * NUM_FAMILY_KINDS);
+    int iNumStyles = RandomStyleCount();
+
+    iScript = RandomScript();
+    if (uRound)
+      snprintf(achFamily, sizeof(achFamily), "%s %s%s %u",
+               apchFamilyNames[uFamily % NUM_FAMILY_NAMES],
+               apchFamilyKinds[(uFamily / NUM_FAMILY_NAMES) % NUM_FAMILY_KINDS],
+               aScripts[iScript].pchSuffix, uRound + 1);
+    else
+      snprintf(achFamily, sizeof(achFamily), "%s %s%s",
+               apchFamilyNames[uFamily % NUM_FAMILY_NAMES],
+               apchFamilyKinds[(uFamily / NUM_FAMILY_NAMES) % NUM_FAMILY_KINDS],
+               aScripts[iScript].pchSuffix);
+    if (iNumStyles > iNumFonts - iFonts)
+      iNumStyles = iNumFonts - iFonts;
+    iFonts += AddFamily(&pHead, achFamily, iNumStyles, iScript);
+  }
+
+  pCatalog = FcCatalogCreate(pHead);
+  while (pHead)
+  {
+    pDesc = pHead;
+    pHead = pHead->pNext;
+    FcFontDescriptionFree(pDesc);
+  }
+  if (!pCatalog)
+    return FcFalse;
+  FcCatalogPublish(pCatalog);
+  FcMatchMemoClear();
+  return FcTrue;
+}
+
+/* Number of fonts of the published list */
+static int NumFonts(void)
+{
+  FcCatalog_t *pCatalog = FcCatalogAcquire();
+  int iNumFonts = 0;
+
+  if (pCatalog)
+  {
+    iNumFonts = pCatalog->iNumFonts;
+    FcCatalogRelease(pCatalog);
+  }
+  return iNumFonts;
+}
+
+static void FreeRuns(void)
+{
+  int i;
+
+  for (i = 0; i < NUM_RUNS; i++)
+  {
+    if (apRuns[i])
+      FcPatternDestroy(apRuns[i]);
+    if (apMatched[i])
+      FcPatternDestroy(apMatched[i]);
+    apRuns[i] = apMatched[i] = NULL;
+  }
+  for (i = 0; i < NUM_SORTS; i++)
+  {
+    if (apFamilies[i])
+      FcPatternDestroy(apFamilies[i]);
+    apFamilies[i] = NULL;
+  }
+}
+
+/*
+ * Build the runs from the installed families: every family in four
+ * styles, a few runs in a row sharing the same style, with a generic
+ * family or an unknown one every now and then, like the fallback probes
+ * of a layout engine. Also the fonts they match, and patterns of only a
+ * family for listing.
+ */
+static void BuildRuns(void)
+{
+  static const char *apchGeneric[] = { "serif", "sans-serif", "monospace", "No Such Family" };
+  FcFontSet *fs;
+  FcPattern *p;
+  FcObjectSet *os;
+  FcResult result;
+  int i;
+
+  FreeRuns();
+  p = FcPatternCreate();
+  os = FcObjectSetBuild(FC_FAMILY, NULL);
+  fs = FcFontList(NULL, p, os);
+  FcObjectSetDestroy(os);
+  FcPatternDestroy(p);
+
+  for (i = 0; i < NUM_RUNS; i++)
+  {
+    FcChar8 *pchFamily = (FcChar8 *) apchGeneric[(i / 8) % 4];
+
+    if ((i % 8) && fs && fs->nfont)
+      FcPatternGetString(fs->fonts[(i / 16) % fs->nfont], FC_FAMILY, 0, &pchFamily);
+    apRuns[i] = FcPatternCreate();
+    FcPatternAddString(apRuns[i], FC_FAMILY, pchFamily);
+    FcPatternAddInteger(apRuns[i], FC_WEIGHT, (i / 2) % 2 ? FC_WEIGHT_BOLD : FC_WEIGHT_REGULAR);
+    FcPatternAddInteger(apRuns[i], FC_SLANT, (i / 4) % 2 ? FC_SLANT_ITALIC : FC_SLANT_ROMAN);
+    FcConfigSubstitute(NULL, apRuns[i], FcMatchPattern);
+    FcDefaultSubstitute(apRuns[i]);
+    apMatched[i] = FcFontMatch(NULL, apRuns[i], &result);
+  }
+
+  for (i = 0; i < NUM_SORTS; i++)
+  {
+    FcChar8 *pchFamily = (FcChar8 *) apchGeneric[3];
+
+    if (fs && fs->nfont)
+      FcPatternGetString(fs->fonts[(i * 7) % fs->nfont], FC_FAMILY, 0, &pchFamily);
+    apFamilies[i] = FcPatternCreate();
+    FcPatternAddString(apFamilies[i], FC_FAMILY, pchFamily);
+  }
+  FcFontSetDestroy(fs);
+}
+
+/* FcFontMatch() for every run */
+static void BenchMatchLoop(void)
+{
+  FcResult result;
+  int i;
+
+  for (i = 0; i < NUM_RUNS; i++)
+    apResults[i] = FcFontMatch(NULL, apRuns[i], &result);
+  for (i = 0; i < NUM_RUNS; i++)
+    FcPatternDestroy(apResults[i]);
+}
+
+/* FcFontMatch() for every run, without the results of the ones before */
+static void BenchMatchNoMemo(void)
+{
+  FcResult result;
+  int i;
+
+  for (i = 0; i < NUM_RUNS; i++)
+  {
+    FcMatchMemoClear();
+    FcPatternDestroy(FcFontMatch(NULL, apRuns[i], &result));
+  }
+}
+
+/* FcFontMatchBatch() for all runs */
+static void BenchMatchBatch(void)
+{
+  int i;
+
+  FcFontMatchBatch(NULL, apRuns, NUM_RUNS, apResults);
+  for (i = 0; i < NUM_RUNS; i++)
+    FcPatternDestroy(apResults[i]);
+}
+
+/* FcFontSort() for the first styles of the first runs, a generic
+ * family and an installed one in turn */
+static void BenchSort(void)
+{
+  FcResult result;
+  int i;
+
+  for (i = 0; i < NUM_SORTS; i++)
+    FcFontSetDestroy(FcFontSort(NULL, apRuns[i * 4], FcTrue, NULL, &result));
+}
+
+/* FcFontList() of all fonts */
+static void BenchListAll(void)
+{
+  FcPattern *p = FcPatternCreate();
+  FcObjectSet *os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, NULL);
+
+  FcFontSetDestroy(FcFontList(NULL, p, os));
+  FcObjectSetDestroy(os);
+  FcPatternDestroy(p);
+}
+
+/* FcFontList() of the fonts of a family */
+static void BenchListFamily(void)
+{
+  FcObjectSet *os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, NULL);
+  int i;
+
+  for (i = 0; i < NUM_SORTS; i++)
+    FcFontSetDestroy(FcFontList(NULL, apFamilies[i], os));
+  FcObjectSetDestroy(os);
+}
+
+/* the properties of the matched fonts a text renderer asks for */
+#define NUM_GETS  7
+
+static void BenchPatternGet(void)
+{
+  FcChar8 *pch;
+  FcCharSet *pCharSet;
+  int i, iValue;
+
+  for (i = 0; i < NUM_RUNS; i++)
+  {
+    if (!apMatched[i])
+      continue;
+    FcPatternGetString(apMatched[i], FC_FAMILY, 0, &pch);
+    FcPatternGetString(apMatched[i], FC_STYLE, 0, &pch);
+    FcPatternGetString(apMatched[i], FC_FILE, 0, &pch);
+    FcPatternGetInteger(apMatched[i], FC_INDEX, 0, &iValue);
+    FcPatternGetInteger(apMatched[i], FC_WEIGHT, 0, &iValue);
+    FcPatternGetInteger(apMatched[i], FC_SLANT, 0, &iValue);
+    FcPatternGetCharSet(apMatched[i], FC_CHARSET, 0, &pCharSet);
+  }
+}
+
+static const char *apchNames[] =
+{
+  "Times New Roman-12",
+  "Helvetica:bold:italic",
+  "DejaVu Sans Mono-10:weight=200",
+  "serif-11:slant=100:lang=ja",
+  "Courier,monospace-9.5",
+  "Noto Sans:style=Condensed Bold",
+  "Noto Sans CJK JP:lang=zh-cn:pixelsize=16",
+  ":family=Arial:pixelsize=14:antialias=true:hinting=false",
+};
+
+#define NUM_NAMES (sizeof(apchNames) / sizeof(apchNames[0]))
+
+static void BenchNameParse(void)
+{
+  unsigned i;
+
+  for (i = 0; i < NUM_NAMES; i++)
+    FcPatternDestroy(FcNameParse((const FcChar8 *) apchNames[i]));
+}
+
+/* FcInit() with the cache file the run before wrote, or scanning every
+ * font file after BenchRemoveCache() */
+static void BenchInit(void)
+{
+  FcInit();
+}
+
+static void BenchRemoveCache(void)
+{
+  unlink(achCacheFile);
+}
+
+/* not part of the time of FcInit(), closing the inotify instance alone
+ * takes longer than a warm FcInit() */
+static void BenchFini(void)
+{
+  FcFini();
+}
+
+/* what a benchmark runs on */
+#define BENCH_CATALOG   0   /* every font list of -n */
+#define BENCH_ALONE     1   /* needs no fonts */
+#define BENCH_INIT      2   /* FcInit() on the fonts of FC_FONT_PATH */
+
+typedef struct FcBench_s
+{
+  const char *pchName;
+  void      (*pfnRun)(void);
+  int         iOpsPerRun;
+  int         iKind;
+  void      (*pfnSetup)(void);     /* before every run, not timed */
+  void      (*pfnTeardown)(void);  /* after every run, not timed */
+} FcBench_t;
+
+static const FcBench_t aBenches[] =
+{
+  { "match-loop",   BenchMatchLoop,   NUM_RUNS,            BENCH_CATALOG },
+  { "match-nomemo", BenchMatchNoMemo, NUM_RUNS,            BENCH_CATALOG },
+  { "match-batch",  BenchMatchBatch,  NUM_RUNS,            BENCH_CATALOG },
+  { "sort",         BenchSort,        NUM_SORTS,           BENCH_CATALOG },
+  { "list-all",     BenchListAll,     1,                   BENCH_CATALOG },
+  { "list-family",  BenchListFamily,  NUM_SORTS,           BENCH_CATALOG },
+  { "pattern-get",  BenchPatternGet,  NUM_RUNS * NUM_GETS, BENCH_CATALOG },
+  { "name-parse",   BenchNameParse,   NUM_NAMES,           BENCH_ALONE },
+  { "init-warm",    BenchInit,        1,                   BENCH_INIT, NULL, BenchFini },
+  { "init-cold",    BenchInit,        1,                   BENCH_INIT, BenchRemoveCache, BenchFini },
+};
+
+#define NUM_BENCHES (sizeof(aBenches) / sizeof(aBenches[0]))
+
+static int iMinMs = BENCH_MIN_MS;
+
+static void RunOnce(const FcBench_t *pBench, double *pdTimed, long *plAllocs)
+{
+  double dStart;
+  long lStartAllocs;
+
+  if (pBench->pfnSetup)
+    pBench->pfnSetup();
+  lStartAllocs = lAllocs;
+  dStart = Now();
+  pBench->pfnRun();
+  *pdTimed += Now() - dStart;
+  *plAllocs += lAllocs - lStartAllocs;
+  if (pBench->pfnTeardown)
+    pBench->pfnTeardown();
+}
+
+static void RunBench(const FcBench_t *pBench, int iNumFonts)
+{
+  double dStart, dTimed = 0;
+  long lRuns = 0, lAllocsRun = 0;
+
+  // once for the caches, then for real
+  RunOnce(pBench, &dTimed, &lAllocsRun);
+  dTimed = 0;
+  lAllocsRun = 0;
+  dStart = Now();
+  do
+  {
+    RunOnce(pBench, &dTimed, &lAllocsRun);
+    lRuns++;
+  } while (Now() - dStart < iMinMs * 1e6);
+
+  printf("%-14s %6d %10ld %12.1f %10.2f\n", pBench->pchName, iNumFonts,
+         lRuns * pBench->iOpsPerRun, dTimed / (lRuns * pBench->iOpsPerRun),
+         (double) lAllocsRun / (lRuns * pBench->iOpsPerRun));
+  fflush(stdout);
+}
+
+static FcBool Selected(const FcBench_t *pBench, int iFirstArg, int argc, char *argv[])
+{
+  int iArg;
+
+  for (iArg = iFirstArg; iArg < argc && strcmp(argv[iArg], pBench->pchName); iArg++)
+    ;
+  return iFirstArg == argc || iArg < argc;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *pchSizes = "0,100,1000,10000";
+  const char *pchTmpDir;
+  char *pchEnd;
+  unsigned i;
+  int iArg, iNumFonts;
+
+  for (iArg = 1; iArg + 1 < argc && argv[iArg][0] == '-'; iArg += 2)
+  {
+    if (!strcmp(argv[iArg], "-n"))
+      pchSizes = argv[iArg + 1];
+    else if (!strcmp(argv[iArg], "-t"))
+      iMinMs = atoi(argv[iArg + 1]);
+    else
+      break;
+  }
+  if (iArg < argc && argv[iArg][0] == '-')
+  {
+    fprintf(stderr, "usage: fcbench [-n <fonts>[,<fonts>...]] [-t <ms>] [benchmark...]\n");
+    return 1;
+  }
+
+  // init-cold removes the cache, so it must not be the one of the user
+  pchTmpDir = getenv("TMPDIR");
+  snprintf(achCacheFile, sizeof(achCacheFile), "%s/fcbench-%d.cache",
+           pchTmpDir && pchTmpDir[0] ? pchTmpDir : "/tmp", (int) getpid());
+  setenv("FC_CACHE_FILE", achCacheFile, 1);
+
+  if (!FcInit() || !InitScripts())
+  {
+    fprintf(stderr, "fcbench: FcInit() failed\n");
+    return 1;
+  }
+
+  printf("# benchmark fonts ops ns/op allocs/op\n");
+  for (i = 0; i < NUM_BENCHES; i++)
+    if (aBenches[i].iKind == BENCH_ALONE && Selected(aBenches + i, iArg, argc, argv))
+      RunBench(aBenches + i, 0);
+
+  while (*pchSizes)
+  {
+    iNumFonts = strtol(pchSizes, &pchEnd, 10);
+    if (pchEnd == pchSizes || iNumFonts < 0)
+      break;
+    pchSizes = *pchEnd == ',' ? pchEnd + 1 : pchEnd;
+
+    if (iNumFonts)
+    {
+      if (!PublishSynthetic(iNumFonts))
+      {
+        fprintf(stderr, "fcbench: could not build a list of %d fonts\n", iNumFonts);
+        continue;
+      }
+    }
+    else
+    {
+      // back to the installed fonts
+      FreeRuns();
+      FcFini();
+      FcInit();
+    }
+    BuildRuns();
+    iNumFonts = NumFonts();
+    for (i = 0; i < NUM_BENCHES; i++)
+      if (aBenches[i].iKind == BENCH_CATALOG && Selected(aBenches + i, iArg, argc, argv))
+        RunBench(aBenches + i, iNumFonts);
+  }
+  FreeRuns();
+
+  FcFini();
+  FcInit();
+  iNumFonts = NumFonts();
+  FcFini();
+  for (i = 0; i < NUM_BENCHES; i++)
+    if (aBenches[i].iKind == BENCH_INIT && Selected(aBenches + i, iArg, argc, argv))
+      RunBench(aBenches + i, iNumFonts);
+
+  DoneScripts();
+  unlink(achCacheFile);
+  return 0;
+}
@@ -277,6 +277,38 @@ typedef struct _FcStrList   FcStrList;
 
 typedef struct _FcStrSet    FcStrSet;
 
+/*
+ * What the library did since it was loaded or FcStatsReset() was called,
+ * see FcStatsGet(). Every match is found by family name (exact), through a
+ * substitution rule (alias), by a part of the family name (substring) or
+ * not at all (none), unless it is a recent result remembered (memo hit).
+ * Every face of a font list built is a cache hit, a cache miss or, on a
+ * refresh, reused from the list before.
+ */
+typedef struct _FcStats {
+    unsigned long   faces_scanned;	/* faces read from font files */
+    unsigned long   faces_opened;	/* faces opened with FreeType */
+    unsigned long   cache_hits;		/* faces found in the font cache */
+    unsigned long   cache_misses;	/* faces missing or outdated there */
+    unsigned long   faces_reused;	/* faces kept from the list refreshed */
+    unsigned long   match_calls;	/* patterns matched */
+    unsigned long   match_memo_hits;
+    unsigned long   match_exact;
+    unsigned long   match_alias;
+    unsigned long   match_substring;
+    unsigned long   match_none;
+    unsigned long   match_faces;	/* faces compared by the matches */
+    double	    match_faces_avg;	/* per match that was not a memo hit */
+    unsigned long   inits;		/* font lists built from scratch */
+    double	    init_seconds;	/* the time all of them took */
+    double	    last_init_seconds;
+    unsigned long   reinits;		/* refreshes of the font list */
+    double	    reinit_seconds;
+    double	    last_reinit_seconds;
+    int		    catalog_fonts;	/* fonts of the current font list */
+    unsigned long   catalog_bytes;	/* memory the font list takes */
+} FcStats;
+
 _FCFUNCPROTOBEGIN
 
 /* fcblanks.c */
@@ -412,6 +444,9 @@ FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b);
 FcBool
 FcCharSetIsSubset (const FcCharSet *a, const FcCharSet *b);
 
+FcBool
+FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed);
+
 #define FC_CHARSET_MAP_SIZE (256/32)
 #define FC_CHARSET_DONE	((FcChar32) -1)
 
@@ -497,6 +532,12 @@ FcInitReinitialize (void);
 FcBool
 FcInitBringUptoDate (void);
 
+void
+FcStatsGet (FcStats *stats);
+
+void
+FcStatsReset (void);
+
 /* fclang.c */
 FcLangSet *
 FcLangSetCreate (void);
@@ -592,6 +633,12 @@ FcFontMatch (FcConfig	*config,
 	     FcPattern	*p, 
 	     FcResult	*result);
 
+int
+FcFontMatchBatch (FcConfig	*config,
+		  FcPattern	**patterns,
+		  int		npatterns,
+		  FcPattern	**results);
+
 FcPattern *
 FcFontRenderPrepare (FcConfig	    *config,
 		     FcPattern	    *pat,
@@ -695,6 +742,9 @@ FcPatternEqualSubset (const FcPattern *pa, const FcPattern *pb, const FcObjectSe
 FcChar32
 FcPatternHash (const FcPattern *p);
 
+FcPattern *
+FcPatternIntern (FcPattern *p);
+
 FcBool
 FcPatternAdd (FcPattern *p, const char *object, FcValue value, FcBool append);
     
@@ -834,6 +884,9 @@ FcStrSetEqual (FcStrSet *sa, FcStrSet *sb);
 FcBool
 FcStrSetAdd (FcStrSet *set, const FcChar8 *s);
 
+FcBool
+FcStrSetAddMany (FcStrSet *set, const FcChar8 * const *strs, int num);
+
 FcBool
 FcStrSetAddFilename (FcStrSet *set, const FcChar8 *s);
 
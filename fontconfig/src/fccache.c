@@ -0,0 +1,627 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+#ifndef OS2
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Layout of the binary font description cache file. Everything is stored
+ * in host byte order, the file is only meant to be read back on the
+ * machine that wrote it:
+ *
+ *   FcBinCacheHeader_t
+ *   FcBinCacheDir_t  [ulNumDirs]
+ *   FcBinCacheFace_t [ulNumFaces]
+ *   string pool      [ulPoolSize]  (NUL terminated strings, referenced by offset)
+ *
+ * The pool also holds the serialized coverage of the faces. A string is
+ * always stored after it, so the pool still ends with a terminator.
+ *
+ * The faces of one font file are stored next to each other and share the
+ * same file name offset.
+ */
+#define FC_BINCACHE_MAGIC   "FcBCache"
+#define FC_BINCACHE_VERSION 4
+
+typedef struct FcBinCacheHeader_s
+{
+  char     achMagic[8];
+  FcChar32 ulVersion;
+  FcChar32 ulHeaderSize;
+  FcChar32 ulDirSize;
+  FcChar32 ulFaceSize;
+  FcChar32 ulFontPath;     /* the font path the cache was built for */
+  FcChar32 ulNumDirs;
+  FcChar32 ulNumFaces;
+  FcChar32 ulPoolSize;
+  FcChar32 ulDirsOffset;
+  FcChar32 ulFacesOffset;
+  FcChar32 ulPoolOffset;
+  FcChar32 ulReserved;
+} FcBinCacheHeader_t;
+
+typedef struct FcBinCacheDir_s
+{
+  long long llMTime;
+  FcChar32  ulPath;
+  FcChar32  ulReserved;
+} FcBinCacheDir_t;
+
+typedef struct FcBinCacheFace_s
+{
+  long long llSize;
+  long long llMTime;
+  FcChar32  ulFileName;
+  FcChar32  ulFamilyName;
+  FcChar32  ulStyleName;
+  FcChar32  ulFontIndex;
+  FcChar32  ulWeight;       /* FC_WEIGHT_* */
+  FcChar32  ulSlant;        /* FC_SLANT_* */
+  FcChar32  ulWidth;        /* FC_WIDTH_* */
+  FcChar32  ulCharSet;      /* serialized coverage in the pool */
+  FcChar32  ulCharSetSize;  /* 0 if the face has no coverage */
+  FcChar32  aulLangs[FC_LANG_MAP_SIZE]; /* languages of the coverage */
+  FcChar32  ulReserved;
+} FcBinCacheFace_t;
+
+struct FcBinCache_s
+{
+  void                     *pBase;
+  size_t                    cbSize;
+  const FcBinCacheHeader_t *pHeader;
+  const FcBinCacheDir_t    *pDirs;
+  const FcBinCacheFace_t   *pFaces;
+  const char               *pchPool;
+
+  /* file name -> index of its first face + 1, built on the first lookup */
+  FcChar32                 *pulFileHash;
+  FcChar32                  ulFileHashMask;
+};
+
+typedef struct FcBinCachePool_s
+{
+  char     *pch;
+  FcChar32  ulSize;
+  FcChar32  ulAlloc;
+} FcBinCachePool_t;
+
+static FcBool CheckRange(const FcBinCache *pCache, FcChar32 ulOffset,
+                         FcChar32 ulCount, FcChar32 ulSize)
+{
+  return ((unsigned long long)ulOffset +
+          (unsigned long long)ulCount * ulSize) <= pCache->cbSize;
+}
+
+/* make sure the mapped file is one of ours and that all offsets are sane */
+static FcBool CheckCache(FcBinCache *pCache)
+{
+  const FcBinCacheHeader_t *pHeader = pCache->pHeader;
+  FcChar32 i;
+
+  if (memcmp(pHeader->achMagic, FC_BINCACHE_MAGIC, sizeof(pHeader->achMagic)) ||
+      (pHeader->ulVersion != FC_BINCACHE_VERSION) ||
+      (pHeader->ulHeaderSize != sizeof(FcBinCacheHeader_t)) ||
+      (pHeader->ulDirSize != sizeof(FcBinCacheDir_t)) ||
+      (pHeader->ulFaceSize != sizeof(FcBinCacheFace_t)))
+    return FcFalse;
+
+  if (!CheckRange(pCache, pHeader->ulDirsOffset, pHeader->ulNumDirs, sizeof(FcBinCacheDir_t)) ||
+      !CheckRange(pCache, pHeader->ulFacesOffset, pHeader->ulNumFaces, sizeof(FcBinCacheFace_t)) ||
+      !CheckRange(pCache, pHeader->ulPoolOffset, pHeader->ulPoolSize, 1) ||
+      (pHeader->ulDirsOffset % sizeof(long long)) ||
+      (pHeader->ulFacesOffset % sizeof(long long)) ||
+      (pHeader->ulPoolSize == 0))
+    return FcFalse;
+
+  pCache->pDirs = FcOffsetToPtr(pCache->pBase, pHeader->ulDirsOffset, const FcBinCacheDir_t);
+  pCache->pFaces = FcOffsetToPtr(pCache->pBase, pHeader->ulFacesOffset, const FcBinCacheFace_t);
+  pCache->pchPool = FcOffsetToPtr(pCache->pBase, pHeader->ulPoolOffset, const char);
+
+  /* the pool must end with a string terminator, then every offset into it
+   * points to a valid string */
+  if (pCache->pchPool[pHeader->ulPoolSize-1] != 0 ||
+      pHeader->ulFontPath >= pHeader->ulPoolSize)
+    return FcFalse;
+
+  for (i = 0; i < pHeader->ulNumDirs; i++)
+    if (pCache->pDirs[i].ulPath >= pHeader->ulPoolSize)
+      return FcFalse;
+
+  for (i = 0; i < pHeader->ulNumFaces; i++)
+    if ((pCache->pFaces[i].ulFileName >= pHeader->ulPoolSize) ||
+        (pCache->pFaces[i].ulFamilyName >= pHeader->ulPoolSize) ||
+        (pCache->pFaces[i].ulStyleName >= pHeader->ulPoolSize) ||
+        ((unsigned long long)pCache->pFaces[i].ulCharSet +
+         pCache->pFaces[i].ulCharSetSize > pHeader->ulPoolSize))
+      return FcFalse;
+
+  return FcTrue;
+}
+
+FcBinCache *FcBinCacheMap(const char *pchCacheFile)
+{
+  FcBinCache *pCache;
+  struct stat statBuf;
+  void *pBase;
+  int fd;
+
+  fd = open(pchCacheFile, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  if ((fstat(fd, &statBuf) == -1) ||
+      (statBuf.st_size < (off_t)sizeof(FcBinCacheHeader_t)))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  pBase = mmap(NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pBase == MAP_FAILED)
+    return NULL;
+
+  pCache = (FcBinCache *) calloc(1, sizeof(FcBinCache));
+  if (!pCache)
+  {
+    munmap(pBase, statBuf.st_size);
+    return NULL;
+  }
+  pCache->pBase = pBase;
+  pCache->cbSize = statBuf.st_size;
+  pCache->pHeader = (const FcBinCacheHeader_t *) pBase;
+
+  if (!CheckCache(pCache))
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Ignoring invalid or outdated cache file [%s]\n", pchCacheFile);
+#endif
+    FcBinCacheUnmap(pCache);
+    return NULL;
+  }
+
+  return pCache;
+}
+
+void FcBinCacheUnmap(FcBinCache *pCache)
+{
+  if (!pCache)
+    return;
+
+  munmap(pCache->pBase, pCache->cbSize);
+  if (pCache->pulFileHash)
+    free(pCache->pulFileHash);
+  free(pCache);
+}
+
+/*
+ * The cache is current if it was built for the same font path and none of
+ * the directories it has seen was modified since then. This needs a stat()
+ * per directory only, not per font file.
+ */
+FcBool FcBinCacheIsCurrent(const FcBinCache *pCache, const char *pchFontPath)
+{
+  struct stat statBuf;
+  long long llMTime;
+  FcChar32 i;
+
+  if (strcmp(pCache->pchPool + pCache->pHeader->ulFontPath, pchFontPath))
+    return FcFalse;
+
+  for (i = 0; i < pCache->pHeader->ulNumDirs; i++)
+  {
+    if (stat(pCache->pchPool + pCache->pDirs[i].ulPath, &statBuf) == -1)
+      llMTime = -1;
+    else
+      llMTime = statBuf.st_mtime;
+
+    if (llMTime != pCache->pDirs[i].llMTime)
+    {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+      fprintf(stderr, "XX: Font directory [%s] has changed\n", pCache->pchPool + pCache->pDirs[i].ulPath);
+#endif
+      return FcFalse;
+    }
+  }
+  return FcTrue;
+}
+
+/* Tell fcwatch.c about the directories and font files of a current cache */
+void FcBinCacheWatch(const FcBinCache *pCache)
+{
+  const FcBinCacheFace_t *pFace;
+  FcChar32 ulLastFileName = 0;
+  FcChar32 i;
+
+  for (i = 0; i < pCache->pHeader->ulNumDirs; i++)
+    FcWatchAdd(pCache->pchPool + pCache->pDirs[i].ulPath,
+               (time_t) pCache->pDirs[i].llMTime, 0, FC_WATCH_DIRECTORY);
+
+  for (i = 0; i < pCache->pHeader->ulNumFaces; i++)
+  {
+    pFace = pCache->pFaces + i;
+    /* the faces of a file follow each other */
+    if (i && (pFace->ulFileName == ulLastFileName))
+      continue;
+    ulLastFileName = pFace->ulFileName;
+    FcWatchAdd(pCache->pchPool + pFace->ulFileName, (time_t) pFace->llMTime,
+               (off_t) pFace->llSize, FC_WATCH_FONT);
+  }
+}
+
+static void CopyPoolString(char *pchDest, size_t cbDest, const char *pchSource)
+{
+  size_t cbLen = strlen(pchSource);
+
+  if (cbLen >= cbDest)
+    cbLen = cbDest - 1;
+  memcpy(pchDest, pchSource, cbLen);
+  pchDest[cbLen] = 0;
+}
+
+static FcBool LinkFace(const FcBinCache *pCache, const FcBinCacheFace_t *pFace)
+{
+  FontDescriptionCache_t FontDesc;
+
+  memset(&FontDesc.FileStatus, 0, sizeof(FontDesc.FileStatus));
+  CopyPoolString(FontDesc.achFileName, sizeof(FontDesc.achFileName),
+                 pCache->pchPool + pFace->ulFileName);
+  CopyPoolString(FontDesc.achFamilyName, sizeof(FontDesc.achFamilyName),
+                 pCache->pchPool + pFace->ulFamilyName);
+  CopyPoolString(FontDesc.achStyleName, sizeof(FontDesc.achStyleName),
+                 pCache->pchPool + pFace->ulStyleName);
+  FontDesc.FileStatus.st_size = pFace->llSize;
+  FontDesc.FileStatus.st_mtime = pFace->llMTime;
+  FontDesc.lFontIndex = pFace->ulFontIndex;
+  FontDesc.iWeight = pFace->ulWeight;
+  FontDesc.iSlant = pFace->ulSlant;
+  FontDesc.iWidth = pFace->ulWidth;
+  memcpy(FontDesc.aulLangs, pFace->aulLangs, sizeof(FontDesc.aulLangs));
+  FontDesc.pCharSet = NULL;
+  if (pFace->ulCharSetSize)
+    FontDesc.pCharSet = FcCharSetDeserialize(pCache->pchPool + pFace->ulCharSet,
+                                             pFace->ulCharSetSize);
+
+  if (!FcFontDescriptionLink(&FontDesc))
+  {
+    if (FontDesc.pCharSet)
+      free(FontDesc.pCharSet);
+    return FcFalse;
+  }
+  FcStatsAdd(FC_STAT_CACHE_HITS, 1);
+  return FcTrue;
+}
+
+/*
+ * Link all cached faces. On a refresh, the entries of files that are still
+ * in the font list are taken over instead, so they stay valid.
+ */
+FcBool FcBinCacheLinkAll(const FcBinCache *pCache)
+{
+  const FcBinCacheFace_t *pFace;
+  struct stat statFile;
+  FcChar32 i;
+  int iReused;
+
+  memset(&statFile, 0, sizeof(statFile));
+  for (i = 0; i < pCache->pHeader->ulNumFaces; i++)
+  {
+    pFace = pCache->pFaces + i;
+    if (!i || (pFace->ulFileName != pFace[-1].ulFileName))
+    {
+      statFile.st_size = pFace->llSize;
+      statFile.st_mtime = pFace->llMTime;
+      iReused = FcFontDescriptionReuse(pCache->pchPool + pFace->ulFileName, &statFile);
+      if (iReused >= 0)
+      {
+        /* skip the cached faces of this file */
+        while ((i + 1 < pCache->pHeader->ulNumFaces) &&
+               (pFace[1].ulFileName == pFace->ulFileName))
+          i++, pFace++;
+        continue;
+      }
+    }
+    if (!LinkFace(pCache, pFace))
+      return FcFalse;
+  }
+
+  return FcTrue;
+}
+
+static FcBool BuildFileHash(FcBinCache *pCache)
+{
+  FcChar32 ulSize, ulHash, i;
+  FcChar32 ulLastFileName = (FcChar32) -1;
+  const char *pchFileName;
+
+  for (ulSize = 16; ulSize < pCache->pHeader->ulNumFaces * 2; ulSize <<= 1)
+    ;
+  pCache->pulFileHash = (FcChar32 *) calloc(ulSize, sizeof(FcChar32));
+  if (!pCache->pulFileHash)
+    return FcFalse;
+  pCache->ulFileHashMask = ulSize - 1;
+
+  for (i = 0; i < pCache->pHeader->ulNumFaces; i++)
+  {
+    if (pCache->pFaces[i].ulFileName == ulLastFileName)
+      continue;
+    ulLastFileName = pCache->pFaces[i].ulFileName;
+
+    pchFileName = pCache->pchPool + ulLastFileName;
+    ulHash = FcStringHash((const FcChar8 *)pchFileName) & pCache->ulFileHashMask;
+    while (pCache->pulFileHash[ulHash])
+      ulHash = (ulHash + 1) & pCache->ulFileHashMask;
+    pCache->pulFileHash[ulHash] = i + 1;
+  }
+  return FcTrue;
+}
+
+/*
+ * Look up a font file in the cache. Returns the index of its first face,
+ * or -1 if the cache does not know the file or the file changed since.
+ */
+int FcBinCacheFindFile(FcBinCache *pCache, const char *pchFileName,
+                       const struct stat *pStat)
+{
+  const FcBinCacheFace_t *pFace;
+  FcChar32 ulHash, i;
+
+  if (!pCache->pulFileHash && !BuildFileHash(pCache))
+    return -1;
+
+  ulHash = FcStringHash((const FcChar8 *)pchFileName) & pCache->ulFileHashMask;
+  while ((i = pCache->pulFileHash[ulHash]))
+  {
+    pFace = pCache->pFaces + i - 1;
+    if (!strcmp(pCache->pchPool + pFace->ulFileName, pchFileName))
+      break;
+    ulHash = (ulHash + 1) & pCache->ulFileHashMask;
+  }
+  if (!i)
+    return -1;
+
+  if ((pFace->llSize != pStat->st_size) ||
+      (pFace->llMTime != pStat->st_mtime))
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Cache is not up to date for Font [%s]\n", pchFileName);
+#endif
+    return -1;
+  }
+
+  return i - 1;
+}
+
+/*
+ * Link the cached faces of a font file, if the cache knows it and the file
+ * did not change since. Returns the number of faces linked, or -1 if the
+ * file has to be scanned.
+ */
+int FcBinCacheLinkFile(FcBinCache *pCache, const char *pchFileName,
+                       const struct stat *pStat)
+{
+  FcChar32 ulFileName, i;
+  int iFirst, iLinked;
+
+  iFirst = FcBinCacheFindFile(pCache, pchFileName, pStat);
+  if (iFirst < 0)
+    return -1;
+
+  ulFileName = pCache->pFaces[iFirst].ulFileName;
+  for (i = iFirst, iLinked = 0;
+       (i < pCache->pHeader->ulNumFaces) && (pCache->pFaces[i].ulFileName == ulFileName);
+       i++, iLinked++)
+  {
+    if (!LinkFace(pCache, pCache->pFaces + i))
+      break;
+  }
+  return iLinked;
+}
+
+static FcBool PoolAddData(FcBinCachePool_t *pPool, const void *pData, FcChar32 ulLen,
+                          FcChar32 *pulOffset)
+{
+
+  if (pPool->ulSize + ulLen > pPool->ulAlloc)
+  {
+    FcChar32 ulAlloc = pPool->ulAlloc ? pPool->ulAlloc : 4096;
+    char *pchNew;
+
+    while (pPool->ulSize + ulLen > ulAlloc)
+      ulAlloc *= 2;
+    pchNew = (char *) realloc(pPool->pch, ulAlloc);
+    if (!pchNew)
+      return FcFalse;
+    pPool->pch = pchNew;
+    pPool->ulAlloc = ulAlloc;
+  }
+  memcpy(pPool->pch + pPool->ulSize, pData, ulLen);
+  *pulOffset = pPool->ulSize;
+  pPool->ulSize += ulLen;
+  return FcTrue;
+}
+
+static FcBool PoolAdd(FcBinCachePool_t *pPool, const char *pchString, FcChar32 *pulOffset)
+{
+  return PoolAddData(pPool, pchString, strlen(pchString) + 1, pulOffset);
+}
+
+static FcBool PoolAddCharSet(FcBinCachePool_t *pPool, const FcCharSet *pCharSet,
+                             FcChar32 *pulOffset, FcChar32 *pulSize)
+{
+  void *pData;
+  FcBool rc;
+
+  *pulOffset = 0;
+  *pulSize = 0;
+  if (!pCharSet)
+    return FcTrue;
+
+  *pulSize = FcCharSetSerializedSize(pCharSet);
+  pData = malloc(*pulSize);
+  if (!pData)
+    return FcFalse;
+  FcCharSetSerialize(pCharSet, pData);
+  rc = PoolAddData(pPool, pData, *pulSize, pulOffset);
+  free(pData);
+  return rc;
+}
+
+/* Does the mapped cache hold exactly what is about to be written? */
+static FcBool SameAsCache(const FcBinCache *pCache, const FcBinCacheHeader_t *pHeader,
+                          const FcBinCacheDir_t *pDirs, const FcBinCacheFace_t *pFaces,
+                          const FcBinCachePool_t *pPool)
+{
+  const char *pchBase = (const char *) pCache->pBase;
+
+  return (pCache->cbSize == pHeader->ulPoolOffset + pHeader->ulPoolSize) &&
+         !memcmp(pchBase, pHeader, sizeof(FcBinCacheHeader_t)) &&
+         !memcmp(pchBase + pHeader->ulDirsOffset, pDirs,
+                 pHeader->ulNumDirs * sizeof(FcBinCacheDir_t)) &&
+         !memcmp(pchBase + pHeader->ulFacesOffset, pFaces,
+                 pHeader->ulNumFaces * sizeof(FcBinCacheFace_t)) &&
+         !memcmp(pchBase + pHeader->ulPoolOffset, pPool->pch, pPool->ulSize);
+}
+
+/*
+ * Write the current font description list to the cache file. The file is
+ * written under a temporary name first and then renamed, so that readers
+ * never map a half written cache. If pOldCache, the cache the list was read
+ * from, holds the same already, the file is left alone: processes sharing
+ * it would see it change otherwise.
+ */
+FcBool FcBinCacheWrite(const char *pchCacheFile, const FcBinCache *pOldCache,
+                       const char *pchFontPath, const FcScanDir_t *pDirs, int iNumDirs)
+{
+  FcBinCacheHeader_t Header;
+  FcBinCacheDir_t *pCacheDirs = NULL;
+  FcBinCacheFace_t *pCacheFaces = NULL;
+  FcBinCachePool_t Pool;
+  FontDescriptionCache_p pFont;
+  const char *pchLastFileName = NULL;
+  char achTempFile[CCHMAXPATH + 16];
+  FcChar32 ulNumFaces, ulLastFileName = 0, i;
+  FILE *hFile;
+  FcBool rc = FcFalse;
+
+  memset(&Pool, 0, sizeof(Pool));
+  memset(&Header, 0, sizeof(Header));
+
+  for (ulNumFaces = 0, pFont = FcFontDescriptionFirst(); pFont; pFont = pFont->pNext)
+    ulNumFaces++;
+
+  pCacheDirs = (FcBinCacheDir_t *) calloc(iNumDirs + 1, sizeof(FcBinCacheDir_t));
+  pCacheFaces = (FcBinCacheFace_t *) calloc(ulNumFaces + 1, sizeof(FcBinCacheFace_t));
+  if (!pCacheDirs || !pCacheFaces)
+    goto bail;
+
+  if (!PoolAdd(&Pool, pchFontPath, &Header.ulFontPath))
+    goto bail;
+
+  for (i = 0; i < iNumDirs; i++)
+  {
+    pCacheDirs[i].llMTime = pDirs[i].tMTime;
+    if (!PoolAdd(&Pool, pDirs[i].pchPath, &pCacheDirs[i].ulPath))
+      goto bail;
+  }
+
+  for (i = 0, pFont = FcFontDescriptionFirst(); pFont; pFont = pFont->pNext, i++)
+  {
+    FcBinCacheFace_t *pFace = pCacheFaces + i;
+
+    /* the faces of a file follow each other, store the name only once */
+    if (!pchLastFileName || strcmp(pchLastFileName, pFont->achFileName))
+    {
+      if (!PoolAdd(&Pool, pFont->achFileName, &ulLastFileName))
+        goto bail;
+      pchLastFileName = pFont->achFileName;
+    }
+    pFace->ulFileName = ulLastFileName;
+    /* the coverage goes first, so a string is always last in the pool */
+    if (!PoolAddCharSet(&Pool, pFont->pCharSet, &pFace->ulCharSet, &pFace->ulCharSetSize) ||
+        !PoolAdd(&Pool, pFont->achFamilyName, &pFace->ulFamilyName) ||
+        !PoolAdd(&Pool, pFont->achStyleName, &pFace->ulStyleName))
+      goto bail;
+    pFace->llSize = pFont->FileStatus.st_size;
+    pFace->llMTime = pFont->FileStatus.st_mtime;
+    pFace->ulFontIndex = pFont->lFontIndex;
+    pFace->ulWeight = pFont->iWeight;
+    pFace->ulSlant = pFont->iSlant;
+    pFace->ulWidth = pFont->iWidth;
+    memcpy(pFace->aulLangs, pFont->aulLangs, sizeof(pFace->aulLangs));
+  }
+
+  memcpy(Header.achMagic, FC_BINCACHE_MAGIC, sizeof(Header.achMagic));
+  Header.ulVersion = FC_BINCACHE_VERSION;
+  Header.ulHeaderSize = sizeof(FcBinCacheHeader_t);
+  Header.ulDirSize = sizeof(FcBinCacheDir_t);
+  Header.ulFaceSize = sizeof(FcBinCacheFace_t);
+  Header.ulNumDirs = iNumDirs;
+  Header.ulNumFaces = ulNumFaces;
+  Header.ulPoolSize = Pool.ulSize;
+  Header.ulDirsOffset = sizeof(FcBinCacheHeader_t);
+  Header.ulFacesOffset = Header.ulDirsOffset + iNumDirs * sizeof(FcBinCacheDir_t);
+  Header.ulPoolOffset = Header.ulFacesOffset + ulNumFaces * sizeof(FcBinCacheFace_t);
+
+  if (pOldCache && SameAsCache(pOldCache, &Header, pCacheDirs, pCacheFaces, &Pool))
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Cache file [%s] is unchanged\n", pchCacheFile);
+#endif
+    rc = FcTrue;
+    goto bail;
+  }
+
+  snprintf(achTempFile, sizeof(achTempFile), "%s.%ld", pchCacheFile, (long)getpid());
+  hFile = fopen(achTempFile, "wb");
+  if (!hFile)
+    goto bail;
+
+  if ((fwrite(&Header, sizeof(Header), 1, hFile) != 1) ||
+      (iNumDirs && fwrite(pCacheDirs, sizeof(FcBinCacheDir_t), iNumDirs, hFile) != iNumDirs) ||
+      (ulNumFaces && fwrite(pCacheFaces, sizeof(FcBinCacheFace_t), ulNumFaces, hFile) != ulNumFaces) ||
+      (fwrite(Pool.pch, 1, Pool.ulSize, hFile) != Pool.ulSize))
+  {
+    fclose(hFile);
+    remove(achTempFile);
+    goto bail;
+  }
+
+  if (fclose(hFile) || rename(achTempFile, pchCacheFile))
+  {
+    remove(achTempFile);
+    goto bail;
+  }
+
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Wrote %u faces to cache file [%s]\n", ulNumFaces, pchCacheFile);
+#endif
+  rc = FcTrue;
+
+bail:
+  if (pCacheDirs)
+    free(pCacheDirs);
+  if (pCacheFaces)
+    free(pCacheFaces);
+  if (Pool.pch)
+    free(Pool.pch);
+  return rc;
+}
+
+#endif /* !OS2 */
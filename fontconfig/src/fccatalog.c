@@ -0,0 +1,291 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Snapshots of the font list.
+ *
+ * FcFontMatch(), FcFontList() and FcFontSort() may be called from several
+ * threads at once, while another one refreshes the font list. A refresh
+ * builds a complete new snapshot on the side and then publishes it by
+ * swapping one pointer, so readers see either the old or the new list, but
+ * never a half built one, and they never have to wait for a lock.
+ *
+ * A reader takes a reference to the current snapshot. Between reading the
+ * pointer and incrementing the reference count of the snapshot it counts
+ * itself in iAcquiring, and the publisher waits until nobody is in there
+ * anymore before it drops its own reference to the old snapshot. That way
+ * the old snapshot can't be freed under the feet of a reader that just
+ * picked it up. Once the publisher has let go, the old snapshot lives on
+ * as long as somebody (a pattern, usually) still holds a reference to it.
+ */
+
+static FcCatalog_t *volatile pCurrentCatalog;
+static volatile int          iAcquiring;      /* readers inside FcCatalogAcquire() */
+static volatile int          iLastSerial;
+
+/*
+ * String pool of a snapshot. While it is filled, the strings are found
+ * again through a hash of their offsets, so every distinct string (a family
+ * name, the file name of the faces of a collection) is stored only once.
+ */
+typedef struct FcStringPool_s
+{
+  char     *pchPool;
+  size_t    cbUsed;
+  size_t    cbAlloc;
+  size_t   *pcbHash;      /* offset + 1, 0 is empty */
+  FcChar32  ulHashMask;
+} FcStringPool_t;
+
+/* Add a string to the pool, returns its offset or -1 if out of memory */
+static long PoolIntern(FcStringPool_t *pPool, const char *pchString)
+{
+  FcChar32 ulSlot = FcStringHash((const FcChar8 *)pchString) & pPool->ulHashMask;
+  size_t cbString = strlen(pchString) + 1;
+  char *pchNew;
+
+  while (pPool->pcbHash[ulSlot])
+  {
+    if (!strcmp(pPool->pchPool + pPool->pcbHash[ulSlot] - 1, pchString))
+      return (long) (pPool->pcbHash[ulSlot] - 1);
+    ulSlot = (ulSlot + 1) & pPool->ulHashMask;
+  }
+
+  if (pPool->cbUsed + cbString > pPool->cbAlloc)
+  {
+    pchNew = (char *) realloc(pPool->pchPool, (pPool->cbUsed + cbString) * 2);
+    if (!pchNew)
+      return -1;
+    pPool->pchPool = pchNew;
+    pPool->cbAlloc = (pPool->cbUsed + cbString) * 2;
+  }
+  memcpy(pPool->pchPool + pPool->cbUsed, pchString, cbString);
+  pPool->pcbHash[ulSlot] = pPool->cbUsed + 1;
+  pPool->cbUsed += cbString;
+  return (long) (pPool->cbUsed - cbString);
+}
+
+/*
+ * Turn the language bitmaps of the fonts around: for every language bit, a
+ * bitmap of the fonts covering it, so the fonts good for a language are
+ * found by combining a few rows instead of looking at every font.
+ */
+static FcBool BuildLangIndex(FcCatalog_t *pCatalog)
+{
+  FcChar32 *pulRow;
+  int iBit, i;
+
+  pCatalog->iLangWords = (pCatalog->iNumFonts + 31) / 32;
+  pCatalog->pulLangFaces = (FcChar32 *) calloc(FC_LANG_MAP_SIZE * 32 * pCatalog->iLangWords + 1,
+                                               sizeof(FcChar32));
+  if (!pCatalog->pulLangFaces)
+    return FcFalse;
+
+  for (i = 0; i < pCatalog->iNumFonts; i++)
+  {
+    const FcChar32 *pulLangs = pCatalog->pFonts[i].aulLangs;
+
+    for (iBit = 0; iBit < FC_LANG_MAP_SIZE * 32; iBit++)
+    {
+      if (!pulLangs[iBit / 32])
+      {
+        iBit |= 31;   /* skip the empty word */
+        continue;
+      }
+      if (pulLangs[iBit / 32] & ((FcChar32) 1 << (iBit % 32)))
+      {
+        pulRow = pCatalog->pulLangFaces + iBit * pCatalog->iLangWords;
+        pulRow[i / 32] |= (FcChar32) 1 << (i % 32);
+      }
+    }
+  }
+  return FcTrue;
+}
+
+/*
+ * Make a snapshot of a font description list. The records take over the
+ * coverage of the descriptions, the rest of the list stays with the caller.
+ */
+FcCatalog_t *FcCatalogCreate(FontDescriptionCache_p pHead)
+{
+  FcCatalog_t *pCatalog;
+  FontDescriptionCache_p pDesc;
+  FcFontRecord_p pFont;
+  FcStringPool_t Pool;
+  long *plOffsets = NULL;   /* file, family and style of every font */
+  FcChar32 ulSize;
+  int iNumFonts, i;
+
+  for (iNumFonts = 0, pDesc = pHead; pDesc; pDesc = pDesc->pNext)
+    iNumFonts++;
+
+  memset(&Pool, 0, sizeof(Pool));
+  for (ulSize = 64; ulSize < iNumFonts * 6; ulSize <<= 1)
+    ;
+  Pool.ulHashMask = ulSize - 1;
+  Pool.pcbHash = (size_t *) calloc(ulSize, sizeof(size_t));
+  pCatalog = (FcCatalog_t *) calloc(1, sizeof(FcCatalog_t));
+  if (pCatalog)
+    pCatalog->pFonts = (FcFontRecord_t *) calloc(iNumFonts + 1, sizeof(FcFontRecord_t));
+  plOffsets = (long *) malloc((iNumFonts * 3 + 1) * sizeof(long));
+  if (!Pool.pcbHash || !pCatalog || !pCatalog->pFonts || !plOffsets)
+    goto failed;
+
+  /* the pool moves while it grows, so first collect the offsets */
+  for (i = 0, pDesc = pHead; pDesc; pDesc = pDesc->pNext, i++)
+  {
+    if ((plOffsets[i * 3] = PoolIntern(&Pool, pDesc->achFileName)) < 0 ||
+        (plOffsets[i * 3 + 1] = PoolIntern(&Pool, pDesc->achFamilyName)) < 0 ||
+        (plOffsets[i * 3 + 2] = PoolIntern(&Pool, pDesc->achStyleName)) < 0)
+      goto failed;
+  }
+  pCatalog->pchPool = Pool.pchPool ? (char *) realloc(Pool.pchPool, Pool.cbUsed) : NULL;
+  if (!pCatalog->pchPool)
+    pCatalog->pchPool = Pool.pchPool;
+  Pool.pchPool = NULL;
+
+  for (i = 0, pDesc = pHead; pDesc; pDesc = pDesc->pNext, i++)
+  {
+    pFont = pCatalog->pFonts + i;
+    pFont->pchFileName = pCatalog->pchPool + plOffsets[i * 3];
+    pFont->pchFamilyName = pCatalog->pchPool + plOffsets[i * 3 + 1];
+    pFont->pchStyleName = pCatalog->pchPool + plOffsets[i * 3 + 2];
+    pFont->cbSize = pDesc->FileStatus.st_size;
+    pFont->tMTime = pDesc->FileStatus.st_mtime;
+    pFont->lFontIndex = pDesc->lFontIndex;
+    pFont->iWeight = pDesc->iWeight;
+    pFont->iSlant = pDesc->iSlant;
+    pFont->iWidth = pDesc->iWidth;
+    memcpy(pFont->aulLangs, pDesc->aulLangs, sizeof(pFont->aulLangs));
+  }
+  pCatalog->iNumFonts = iNumFonts;
+
+  pCatalog->pFamilyIndex = FcFamilyIndexBuild(pCatalog->pFonts, iNumFonts);
+  if (!pCatalog->pFamilyIndex || !BuildLangIndex(pCatalog))
+    goto failed;
+
+  pCatalog->cbSize = sizeof(FcCatalog_t) + (iNumFonts + 1) * sizeof(FcFontRecord_t) +
+                     Pool.cbUsed + FcFamilyIndexSize(pCatalog->pFamilyIndex) +
+                     (FC_LANG_MAP_SIZE * 32 * pCatalog->iLangWords + 1) * sizeof(FcChar32);
+
+  /* nothing can fail anymore, take over the coverage */
+  for (i = 0, pDesc = pHead; pDesc; pDesc = pDesc->pNext, i++)
+  {
+    pCatalog->pFonts[i].pCharSet = pDesc->pCharSet;
+    if (pDesc->pCharSet)
+      pCatalog->cbSize += FcCharSetFrozenSize(pDesc->pCharSet);
+    pDesc->pCharSet = NULL;
+  }
+
+  free(Pool.pcbHash);
+  free(plOffsets);
+  pCatalog->iRefCount = 1;
+  pCatalog->ulSerial = (FcChar32) FcAtomicInc(&iLastSerial);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Font list snapshot %lu: %d fonts, %lu bytes of strings, %lu bytes in all\n",
+          (unsigned long) pCatalog->ulSerial, iNumFonts, (unsigned long) Pool.cbUsed,
+          (unsigned long) pCatalog->cbSize);
+#endif
+  return pCatalog;
+
+failed:
+  if (Pool.pcbHash)
+    free(Pool.pcbHash);
+  if (Pool.pchPool)
+    free(Pool.pchPool);
+  if (plOffsets)
+    free(plOffsets);
+  if (pCatalog)
+  {
+    if (pCatalog->pFonts)
+      free(pCatalog->pFonts);
+    if (pCatalog->pchPool)
+      free(pCatalog->pchPool);
+    if (pCatalog->pulLangFaces)
+      free(pCatalog->pulLangFaces);
+    FcFamilyIndexDestroy(pCatalog->pFamilyIndex);
+    free(pCatalog);
+  }
+  return NULL;
+}
+
+static void FreeCatalog(FcCatalog_t *pCatalog)
+{
+  int i;
+
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Freeing font list snapshot %lu\n", (unsigned long) pCatalog->ulSerial);
+#endif
+  FcFamilyIndexDestroy(pCatalog->pFamilyIndex);
+  free(pCatalog->pulLangFaces);
+  for (i = 0; i < pCatalog->iNumFonts; i++)
+    if (pCatalog->pFonts[i].pCharSet)
+      free(pCatalog->pFonts[i].pCharSet);
+  free(pCatalog->pFonts);
+  if (pCatalog->pchPool)
+    free(pCatalog->pchPool);
+  free(pCatalog);
+}
+
+/* Return a new reference to the current snapshot, NULL if there is none */
+FcCatalog_t *FcCatalogAcquire(void)
+{
+  FcCatalog_t *pCatalog;
+
+  FcAtomicInc(&iAcquiring);
+  pCatalog = pCurrentCatalog;
+  if (pCatalog)
+    FcAtomicInc(&pCatalog->iRefCount);
+  FcAtomicDec(&iAcquiring);
+  return pCatalog;
+}
+
+void FcCatalogReference(FcCatalog_t *pCatalog)
+{
+  if (pCatalog)
+    FcAtomicInc(&pCatalog->iRefCount);
+}
+
+void FcCatalogRelease(FcCatalog_t *pCatalog)
+{
+  if (pCatalog && !FcAtomicDec(&pCatalog->iRefCount))
+    FreeCatalog(pCatalog);
+}
+
+FcBool FcCatalogIsCurrent(const FcCatalog_t *pCatalog)
+{
+  return pCatalog == pCurrentCatalog;
+}
+
+/*
+ * Make a snapshot (or none, if NULL) the current one, taking over the
+ * reference of the caller. Only one thread may publish at a time.
+ */
+void FcCatalogPublish(FcCatalog_t *pCatalog)
+{
+  FcCatalog_t *pOld = pCurrentCatalog;
+
+  FcMemoryBarrier();
+  pCurrentCatalog = pCatalog;
+  FcMemoryBarrier();
+
+  /* readers coming in from now on get the new one, wait for those who
+   * might have picked up the old one to take their reference */
+  while (iAcquiring)
+    FcYield();
+
+  FcCatalogRelease(pOld);
+}
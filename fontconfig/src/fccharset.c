@@ -14,7 +14,7 @@
 
 #include "fcint.h"
 
-FcCharSet* FcCharSetCreate (void)
+fcExport FcCharSet* FcCharSetCreate (void)
 {
     FcCharSet	*fcs;
 
@@ -27,11 +27,13 @@ FcCharSet* FcCharSetCreate (void)
     fcs->numbers_offset = 0;
     return fcs;
 }
-void
+fcExport void
 FcCharSetDestroy (FcCharSet *fcs)
 {
     int i;
     
+    if (!fcs)
+	return;
     if (fcs->ref == FC_REF_CONSTANT)
     {
 	// FcCacheObjectDereference (fcs); because we cache different we just return
@@ -164,6 +166,657 @@ static FcBool FcCharSetInsertLeaf (FcCharSet *fcs, FcChar32 ucs4, FcCharLeaf *le
     return FcCharSetPutLeaf (fcs, ucs4, leaf, pos);
 }
 
+/*
+ * Return the leaf for ucs4, creating an empty one if it doesn't exist yet
+ */
+static FcCharLeaf *
+FcCharSetFindLeafCreate (FcCharSet *fcs, FcChar32 ucs4)
+{
+    int		    pos;
+    FcCharLeaf	    *leaf;
+
+    pos = FcCharSetFindLeafPos (fcs, ucs4);
+    if (pos >= 0)
+	return FcCharSetLeaf(fcs, pos);
+
+    leaf = calloc (1, sizeof (FcCharLeaf));
+    if (!leaf)
+	return 0;
+
+    pos = -pos - 1;
+    if (!FcCharSetPutLeaf (fcs, ucs4, leaf, pos))
+    {
+	free (leaf);
+	return 0;
+    }
+    return leaf;
+}
+
+fcExport FcBool
+FcCharSetAddChar (FcCharSet *fcs, FcChar32 ucs4)
+{
+    FcCharLeaf	*leaf;
+
+    if (!fcs || fcs->ref == FC_REF_CONSTANT)
+	return FcFalse;
+    leaf = FcCharSetFindLeafCreate (fcs, ucs4);
+    if (!leaf)
+	return FcFalse;
+    leaf->map[(ucs4 & 0xff) >> 5] |= ((FcChar32) 1 << (ucs4 & 0x1f));
+    return FcTrue;
+}
+
+/*
+ * Add the characters first to last. Whole words of a leaf are set at once,
+ * so long ranges like those of a font cmap go in quickly.
+ */
+FcBool
+FcCharSetAddRange (FcCharSet *fcs, FcChar32 first, FcChar32 last)
+{
+    FcCharLeaf	*leaf;
+    FcChar32	ucs4, end;
+    int		i;
+
+    if (!fcs || fcs->ref == FC_REF_CONSTANT)
+	return FcFalse;
+    for (ucs4 = first; ucs4 <= last; ucs4 = end + 1)
+    {
+	leaf = FcCharSetFindLeafCreate (fcs, ucs4);
+	if (!leaf)
+	    return FcFalse;
+	end = ucs4 | 0xff;
+	if (end > last)
+	    end = last;
+	for (i = (ucs4 & 0xff) >> 5; i <= (int) ((end & 0xff) >> 5); i++)
+	{
+	    FcChar32	bits = ~0;
+
+	    if (i == (int) ((ucs4 & 0xff) >> 5))
+		bits &= ~0U << (ucs4 & 0x1f);
+	    if (i == (int) ((end & 0xff) >> 5))
+		bits &= ~0U >> (31 - (end & 0x1f));
+	    leaf->map[i] |= bits;
+	}
+	if (end == 0xffffffff)
+	    break;
+    }
+    return FcTrue;
+}
+
+fcExport FcCharSet *
+FcCharSetCopy (FcCharSet *src)
+{
+    if (src && src->ref != FC_REF_CONSTANT)
+	src->ref++;
+    return src;
+}
+
+/*
+ * The set operations work on the leaves 64 bits at a time, in loops of a
+ * fixed length that the compiler unrolls, or turns into vector operations
+ * where the target has them. Two sets are walked together along their
+ * sorted page numbers, jumping ahead in one of them where the pages of the
+ * other can't matter, and nothing is allocated except for the result of
+ * FcCharSetUnion, FcCharSetIntersect and FcCharSetSubtract.
+ */
+typedef unsigned long long FcLeafWord;
+
+#define FC_LEAF_WORDS	((int) (sizeof (FcCharLeaf) / sizeof (FcLeafWord)))
+
+static const FcCharLeaf	fcEmptyLeaf;
+
+static FcLeafWord
+FcLeafWordGet (const FcCharLeaf *leaf, int i)
+{
+    FcLeafWord	w;
+
+    /* leaves of serialized sets may be unaligned */
+    memcpy (&w, (const char *) leaf->map + i * sizeof (w), sizeof (w));
+    return w;
+}
+
+static void
+FcLeafWordSet (FcCharLeaf *leaf, int i, FcLeafWord w)
+{
+    memcpy ((char *) leaf->map + i * sizeof (w), &w, sizeof (w));
+}
+
+/* the number of characters in a leaf */
+static FcChar32
+FcCharSetPopCount (const FcCharLeaf *leaf)
+{
+#ifdef __POPCNT__
+    FcChar32	count = 0;
+    int		j;
+
+    for (j = 0; j < FC_LEAF_WORDS; j++)
+	count += __builtin_popcountll (FcLeafWordGet (leaf, j));
+    return count;
+#else
+    FcLeafWord	w, bytes = 0;
+    int		j;
+
+    /* count the bits in pairs, nibbles and bytes of each word, add up the
+     * bytes of all words, then the 16 bit sums of those */
+    for (j = 0; j < FC_LEAF_WORDS; j++)
+    {
+	w = FcLeafWordGet (leaf, j);
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	bytes += (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    }
+    bytes = (bytes & 0x00ff00ff00ff00ffULL) + ((bytes >> 8) & 0x00ff00ff00ff00ffULL);
+    return (FcChar32) ((bytes * 0x0001000100010001ULL) >> 48);
+#endif
+}
+
+/* the page of leaf i of a set, or 0x10000 past the last one */
+static FcChar32
+FcCharSetPage (const FcCharSet *fcs, int i)
+{
+    return i < fcs->num ? FcCharSetNumbers(fcs)[i] : 0x10000;
+}
+
+/* move i forward to the first leaf of fcs at or after page */
+static int
+FcCharSetSkipTo (const FcCharSet *fcs, int i, FcChar32 page)
+{
+    if (page >= 0x10000)
+	return fcs->num;
+    i = FcCharSetFindLeafForward (fcs, i, (FcChar16) page);
+    return i < 0 ? -i - 1 : i;
+}
+
+fcExport FcBool
+FcCharSetHasChar (const FcCharSet *fcs, FcChar32 ucs4)
+{
+    int		pos;
+    FcCharLeaf	*leaf;
+
+    if (!fcs)
+	return FcFalse;
+    pos = FcCharSetFindLeafPos (fcs, ucs4);
+    if (pos < 0)
+	return FcFalse;
+    leaf = FcCharSetLeaf(fcs, pos);
+    return (leaf->map[(ucs4 & 0xff) >> 5] >> (ucs4 & 0x1f)) & 1;
+}
+
+/*
+ * Add the characters of b to a. If changed is not 0, it tells whether
+ * b had anything that a did not have yet.
+ */
+fcExport FcBool
+FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed)
+{
+    FcCharLeaf	*al, *bl;
+    FcLeafWord	aw, bw, added;
+    int		ai, bi, j;
+
+    if (changed)
+	*changed = FcFalse;
+    if (!a || a->ref == FC_REF_CONSTANT)
+	return FcFalse;
+    if (!b)
+	return FcTrue;
+
+    added = 0;
+    for (ai = 0, bi = 0; bi < b->num; bi++, ai++)
+    {
+	bl = FcCharSetLeaf(b, bi);
+	ai = FcCharSetFindLeafForward (a, ai, FcCharSetNumbers(b)[bi]);
+	if (ai < 0)
+	{
+	    /* a new page, it goes in as a copy of the leaf of b */
+	    ai = -ai - 1;
+	    al = malloc (sizeof (FcCharLeaf));
+	    if (!al)
+		return FcFalse;
+	    *al = *bl;
+	    if (!FcCharSetPutLeaf (a, (FcChar32) FcCharSetNumbers(b)[bi] << 8, al, ai))
+	    {
+		free (al);
+		return FcFalse;
+	    }
+	    for (j = 0; j < FC_LEAF_WORDS; j++)
+		added |= FcLeafWordGet (bl, j);
+	    continue;
+	}
+	al = FcCharSetLeaf(a, ai);
+	for (j = 0; j < FC_LEAF_WORDS; j++)
+	{
+	    aw = FcLeafWordGet (al, j);
+	    bw = FcLeafWordGet (bl, j);
+	    added |= bw & ~aw;
+	    FcLeafWordSet (al, j, aw | bw);
+	}
+    }
+    if (changed)
+	*changed = added != 0;
+    return FcTrue;
+}
+
+/*
+ * Return whether every character of a is also in b
+ */
+fcExport FcBool
+FcCharSetIsSubset (const FcCharSet *a, const FcCharSet *b)
+{
+    const FcCharLeaf	*al, *bl;
+    FcLeafWord		missing;
+    int			ai, bi, j;
+
+    if (a == b || !a)
+	return FcTrue;
+    bi = 0;
+    for (ai = 0; ai < a->num; ai++)
+    {
+	al = FcCharSetLeaf(a, ai);
+	/* both number arrays are sorted, so b can only go forward */
+	if (b && (bi = FcCharSetFindLeafForward (b, bi, FcCharSetNumbers(a)[ai])) >= 0)
+	    bl = FcCharSetLeaf(b, bi);
+	else
+	{
+	    /* fine only if the leaf of a is empty */
+	    if (b)
+		bi = -bi - 1;
+	    bl = &fcEmptyLeaf;
+	}
+	missing = 0;
+	for (j = 0; j < FC_LEAF_WORDS; j++)
+	    missing |= FcLeafWordGet (al, j) & ~FcLeafWordGet (bl, j);
+	if (missing)
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+fcExport FcChar32
+FcCharSetCount (const FcCharSet *a)
+{
+    FcChar32	count = 0;
+    int		i;
+
+    if (!a)
+	return 0;
+    for (i = 0; i < a->num; i++)
+	count += FcCharSetPopCount (FcCharSetLeaf(a, i));
+    return count;
+}
+
+typedef enum _FcCharSetOp {
+    FcCharSetOpUnion,
+    FcCharSetOpIntersect,
+    FcCharSetOpSubtract
+} FcCharSetOp;
+
+/*
+ * Walk the pages of a and b together and combine their leaves with op,
+ * missing leaves are empty. Each combined leaf is handed to the callback
+ * with the page it belongs to. Pages that can't give anything are skipped:
+ * those of only one set for an intersection, those of only b for a
+ * subtraction.
+ */
+static FcBool
+FcCharSetWalk (const FcCharSet *a, const FcCharSet *b, FcCharSetOp op,
+	       FcBool (*leaf_func) (FcChar32 page, const FcCharLeaf *leaf, void *closure),
+	       void *closure)
+{
+    const FcCharLeaf	*al, *bl;
+    FcCharLeaf		leaf;
+    FcChar32		an, bn, page;
+    FcLeafWord		aw, bw, any;
+    int			ai = 0, bi = 0;
+    int			j;
+
+    for (;;)
+    {
+	an = FcCharSetPage (a, ai);
+	bn = FcCharSetPage (b, bi);
+	if (an < bn)
+	{
+	    if (op == FcCharSetOpIntersect)
+	    {
+		ai = FcCharSetSkipTo (a, ai, bn);
+		continue;
+	    }
+	    page = an;
+	    al = FcCharSetLeaf(a, ai++);
+	    bl = &fcEmptyLeaf;
+	}
+	else if (bn < an)
+	{
+	    if (op != FcCharSetOpUnion)
+	    {
+		bi = FcCharSetSkipTo (b, bi, an);
+		continue;
+	    }
+	    page = bn;
+	    al = &fcEmptyLeaf;
+	    bl = FcCharSetLeaf(b, bi++);
+	}
+	else if (an < 0x10000)
+	{
+	    page = an;
+	    al = FcCharSetLeaf(a, ai++);
+	    bl = FcCharSetLeaf(b, bi++);
+	}
+	else
+	    break;
+
+	any = 0;
+	for (j = 0; j < FC_LEAF_WORDS; j++)
+	{
+	    aw = FcLeafWordGet (al, j);
+	    bw = FcLeafWordGet (bl, j);
+	    switch (op) {
+	    case FcCharSetOpUnion:	aw |= bw; break;
+	    case FcCharSetOpIntersect:	aw &= bw; break;
+	    case FcCharSetOpSubtract:	aw &= ~bw; break;
+	    }
+	    FcLeafWordSet (&leaf, j, aw);
+	    any |= aw;
+	}
+	if (any && !(*leaf_func) (page, &leaf, closure))
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+/* the pages come in order, so every leaf is appended */
+static FcBool
+FcCharSetAppendLeaf (FcChar32 page, const FcCharLeaf *leaf, void *closure)
+{
+    FcCharSet	*fcs = closure;
+    FcCharLeaf	*copy;
+
+    copy = malloc (sizeof (FcCharLeaf));
+    if (!copy)
+	return FcFalse;
+    *copy = *leaf;
+    if (!FcCharSetPutLeaf (fcs, page << 8, copy, fcs->num))
+    {
+	free (copy);
+	return FcFalse;
+    }
+    return FcTrue;
+}
+
+static FcBool
+FcCharSetCountLeaf (FcChar32 page, const FcCharLeaf *leaf, void *closure)
+{
+    FcChar32	*count = closure;
+
+    *count += FcCharSetPopCount (leaf);
+    return FcTrue;
+}
+
+static FcCharSet *
+FcCharSetOperate (const FcCharSet *a, const FcCharSet *b, FcCharSetOp op)
+{
+    FcCharSet	*fcs;
+
+    if (!a || !b)
+	return 0;
+    fcs = FcCharSetCreate ();
+    if (fcs && !FcCharSetWalk (a, b, op, FcCharSetAppendLeaf, fcs))
+    {
+	FcCharSetDestroy (fcs);
+	fcs = 0;
+    }
+    return fcs;
+}
+
+fcExport FcCharSet *
+FcCharSetUnion (const FcCharSet *a, const FcCharSet *b)
+{
+    return FcCharSetOperate (a, b, FcCharSetOpUnion);
+}
+
+fcExport FcCharSet *
+FcCharSetIntersect (const FcCharSet *a, const FcCharSet *b)
+{
+    return FcCharSetOperate (a, b, FcCharSetOpIntersect);
+}
+
+fcExport FcCharSet *
+FcCharSetSubtract (const FcCharSet *a, const FcCharSet *b)
+{
+    return FcCharSetOperate (a, b, FcCharSetOpSubtract);
+}
+
+fcExport FcChar32
+FcCharSetIntersectCount (const FcCharSet *a, const FcCharSet *b)
+{
+    FcChar32	count = 0;
+
+    if (a && b)
+	FcCharSetWalk (a, b, FcCharSetOpIntersect, FcCharSetCountLeaf, &count);
+    return count;
+}
+
+fcExport FcChar32
+FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b)
+{
+    FcChar32	count = 0;
+
+    if (a && b)
+	FcCharSetWalk (a, b, FcCharSetOpSubtract, FcCharSetCountLeaf, &count);
+    else if (a)
+	count = FcCharSetCount (a);
+    return count;
+}
+
+/*
+ * Two sets are equal if they have the same characters, whatever empty
+ * leaves either of them has
+ */
+fcExport FcBool
+FcCharSetEqual (const FcCharSet *a, const FcCharSet *b)
+{
+    if (a == b)
+	return FcTrue;
+    if (!a || !b)
+	return FcFalse;
+    return FcCharSetIsSubset (a, b) && FcCharSetIsSubset (b, a);
+}
+
+/*
+ * Coverage of a face, taken from its Unicode cmap. Fonts that only have a
+ * symbol cmap get their codes in the 0xF000 area mapped down to Latin-1 as
+ * well, as that is how such fonts are addressed.
+ */
+fcExport FcCharSet *
+FcFreeTypeCharSet (FT_Face face, FcBlanks *blanks)
+{
+    FcCharSet	*fcs;
+    FcCharLeaf	*leaf = 0;
+    FcChar32	page = (FcChar32) -1;
+    FT_ULong	ucs4;
+    FT_UInt	glyph;
+    FcBool	symbol = FcFalse;
+
+    if (!face)
+	return 0;
+    if (FT_Select_Charmap (face, FT_ENCODING_UNICODE) != 0)
+    {
+	if (FT_Select_Charmap (face, FT_ENCODING_MS_SYMBOL) != 0)
+	    return 0;
+	symbol = FcTrue;
+    }
+
+    fcs = FcCharSetCreate ();
+    if (!fcs)
+	return 0;
+
+    for (ucs4 = FT_Get_First_Char (face, &glyph); glyph;
+	 ucs4 = FT_Get_Next_Char (face, ucs4, &glyph))
+    {
+	/* the cmap is walked in ascending order, so remember the last leaf */
+	if ((ucs4 >> 8) != page)
+	{
+	    leaf = FcCharSetFindLeafCreate (fcs, ucs4);
+	    if (!leaf)
+		goto bail;
+	    page = ucs4 >> 8;
+	}
+	leaf->map[(ucs4 & 0xff) >> 5] |= ((FcChar32) 1 << (ucs4 & 0x1f));
+
+	if (symbol && ucs4 >= 0xF020 && ucs4 <= 0xF0FF &&
+	    !FcCharSetAddChar (fcs, ucs4 - 0xF000))
+	    goto bail;
+    }
+    return fcs;
+
+bail:
+    FcCharSetDestroy (fcs);
+    return 0;
+}
+
+fcExport FcCharSet *
+FcFreeTypeCharSetAndSpacing (FT_Face face, FcBlanks *blanks, int *spacing)
+{
+    if (spacing)
+	*spacing = FT_IS_FIXED_WIDTH (face) ? FC_MONO : FC_PROPORTIONAL;
+    return FcFreeTypeCharSet (face, blanks);
+}
+
+/*
+ * Charsets of the font descriptions are kept in a compact form: one block
+ * holding the FcCharSet, its leaf offsets, page numbers and leaves. They are
+ * marked constant, so FcCharSetDestroy() leaves them alone, and are freed
+ * with free() by their owner.
+ *
+ * The serialized form used by the caches is
+ *
+ *   FcChar32	 num
+ *   FcChar16	 numbers[num]
+ *   FcCharLeaf	 leaves[num]
+ *
+ * in host byte order, without any alignment.
+ */
+static size_t
+FcCharSetCompactSize (int num)
+{
+    /* keep the leaves aligned behind the 16 bit page numbers */
+    return sizeof (FcCharSet) + num * sizeof (intptr_t) +
+	   ((num * sizeof (FcChar16) + sizeof (intptr_t) - 1) & ~(sizeof (intptr_t) - 1)) +
+	   num * sizeof (FcCharLeaf);
+}
+
+static FcCharSet *
+FcCharSetCreateCompact (int num)
+{
+    FcCharSet	*fcs;
+    intptr_t	*leaves;
+    FcChar16	*numbers;
+    FcCharLeaf	*data;
+    size_t	size;
+    int		i;
+
+    size = FcCharSetCompactSize (num);
+    fcs = (FcCharSet *) malloc (size);
+    if (!fcs)
+	return 0;
+
+    leaves = (intptr_t *) (fcs + 1);
+    numbers = (FcChar16 *) (leaves + num);
+    data = (FcCharLeaf *) ((char *) fcs + size - num * sizeof (FcCharLeaf));
+
+    fcs->ref = FC_REF_CONSTANT;
+    fcs->num = num;
+    fcs->leaves_offset = FcPtrToOffset (fcs, leaves);
+    fcs->numbers_offset = FcPtrToOffset (fcs, numbers);
+    for (i = 0; i < num; i++)
+	leaves[i] = FcPtrToOffset (leaves, data + i);
+    return fcs;
+}
+
+/* Return a compact copy of a charset, see above */
+FcCharSet *
+FcCharSetFreeze (const FcCharSet *src)
+{
+    FcCharSet	*fcs;
+    int		i;
+
+    if (!src)
+	return 0;
+    fcs = FcCharSetCreateCompact (src->num);
+    if (!fcs)
+	return 0;
+    for (i = 0; i < src->num; i++)
+    {
+	FcCharSetNumbers(fcs)[i] = FcCharSetNumbers(src)[i];
+	*FcCharSetLeaf(fcs, i) = *FcCharSetLeaf(src, i);
+    }
+    return fcs;
+}
+
+/* Memory a compact charset takes */
+size_t
+FcCharSetFrozenSize (const FcCharSet *fcs)
+{
+    return FcCharSetCompactSize (fcs->num);
+}
+
+int
+FcCharSetSerializedSize (const FcCharSet *fcs)
+{
+    return sizeof (FcChar32) + fcs->num * (sizeof (FcChar16) + sizeof (FcCharLeaf));
+}
+
+void
+FcCharSetSerialize (const FcCharSet *fcs, void *buffer)
+{
+    FcChar8	*pos = (FcChar8 *) buffer;
+    FcChar32	num = fcs->num;
+    int		i;
+
+    memcpy (pos, &num, sizeof (num));
+    pos += sizeof (num);
+    memcpy (pos, FcCharSetNumbers(fcs), num * sizeof (FcChar16));
+    pos += num * sizeof (FcChar16);
+    for (i = 0; i < fcs->num; i++, pos += sizeof (FcCharLeaf))
+	memcpy (pos, FcCharSetLeaf(fcs, i), sizeof (FcCharLeaf));
+}
+
+/* Return a compact charset from its serialized form, or 0 if it's broken */
+FcCharSet *
+FcCharSetDeserialize (const void *buffer, int size)
+{
+    const FcChar8   *pos = (const FcChar8 *) buffer;
+    FcCharSet	    *fcs;
+    FcChar32	    num;
+    FcChar16	    *numbers;
+    int		    i;
+
+    if (size < (int) sizeof (num))
+	return 0;
+    memcpy (&num, pos, sizeof (num));
+    pos += sizeof (num);
+    if (num > 0x10000 ||
+	size != (int) (sizeof (num) + num * (sizeof (FcChar16) + sizeof (FcCharLeaf))))
+	return 0;
+
+    fcs = FcCharSetCreateCompact (num);
+    if (!fcs)
+	return 0;
+    numbers = FcCharSetNumbers(fcs);
+    memcpy (numbers, pos, num * sizeof (FcChar16));
+    pos += num * sizeof (FcChar16);
+    for (i = 0; i < (int) num; i++, pos += sizeof (FcCharLeaf))
+    {
+	/* the lookups depend on the pages being sorted */
+	if (i && numbers[i] <= numbers[i-1])
+	{
+	    free (fcs);
+	    return 0;
+	}
+	memcpy (FcCharSetLeaf(fcs, i), pos, sizeof (FcCharLeaf));
+    }
+    return fcs;
+}
+
 static const unsigned char	charToValue[256] = {
     /*     "" */ 0xff,  0xff,  0xff,  0xff,  0xff,  0xff,  0xff,  0xff, 
     /*   "\b" */ 0xff,  0xff,  0xff,  0xff,  0xff,  0xff,  0xff,  0xff, 
@@ -0,0 +1,549 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+#ifndef OS2
+
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Font directories to scan, separated by ':'. The FC_FONT_PATH environment
+ * variable replaces this list, a leading '~' stands for $HOME. */
+#define DEFAULT_FONT_PATH "/usr/share/fonts:/usr/local/share/fonts:~/.local/share/fonts:~/.fonts"
+#define FONT_PATH_SEPARATOR ':'
+
+#define BINCACHE_FILE_NAME "fccache-"FC_CACHE_VERSION_STRING".bin"
+
+/* protects against symlink loops below the font directories */
+#define MAX_SCAN_DEPTH 16
+
+/* where the faces of a font file come from */
+#define SCAN_SOURCE_FILE    0     /* opened by the scan threads */
+#define SCAN_SOURCE_CACHE   1     /* the old binary cache */
+#define SCAN_SOURCE_LIST    2     /* the font list that is being refreshed */
+
+/*
+ * A font file found while walking the directories. Files still in the font
+ * list or in the old cache are linked from there, the others are opened by
+ * the scan threads, which leave their faces in pFaces. Linking happens in
+ * the order the files were found, so the font list is the same for any
+ * thread count.
+ */
+typedef struct FcScanFile_s
+{
+  char                   *pchFileName;
+  struct stat             FileStatus;
+  int                     iSource;
+  FontDescriptionCache_t *pFaces;
+  int                     iNumFaces;
+} FcScanFile_t;
+
+typedef struct FcDirScan_s
+{
+  FT_Library      hLib;
+  FcBinCache     *pCache;
+  FcScanDir_t    *pDirs;
+  int             iNumDirs;
+  int             iDirsSize;
+  FcScanFile_t   *pFiles;
+  int             iNumFiles;
+  int             iFilesSize;
+  int             iNextFile;      /* next file for the scan threads */
+  pthread_mutex_t hMutex;
+} FcDirScan_t;
+
+/* only outline formats are of any use for us */
+static const char *apchFontExtensions[] =
+{
+  ".ttf", ".ttc", ".otf", ".otc", ".pfb", ".pfa", NULL
+};
+
+static FcBool IsFontFile(const char *pchName)
+{
+  const char *pchExt = strrchr(pchName, '.');
+  int i;
+
+  if (!pchExt)
+    return FcFalse;
+  for (i = 0; apchFontExtensions[i]; i++)
+    if (!stricmp(pchExt, apchFontExtensions[i]))
+      return FcTrue;
+  return FcFalse;
+}
+
+/* Return the font path with '~' expanded, to be freed by the caller */
+static char *GetFontPath(void)
+{
+  const char *pchPath = getenv("FC_FONT_PATH");
+  const char *pchHome = getenv("HOME");
+  const char *pch;
+  char *pchResult, *pchOut;
+  int iHomeLen = pchHome ? strlen(pchHome) : 0;
+  int iLen;
+
+  if (!pchPath || !pchPath[0])
+    pchPath = DEFAULT_FONT_PATH;
+
+  /* worst case, every character is a '~' */
+  iLen = strlen(pchPath);
+  pchResult = (char *) malloc(iLen * (iHomeLen + 1) + 1);
+  if (!pchResult)
+    return NULL;
+
+  for (pch = pchPath, pchOut = pchResult; *pch; pch++)
+  {
+    if ((*pch == '~') && pchHome &&
+        ((pch == pchPath) || (pch[-1] == FONT_PATH_SEPARATOR)))
+    {
+      memcpy(pchOut, pchHome, iHomeLen);
+      pchOut += iHomeLen;
+    } else
+      *pchOut++ = *pch;
+  }
+  *pchOut = 0;
+  return pchResult;
+}
+
+static FcBool IsDirectory(const char *pchPath)
+{
+  struct stat statBuf;
+
+  return (stat(pchPath, &statBuf) == 0) && S_ISDIR(statBuf.st_mode);
+}
+
+/* Find a place for the binary cache, in the same spirit as fccache.ini is
+ * placed on OS/2: the user's cache directory, then TEMP, then the current
+ * directory. FC_CACHE_FILE names the file explicitly. */
+static FcBool GetCacheFileName(char *pchBuffer, int iBufferSize)
+{
+  const char *pchEnvVar;
+  char achDir[CCHMAXPATH];
+
+  pchEnvVar = getenv("FC_CACHE_FILE");
+  if (pchEnvVar && pchEnvVar[0])
+    return snprintf(pchBuffer, iBufferSize, "%s", pchEnvVar) < iBufferSize;
+
+  achDir[0] = 0;
+  pchEnvVar = getenv("XDG_CACHE_HOME");
+  if (pchEnvVar && pchEnvVar[0] && IsDirectory(pchEnvVar))
+    snprintf(achDir, sizeof(achDir), "%s", pchEnvVar);
+
+  pchEnvVar = getenv("HOME");
+  if (!achDir[0] && pchEnvVar && pchEnvVar[0])
+  {
+    snprintf(achDir, sizeof(achDir), "%s/.cache", pchEnvVar);
+    if (!IsDirectory(achDir))
+      achDir[0] = 0;
+  }
+
+  pchEnvVar = getenv("TMPDIR");
+  if (!pchEnvVar)
+    pchEnvVar = getenv("TEMP");
+  if (!achDir[0] && pchEnvVar && pchEnvVar[0] && IsDirectory(pchEnvVar))
+    snprintf(achDir, sizeof(achDir), "%s", pchEnvVar);
+
+  if (!achDir[0])
+    return snprintf(pchBuffer, iBufferSize, "%s", BINCACHE_FILE_NAME) < iBufferSize;
+
+  return snprintf(pchBuffer, iBufferSize, "%s/%s", achDir, BINCACHE_FILE_NAME) < iBufferSize;
+}
+
+static FcBool AddDir(FcDirScan_t *pScan, const char *pchPath, time_t tMTime)
+{
+  if (pScan->iNumDirs >= pScan->iDirsSize)
+  {
+    int iNewSize = pScan->iDirsSize ? pScan->iDirsSize * 2 : 32;
+    FcScanDir_t *pNewDirs;
+
+    pNewDirs = (FcScanDir_t *) realloc(pScan->pDirs, iNewSize * sizeof(FcScanDir_t));
+    if (!pNewDirs)
+      return FcFalse;
+    pScan->pDirs = pNewDirs;
+    pScan->iDirsSize = iNewSize;
+  }
+
+  pScan->pDirs[pScan->iNumDirs].pchPath = strdup(pchPath);
+  if (!pScan->pDirs[pScan->iNumDirs].pchPath)
+    return FcFalse;
+  pScan->pDirs[pScan->iNumDirs].tMTime = tMTime;
+  pScan->iNumDirs++;
+  return FcTrue;
+}
+
+static FcBool AddFile(FcDirScan_t *pScan, const char *pchFileName,
+                      const struct stat *pStat)
+{
+  FcScanFile_t *pFile;
+
+  if (pScan->iNumFiles >= pScan->iFilesSize)
+  {
+    int iNewSize = pScan->iFilesSize ? pScan->iFilesSize * 2 : 256;
+    FcScanFile_t *pNewFiles;
+
+    pNewFiles = (FcScanFile_t *) realloc(pScan->pFiles, iNewSize * sizeof(FcScanFile_t));
+    if (!pNewFiles)
+      return FcFalse;
+    pScan->pFiles = pNewFiles;
+    pScan->iFilesSize = iNewSize;
+  }
+
+  pFile = pScan->pFiles + pScan->iNumFiles;
+  memset(pFile, 0, sizeof(*pFile));
+  pFile->pchFileName = strdup(pchFileName);
+  if (!pFile->pchFileName)
+    return FcFalse;
+  pFile->FileStatus = *pStat;
+  FcWatchAdd(pchFileName, pStat->st_mtime, pStat->st_size, FC_WATCH_FONT);
+  /* If the font list or the old cache still know this file, the faces
+   * come from there, unless it was reported changed. Size and time are
+   * not enough for a file rewritten within the same second. */
+  if (FcWatchFileChanged(pchFileName))
+    pFile->iSource = SCAN_SOURCE_FILE;
+  else if (FcFontDescriptionFindOld(pchFileName, pStat) >= 0)
+    pFile->iSource = SCAN_SOURCE_LIST;
+  else if (pScan->pCache &&
+           (FcBinCacheFindFile(pScan->pCache, pchFileName, pStat) >= 0))
+    pFile->iSource = SCAN_SOURCE_CACHE;
+  else
+    pFile->iSource = SCAN_SOURCE_FILE;
+  pScan->iNumFiles++;
+  return FcTrue;
+}
+
+/*
+ * Read all faces of a font file and fill in their descriptions. SFNT files
+ * are read directly, without FreeType loading the faces.
+ */
+static void ScanFontFile(FT_Library hLib, FcScanFile_t *pFile)
+{
+  FontDescriptionCache_p pDesc;
+  FcSfntFile *pSfnt;
+  long lNumFacesInFile;
+  long lCurFace;
+
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Scanning font file [%s]\n", pFile->pchFileName);
+#endif
+
+  lNumFacesInFile = FcFontFileOpen(hLib, pFile->pchFileName, &pSfnt);
+  if (!lNumFacesInFile)
+    return;
+
+  pFile->pFaces = (FontDescriptionCache_p) calloc(lNumFacesInFile, sizeof(FontDescriptionCache_t));
+  if (!pFile->pFaces)
+  {
+    FcSfntClose(pSfnt);
+    return;
+  }
+
+  for (lCurFace = 0; lCurFace < lNumFacesInFile; lCurFace++)
+  {
+    pDesc = pFile->pFaces + pFile->iNumFaces;
+    if (FcFontDescriptionRead(hLib, pSfnt, pDesc, pFile->pchFileName, lCurFace))
+    {
+      pDesc->FileStatus = pFile->FileStatus;
+      pFile->iNumFaces++;
+      /* the cache did not have it, or not as it is now */
+      FcStatsAdd(FC_STAT_CACHE_MISSES, 1);
+    }
+  }
+  FcSfntClose(pSfnt);
+}
+
+/* Take files off the list until none is left */
+static void ScanFiles(FcDirScan_t *pScan, FT_Library hLib)
+{
+  FcScanFile_t *pFile;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&pScan->hMutex);
+    while ((pScan->iNextFile < pScan->iNumFiles) &&
+           (pScan->pFiles[pScan->iNextFile].iSource != SCAN_SOURCE_FILE))
+      pScan->iNextFile++;
+    pFile = (pScan->iNextFile < pScan->iNumFiles) ? pScan->pFiles + pScan->iNextFile++ : NULL;
+    pthread_mutex_unlock(&pScan->hMutex);
+
+    if (!pFile)
+      break;
+    ScanFontFile(hLib, pFile);
+  }
+}
+
+/* FreeType libraries must not be shared between threads, so every scan
+ * thread brings its own */
+static void *ScanThread(void *pArg)
+{
+  FcDirScan_t *pScan = (FcDirScan_t *) pArg;
+  FT_Library hLib;
+
+  if (FT_Init_FreeType(&hLib))
+    return NULL;
+  ScanFiles(pScan, hLib);
+  FT_Done_FreeType(hLib);
+  return NULL;
+}
+
+/* Scan all files that are not known yet, then link all of them in order */
+static void ScanAndLinkFiles(FcDirScan_t *pScan)
+{
+  pthread_t ahThreads[MAX_SCAN_THREADS];
+  FcScanFile_t *pFile;
+  int iNumToScan, iNumThreads, iStarted;
+  int i, j;
+
+  for (i = 0, iNumToScan = 0; i < pScan->iNumFiles; i++)
+    if (pScan->pFiles[i].iSource == SCAN_SOURCE_FILE)
+      iNumToScan++;
+
+  if (iNumToScan)
+  {
+    iNumThreads = FcScanThreadCount(iNumToScan);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Scanning %d font files with %d threads\n", iNumToScan, iNumThreads);
+#endif
+
+    pthread_mutex_init(&pScan->hMutex, NULL);
+    pScan->iNextFile = 0;
+    /* the calling thread is one of the scanners */
+    for (iStarted = 0; iStarted < iNumThreads - 1; iStarted++)
+      if (pthread_create(ahThreads + iStarted, NULL, ScanThread, pScan))
+        break;
+    ScanFiles(pScan, pScan->hLib);
+    for (i = 0; i < iStarted; i++)
+      pthread_join(ahThreads[i], NULL);
+    pthread_mutex_destroy(&pScan->hMutex);
+  }
+
+  for (i = 0; i < pScan->iNumFiles; i++)
+  {
+    pFile = pScan->pFiles + i;
+    if (pFile->iSource == SCAN_SOURCE_LIST)
+      FcFontDescriptionReuse(pFile->pchFileName, &pFile->FileStatus);
+    else if (pFile->iSource == SCAN_SOURCE_CACHE)
+      FcBinCacheLinkFile(pScan->pCache, pFile->pchFileName, &pFile->FileStatus);
+    else
+    {
+      for (j = 0; j < pFile->iNumFaces; j++)
+        if (!FcFontDescriptionLink(pFile->pFaces + j) && pFile->pFaces[j].pCharSet)
+          free(pFile->pFaces[j].pCharSet);
+    }
+    if (pFile->pFaces)
+      free(pFile->pFaces);
+    free(pFile->pchFileName);
+  }
+  if (pScan->pFiles)
+    free(pScan->pFiles);
+  pScan->pFiles = NULL;
+  pScan->iNumFiles = 0;
+}
+
+static int CompareNames(const void *p1, const void *p2)
+{
+  return strcmp(*(const char **)p1, *(const char **)p2);
+}
+
+/* Scan a directory recursively. Entries are visited in sorted order, so the
+ * resulting font list does not depend on the order of the file system. */
+static void ScanDirectory(FcDirScan_t *pScan, const char *pchDir, int iDepth)
+{
+  struct stat statBuf;
+  struct dirent *pEntry;
+  DIR *pDir;
+  char **ppchNames = NULL;
+  int iNumNames = 0;
+  int iNamesSize = 0;
+  char achPath[CCHMAXPATH];
+  int i;
+
+  if ((stat(pchDir, &statBuf) == -1) || !S_ISDIR(statBuf.st_mode))
+  {
+    /* remember missing font directories, so that creating one is noticed */
+    if (iDepth == 0)
+    {
+      AddDir(pScan, pchDir, (time_t)-1);
+      FcWatchAdd(pchDir, (time_t)-1, 0, FC_WATCH_DIRECTORY);
+    }
+    return;
+  }
+
+  if (!AddDir(pScan, pchDir, statBuf.st_mtime))
+    return;
+  FcWatchAdd(pchDir, statBuf.st_mtime, 0, FC_WATCH_DIRECTORY);
+
+  pDir = opendir(pchDir);
+  if (!pDir)
+    return;
+
+  while ((pEntry = readdir(pDir)))
+  {
+    if (pEntry->d_name[0] == '.')
+      continue;
+
+    if (iNumNames >= iNamesSize)
+    {
+      char **ppchNew;
+
+      iNamesSize = iNamesSize ? iNamesSize * 2 : 64;
+      ppchNew = (char **) realloc(ppchNames, iNamesSize * sizeof(char *));
+      if (!ppchNew)
+        break;
+      ppchNames = ppchNew;
+    }
+    ppchNames[iNumNames] = strdup(pEntry->d_name);
+    if (!ppchNames[iNumNames])
+      break;
+    iNumNames++;
+  }
+  closedir(pDir);
+
+  if (iNumNames)
+    qsort(ppchNames, iNumNames, sizeof(char *), CompareNames);
+
+  for (i = 0; i < iNumNames; i++)
+  {
+    if (snprintf(achPath, sizeof(achPath), "%s/%s", pchDir, ppchNames[i]) < sizeof(achPath) &&
+        stat(achPath, &statBuf) == 0)
+    {
+      if (S_ISDIR(statBuf.st_mode))
+      {
+        if (iDepth < MAX_SCAN_DEPTH)
+          ScanDirectory(pScan, achPath, iDepth + 1);
+      }
+      else if (S_ISREG(statBuf.st_mode) && IsFontFile(ppchNames[i]))
+        AddFile(pScan, achPath, &statBuf);
+    }
+    free(ppchNames[i]);
+  }
+
+  if (ppchNames)
+    free(ppchNames);
+}
+
+/*
+ * Fill the font description list from the configured font directories.
+ * If the binary cache is current it is used as is, without looking at a
+ * single font file. Otherwise the directories are scanned, taking the
+ * descriptions of unchanged files from the old cache and opening the other
+ * files on several threads, and the cache is rewritten if that changed it.
+ */
+FcBool FcDirScanFonts(FT_Library hLib)
+{
+  FcDirScan_t Scan;
+  char achCacheFile[CCHMAXPATH];
+  char achRoot[CCHMAXPATH];
+  char *pchFontPath;
+  const char *pchRoot, *pchNext;
+  FcBool bHaveCacheFile;
+  int iLen;
+  int i;
+
+  pchFontPath = GetFontPath();
+  if (!pchFontPath)
+    return FcFalse;
+
+  memset(&Scan, 0, sizeof(Scan));
+  Scan.hLib = hLib;
+
+  bHaveCacheFile = GetCacheFileName(achCacheFile, sizeof(achCacheFile));
+  if (bHaveCacheFile)
+    Scan.pCache = FcBinCacheMap(achCacheFile);
+
+  /* files reported changed may look the same as in the cache */
+  if (Scan.pCache && !FcWatchFileChanged(NULL) &&
+      FcBinCacheIsCurrent(Scan.pCache, pchFontPath))
+  {
+    FcBool rc;
+
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Using cache file [%s]\n", achCacheFile);
+#endif
+    rc = FcBinCacheLinkAll(Scan.pCache);
+    FcBinCacheWatch(Scan.pCache);
+    FcBinCacheUnmap(Scan.pCache);
+    free(pchFontPath);
+    return rc;
+  }
+
+  for (pchRoot = pchFontPath; *pchRoot; pchRoot = pchNext)
+  {
+    pchNext = strchr(pchRoot, FONT_PATH_SEPARATOR);
+    if (!pchNext)
+      pchNext = pchRoot + strlen(pchRoot);
+    iLen = pchNext - pchRoot;
+    if (*pchNext)
+      pchNext++;
+
+    if ((iLen == 0) || (iLen >= sizeof(achRoot)))
+      continue;
+    memcpy(achRoot, pchRoot, iLen);
+    achRoot[iLen] = 0;
+    /* no trailing slashes, the paths are compared by name later */
+    while ((iLen > 1) && (achRoot[iLen-1] == '/'))
+      achRoot[--iLen] = 0;
+
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Scanning font directory [%s]\n", achRoot);
+#endif
+    ScanDirectory(&Scan, achRoot, 0);
+  }
+
+  ScanAndLinkFiles(&Scan);
+
+  if (bHaveCacheFile)
+    FcBinCacheWrite(achCacheFile, Scan.pCache, pchFontPath, Scan.pDirs, Scan.iNumDirs);
+  FcBinCacheUnmap(Scan.pCache);
+
+  for (i = 0; i < Scan.iNumDirs; i++)
+    free(Scan.pDirs[i].pchPath);
+  if (Scan.pDirs)
+    free(Scan.pDirs);
+  free(pchFontPath);
+
+  return FcTrue;
+}
+
+#endif /* !OS2 */
+
+/*
+ * The number of threads to open iNumFiles font files on, used by the
+ * profile scan as well. FC_SCAN_THREADS overrides the number of online
+ * processors, 1 scans on the calling thread only.
+ */
+int FcScanThreadCount(int iNumFiles)
+{
+  const char *pchEnvVar = getenv("FC_SCAN_THREADS");
+  long lThreads = 0;
+
+  if (pchEnvVar && pchEnvVar[0])
+    lThreads = atol(pchEnvVar);
+  if (lThreads <= 0)
+  {
+#ifdef OS2
+    ULONG ulProcessors = 1;
+
+    DosQuerySysInfo(QSV_NUMPROCESSORS, QSV_NUMPROCESSORS, &ulProcessors, sizeof(ULONG));
+    lThreads = ulProcessors;
+#else
+    lThreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  if (lThreads > MAX_SCAN_THREADS)
+    lThreads = MAX_SCAN_THREADS;
+  if (lThreads > iNumFiles)
+    lThreads = iNumFiles;
+  return (lThreads > 1) ? (int) lThreads : 1;
+}
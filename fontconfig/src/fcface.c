@@ -0,0 +1,234 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Pool of opened FreeType faces.
+ *
+ * Parsing a face is expensive, especially for the big CJK collections, and
+ * the same few fonts are asked for over and over again. The pool opens a
+ * face once and hands it to every pattern of that font asking for its
+ * FC_FT_FACE. Faces are identified by their file, face index, size and
+ * modification time, so a face survives a refresh of the font list as long
+ * as its file doesn't change. A face stays open while patterns use it, and
+ * the last FACE_POOL_IDLE faces nobody uses any more are kept open, too, the
+ * least recently used one is closed for a new one.
+ *
+ * The faces are opened on a FreeType library of the pool, so that opening
+ * one never waits for a scan of the fonts. hFaceLock serializes everything
+ * the pool does, FreeType wants faces to be opened and closed one at a time.
+ */
+
+#define FACE_POOL_BUCKETS   64      /* power of two */
+#define FACE_POOL_IDLE      16
+
+struct FcFaceEntry_s
+{
+  char                  *pchFileName;
+  long                   lFontIndex;
+  time_t                 tMTime;
+  off_t                  cbSize;
+  FcChar32               ulHash;
+  FT_Face                face;
+  int                    iRefCount;     /* patterns using the face */
+  struct FcFaceEntry_s  *pBucketNext;
+  struct FcFaceEntry_s  *pIdlePrev;     /* unused faces, most recent first */
+  struct FcFaceEntry_s  *pIdleNext;
+};
+
+static FT_Library     hFaceLib;
+static FcFaceEntry_t *apBuckets[FACE_POOL_BUCKETS];
+static FcFaceEntry_t *pIdleFirst;
+static FcFaceEntry_t *pIdleLast;
+static int            iNumIdle;
+static FcLock_t       hFaceLock;
+
+static void IdleUnlink(FcFaceEntry_t *pEntry)
+{
+  if (pEntry->pIdlePrev)
+    pEntry->pIdlePrev->pIdleNext = pEntry->pIdleNext;
+  else
+    pIdleFirst = pEntry->pIdleNext;
+  if (pEntry->pIdleNext)
+    pEntry->pIdleNext->pIdlePrev = pEntry->pIdlePrev;
+  else
+    pIdleLast = pEntry->pIdlePrev;
+  pEntry->pIdlePrev = pEntry->pIdleNext = NULL;
+  iNumIdle--;
+}
+
+/* close an unused face and forget about it */
+static void CloseEntry(FcFaceEntry_t *pEntry)
+{
+  FcFaceEntry_t **ppEntry;
+
+  for (ppEntry = apBuckets + (pEntry->ulHash & (FACE_POOL_BUCKETS - 1));
+       *ppEntry != pEntry; ppEntry = &(*ppEntry)->pBucketNext)
+    ;
+  *ppEntry = pEntry->pBucketNext;
+  IdleUnlink(pEntry);
+  FT_Done_Face(pEntry->face);
+  free(pEntry->pchFileName);
+  free(pEntry);
+}
+
+/*
+ * Get a reference to the face of a font, opening it if it isn't open yet.
+ * NULL if the face can't be opened. hFaceLock must be held.
+ */
+static FcFaceEntry_t *AcquireLocked(const char *pchFileName, long lFontIndex,
+                                    time_t tMTime, off_t cbSize)
+{
+  FcFaceEntry_t *pEntry;
+  FcChar32 ulHash;
+
+  ulHash = FcStringHash((const FcChar8 *) pchFileName) * 31 + (FcChar32) lFontIndex;
+  for (pEntry = apBuckets[ulHash & (FACE_POOL_BUCKETS - 1)]; pEntry; pEntry = pEntry->pBucketNext)
+  {
+    if (pEntry->ulHash == ulHash && pEntry->lFontIndex == lFontIndex &&
+        pEntry->tMTime == tMTime && pEntry->cbSize == cbSize &&
+        !strcmp(pEntry->pchFileName, pchFileName))
+    {
+      if (!pEntry->iRefCount++)
+        IdleUnlink(pEntry);
+      return pEntry;
+    }
+  }
+
+  if (!hFaceLib && FT_Init_FreeType(&hFaceLib))
+  {
+    hFaceLib = NULL;
+    return NULL;
+  }
+
+  pEntry = (FcFaceEntry_t *) calloc(1, sizeof(FcFaceEntry_t));
+  if (!pEntry)
+    return NULL;
+  pEntry->pchFileName = strdup(pchFileName);
+  if (!pEntry->pchFileName ||
+      FT_New_Face(hFaceLib, pchFileName, lFontIndex, &pEntry->face))
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Could not open face %ld of [%s]\n", lFontIndex, pchFileName);
+#endif
+    if (pEntry->pchFileName)
+      free(pEntry->pchFileName);
+    free(pEntry);
+    return NULL;
+  }
+  FcStatsAdd(FC_STAT_FACES_OPENED, 1);
+  pEntry->lFontIndex = lFontIndex;
+  pEntry->tMTime = tMTime;
+  pEntry->cbSize = cbSize;
+  pEntry->ulHash = ulHash;
+  pEntry->iRefCount = 1;
+  pEntry->pBucketNext = apBuckets[ulHash & (FACE_POOL_BUCKETS - 1)];
+  apBuckets[ulHash & (FACE_POOL_BUCKETS - 1)] = pEntry;
+  return pEntry;
+}
+
+static void ReleaseLocked(FcFaceEntry_t *pEntry)
+{
+  if (--pEntry->iRefCount)
+    return;
+
+  // keep it open for the next one asking for it
+  pEntry->pIdlePrev = NULL;
+  pEntry->pIdleNext = pIdleFirst;
+  if (pIdleFirst)
+    pIdleFirst->pIdlePrev = pEntry;
+  else
+    pIdleLast = pEntry;
+  pIdleFirst = pEntry;
+  iNumIdle++;
+  if (iNumIdle > FACE_POOL_IDLE)
+    CloseEntry(pIdleLast);
+}
+
+FcFaceEntry_t *FcFaceAcquire(const char *pchFileName, long lFontIndex,
+                             time_t tMTime, off_t cbSize)
+{
+  FcFaceEntry_t *pEntry;
+
+  FcLockAcquire(&hFaceLock);
+  pEntry = AcquireLocked(pchFileName, lFontIndex, tMTime, cbSize);
+  FcLockRelease(&hFaceLock);
+  return pEntry;
+}
+
+FT_Face FcFaceGet(const FcFaceEntry_t *pEntry)
+{
+  return pEntry->face;
+}
+
+void FcFaceRelease(FcFaceEntry_t *pEntry)
+{
+  if (!pEntry)
+    return;
+  FcLockAcquire(&hFaceLock);
+  ReleaseLocked(pEntry);
+  FcLockRelease(&hFaceLock);
+}
+
+/*
+ * The face of the font of a pattern. The pattern keeps its reference to the
+ * face until it is destroyed, so the face is valid as long as the pattern.
+ */
+FT_Face FcFaceOfPattern(const FcPattern *p)
+{
+  FcFontRecord_p pFont = p->pFontDesc;
+  FcFaceEntry_t *pEntry;
+
+  if (!pFont)
+    return NULL;
+  pEntry = p->pFaceEntry;
+  if (pEntry)
+    return pEntry->face;
+
+  // patterns are shared between threads, the first one sets the face
+  FcLockAcquire(&hFaceLock);
+  pEntry = p->pFaceEntry;
+  if (!pEntry)
+  {
+    pEntry = AcquireLocked(pFont->pchFileName, pFont->lFontIndex,
+                           pFont->tMTime, pFont->cbSize);
+    // the entry is complete before others can see it without the lock
+    FcMemoryBarrier();
+    ((FcPattern *) p)->pFaceEntry = pEntry;
+  }
+  FcLockRelease(&hFaceLock);
+  return pEntry ? pEntry->face : NULL;
+}
+
+/*
+ * Close the unused faces, and the library if no pattern uses a face any
+ * more. Faces still in use stay open, with their library.
+ */
+void FcFacePoolFini(void)
+{
+  int i;
+
+  FcLockAcquire(&hFaceLock);
+  while (pIdleLast)
+    CloseEntry(pIdleLast);
+  for (i = 0; i < FACE_POOL_BUCKETS && !apBuckets[i]; i++)
+    ;
+  if (i == FACE_POOL_BUCKETS && hFaceLib)
+  {
+    FT_Done_FreeType(hFaceLib);
+    hFaceLib = NULL;
+  }
+  FcLockRelease(&hFaceLock);
+}
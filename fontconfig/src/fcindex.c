@@ -0,0 +1,410 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Family name index over the fonts of the font list.
+ *
+ * Every distinct family (compared case insensitively, like stricmp does)
+ * gets one entry, which points to a run of faces in ppFaces. The faces of
+ * a run keep the order of the font list, so a lookup sees the
+ * faces of a family in the same order as a walk through the list would.
+ * Every snapshot of the font list has its own index, which is read only
+ * once it is built.
+ *
+ * For substring searches there is also a trigram index over the families:
+ * for every three letter sequence (case folded the way stristr() folds)
+ * the ascending list of the families containing it. A search intersects
+ * the lists of the trigrams of the wanted part, and only the families left
+ * over are compared with stristr().
+ */
+
+typedef struct FcFamilyEntry_s
+{
+  FcChar32    ulHash;
+  const char *pchFamily;
+  int         iFirst;
+  int         iCount;
+} FcFamilyEntry_t;
+
+struct FcFamilyIndex_s
+{
+  FcFamilyEntry_t        *pFamilies;
+  int                     iNumFamilies;
+  int                    *piFamilyHash;   /* family index + 1, 0 is empty */
+  FcChar32                ulFamilyHashMask;
+  FcFontRecord_p         *ppFaces;
+  FcFontRecord_t         *pFonts;         /* the font list */
+  int                     iNumFonts;
+  /* trigram index */
+  FcChar32               *pulTrigrams;    /* distinct trigrams, ascending */
+  int                    *piPostingStart; /* of every trigram, one more at the end */
+  int                    *piPostings;     /* family numbers */
+  int                     iNumTrigrams;
+  size_t                  cbSize;         /* memory all of it takes */
+};
+
+#define TRIGRAM(pch) (((FcChar32) FcToLower((FcChar8)(pch)[0]) << 16) | \
+                      ((FcChar32) FcToLower((FcChar8)(pch)[1]) << 8) | \
+                      (FcChar32) FcToLower((FcChar8)(pch)[2]))
+
+#define FoldedHash(pchName) FcStringHashIgnoreCase((const FcChar8 *)(pchName))
+
+static FcFamilyEntry_t *FindFamily(const FcFamilyIndex *pIndex, const char *pchFamily,
+                                   FcChar32 ulHash, int **ppiSlot)
+{
+  FcChar32 ulSlot = ulHash & pIndex->ulFamilyHashMask;
+  FcFamilyEntry_t *pEntry;
+
+  while (pIndex->piFamilyHash[ulSlot])
+  {
+    pEntry = pIndex->pFamilies + pIndex->piFamilyHash[ulSlot] - 1;
+    if ((pEntry->ulHash == ulHash) && !stricmp(pEntry->pchFamily, pchFamily))
+      return pEntry;
+    ulSlot = (ulSlot + 1) & pIndex->ulFamilyHashMask;
+  }
+  if (ppiSlot)
+    *ppiSlot = pIndex->piFamilyHash + ulSlot;
+  return NULL;
+}
+
+void FcFamilyIndexDestroy(FcFamilyIndex *pIndex)
+{
+  if (!pIndex)
+    return;
+  if (pIndex->pFamilies)
+    free(pIndex->pFamilies);
+  if (pIndex->piFamilyHash)
+    free(pIndex->piFamilyHash);
+  if (pIndex->ppFaces)
+    free(pIndex->ppFaces);
+  if (pIndex->pulTrigrams)
+    free(pIndex->pulTrigrams);
+  if (pIndex->piPostingStart)
+    free(pIndex->piPostingStart);
+  if (pIndex->piPostings)
+    free(pIndex->piPostings);
+  free(pIndex);
+}
+
+/* Memory the index takes */
+size_t FcFamilyIndexSize(const FcFamilyIndex *pIndex)
+{
+  return pIndex->cbSize;
+}
+
+static int CompareKeys(const void *p1, const void *p2)
+{
+  unsigned long long ullA = *(const unsigned long long *) p1;
+  unsigned long long ullB = *(const unsigned long long *) p2;
+
+  return (ullA < ullB) ? -1 : (ullA > ullB);
+}
+
+/* Build the trigram index over the families, FcFalse if out of memory */
+static FcBool BuildTrigrams(FcFamilyIndex *pIndex)
+{
+  unsigned long long *pullKeys;   /* trigram << 32 | family */
+  const char *pch;
+  int iNumKeys, iNumPostings, i;
+
+  for (i = 0, iNumKeys = 0; i < pIndex->iNumFamilies; i++)
+    for (pch = pIndex->pFamilies[i].pchFamily; pch[0] && pch[1] && pch[2]; pch++)
+      iNumKeys++;
+
+  pullKeys = (unsigned long long *) malloc((iNumKeys + 1) * sizeof(unsigned long long));
+  pIndex->pulTrigrams = (FcChar32 *) malloc((iNumKeys + 1) * sizeof(FcChar32));
+  pIndex->piPostingStart = (int *) malloc((iNumKeys + 2) * sizeof(int));
+  pIndex->piPostings = (int *) malloc((iNumKeys + 1) * sizeof(int));
+  if (!pullKeys || !pIndex->pulTrigrams || !pIndex->piPostingStart || !pIndex->piPostings)
+  {
+    if (pullKeys)
+      free(pullKeys);
+    return FcFalse;
+  }
+  pIndex->cbSize += (iNumKeys + 1) * (sizeof(FcChar32) + 2 * sizeof(int)) + sizeof(int);
+
+  for (i = 0, iNumKeys = 0; i < pIndex->iNumFamilies; i++)
+    for (pch = pIndex->pFamilies[i].pchFamily; pch[0] && pch[1] && pch[2]; pch++)
+      pullKeys[iNumKeys++] = ((unsigned long long) TRIGRAM(pch) << 32) | (FcChar32) i;
+  qsort(pullKeys, iNumKeys, sizeof(unsigned long long), CompareKeys);
+
+  /* the families of a trigram come out ascending, a family that has the
+   * same trigram twice is listed once */
+  for (i = 0, iNumPostings = 0; i < iNumKeys; i++)
+  {
+    if (i && (pullKeys[i] == pullKeys[i - 1]))
+      continue;
+    if (!i || ((pullKeys[i] >> 32) != (pullKeys[i - 1] >> 32)))
+    {
+      pIndex->pulTrigrams[pIndex->iNumTrigrams] = (FcChar32) (pullKeys[i] >> 32);
+      pIndex->piPostingStart[pIndex->iNumTrigrams++] = iNumPostings;
+    }
+    pIndex->piPostings[iNumPostings++] = (int) (pullKeys[i] & 0xFFFFFFFF);
+  }
+  pIndex->piPostingStart[pIndex->iNumTrigrams] = iNumPostings;
+
+  free(pullKeys);
+  return FcTrue;
+}
+
+/* Find the families containing a trigram, returns their number */
+static int FindTrigram(const FcFamilyIndex *pIndex, FcChar32 ulTrigram, const int **ppiFamilies)
+{
+  int iLow = 0, iHigh = pIndex->iNumTrigrams, iMid;
+
+  while (iLow < iHigh)
+  {
+    iMid = (iLow + iHigh) / 2;
+    if (pIndex->pulTrigrams[iMid] < ulTrigram)
+      iLow = iMid + 1;
+    else
+      iHigh = iMid;
+  }
+  if ((iLow >= pIndex->iNumTrigrams) || (pIndex->pulTrigrams[iLow] != ulTrigram))
+    return 0;
+
+  *ppiFamilies = pIndex->piPostings + pIndex->piPostingStart[iLow];
+  return pIndex->piPostingStart[iLow + 1] - pIndex->piPostingStart[iLow];
+}
+
+/* Build the index of the fonts of a list, NULL if out of memory */
+FcFamilyIndex *FcFamilyIndexBuild(FcFontRecord_t *pFonts, int iNumFonts)
+{
+  FcFamilyIndex *pIndex;
+  FcFontRecord_p pFont;
+  FcFamilyEntry_t *pEntry;
+  FcChar32 ulHash, ulSize;
+  int iFirst, i;
+  int *piSlot;
+
+  pIndex = (FcFamilyIndex *) calloc(1, sizeof(FcFamilyIndex));
+  if (!pIndex)
+    return NULL;
+  pIndex->pFonts = pFonts;
+  pIndex->iNumFonts = iNumFonts;
+
+  for (ulSize = 16; ulSize < iNumFonts * 2; ulSize <<= 1)
+    ;
+  pIndex->ulFamilyHashMask = ulSize - 1;
+  pIndex->piFamilyHash = (int *) calloc(ulSize, sizeof(int));
+  pIndex->pFamilies = (FcFamilyEntry_t *) malloc((iNumFonts + 1) * sizeof(FcFamilyEntry_t));
+  pIndex->ppFaces = (FcFontRecord_p *) malloc((iNumFonts + 1) * sizeof(FcFontRecord_p));
+  if (!pIndex->piFamilyHash || !pIndex->pFamilies || !pIndex->ppFaces)
+  {
+    FcFamilyIndexDestroy(pIndex);
+    return NULL;
+  }
+  pIndex->cbSize = sizeof(FcFamilyIndex) + ulSize * sizeof(int) +
+                   (iNumFonts + 1) * (sizeof(FcFamilyEntry_t) + sizeof(FcFontRecord_p));
+
+  /* first pass: find the distinct families and count their faces */
+  for (pFont = pFonts; pFont < pFonts + iNumFonts; pFont++)
+  {
+    ulHash = FoldedHash(pFont->pchFamilyName);
+    pEntry = FindFamily(pIndex, pFont->pchFamilyName, ulHash, &piSlot);
+    if (!pEntry)
+    {
+      pEntry = pIndex->pFamilies + pIndex->iNumFamilies++;
+      pEntry->ulHash = ulHash;
+      pEntry->pchFamily = pFont->pchFamilyName;
+      pEntry->iCount = 0;
+      *piSlot = pIndex->iNumFamilies;
+    }
+    pEntry->iCount++;
+  }
+
+  for (i = 0, iFirst = 0; i < pIndex->iNumFamilies; i++)
+  {
+    pIndex->pFamilies[i].iFirst = iFirst;
+    iFirst += pIndex->pFamilies[i].iCount;
+    pIndex->pFamilies[i].iCount = 0;
+  }
+
+  /* second pass: place the faces into the runs of their families */
+  for (pFont = pFonts; pFont < pFonts + iNumFonts; pFont++)
+  {
+    pEntry = FindFamily(pIndex, pFont->pchFamilyName, FoldedHash(pFont->pchFamilyName), NULL);
+    pIndex->ppFaces[pEntry->iFirst + pEntry->iCount++] = pFont;
+  }
+
+  if (!BuildTrigrams(pIndex))
+  {
+    FcFamilyIndexDestroy(pIndex);
+    return NULL;
+  }
+
+  return pIndex;
+}
+
+/*
+ * Return the faces of a family (matched case insensitively) and their
+ * number, or NULL if no installed font has this family name.
+ */
+FcFontRecord_p *FcFamilyIndexLookup(const FcFamilyIndex *pIndex,
+                                    const char *pchFamily, int *piCount)
+{
+  FcFamilyEntry_t *pEntry;
+
+  *piCount = 0;
+  if (!pIndex || !pchFamily)
+    return NULL;
+
+  pEntry = FindFamily(pIndex, pchFamily, FoldedHash(pchFamily), NULL);
+  if (!pEntry)
+    return NULL;
+
+  *piCount = pEntry->iCount;
+  return pIndex->ppFaces + pEntry->iFirst;
+}
+
+static int CompareFaces(const void *p1, const void *p2)
+{
+  FcFontRecord_p pA = *(const FcFontRecord_p *) p1;
+  FcFontRecord_p pB = *(const FcFontRecord_p *) p2;
+
+  return (pA < pB) ? -1 : (pA > pB);
+}
+
+/*
+ * Is a family in all lists? The families are tried in ascending order, so
+ * the cursors into the lists only ever move forward.
+ */
+static FcBool InAllLists(int iFamily, const int **ppiLists, const int *piLengths,
+                         int *piCursors, int iNumLists)
+{
+  int i;
+
+  for (i = 0; i < iNumLists; i++)
+  {
+    while ((piCursors[i] < piLengths[i]) && (ppiLists[i][piCursors[i]] < iFamily))
+      piCursors[i]++;
+    if ((piCursors[i] >= piLengths[i]) || (ppiLists[i][piCursors[i]] != iFamily))
+      return FcFalse;
+  }
+  return FcTrue;
+}
+
+/*
+ * Return the faces of all families containing pchPart (like stristr()
+ * finds it) in the order of the font list, and their number. The array is
+ * to be freed by the caller, it is NULL if no family matches.
+ */
+FcFontRecord_p *FcFamilyIndexSubstring(const FcFamilyIndex *pIndex,
+                                       const char *pchPart, int *piCount)
+{
+  FcFontRecord_p *ppResult = NULL;
+  char *pchMarks = NULL;
+  const int **ppiLists = NULL;
+  int *piLengths = NULL;
+  int *piCursors = NULL;
+  int *piMatches = NULL;
+  const int *piCandidates = NULL;
+  const FcFamilyEntry_t *pEntry;
+  int iNumLists, iNumCandidates, iNumMatches, iNumFaces;
+  int iShortest, iFamily, i, j;
+
+  *piCount = 0;
+  if (!pIndex || !pchPart || !pIndex->iNumFamilies)
+    return NULL;
+
+  iNumLists = strlen(pchPart) - 2;
+  if (iNumLists < 0)
+    iNumLists = 0;
+  ppiLists = (const int **) malloc((iNumLists + 1) * sizeof(int *));
+  piLengths = (int *) malloc((iNumLists + 1) * sizeof(int));
+  piCursors = (int *) calloc(iNumLists + 1, sizeof(int));
+  if (!ppiLists || !piLengths || !piCursors)
+    goto done;
+
+  /* the candidates are the families of the rarest trigram, or all of them
+   * if the part is too short to have trigrams */
+  iNumCandidates = pIndex->iNumFamilies;
+  for (i = 0, iShortest = -1; i < iNumLists; i++)
+  {
+    piLengths[i] = FindTrigram(pIndex, TRIGRAM(pchPart + i), ppiLists + i);
+    /* a trigram no family has */
+    if (!piLengths[i])
+      goto done;
+    if (piLengths[i] < iNumCandidates)
+    {
+      iShortest = i;
+      iNumCandidates = piLengths[i];
+    }
+  }
+  if (iShortest >= 0)
+    piCandidates = ppiLists[iShortest];
+
+  piMatches = (int *) malloc(iNumCandidates * sizeof(int));
+  if (!piMatches)
+    goto done;
+
+  for (i = 0, iNumMatches = 0, iNumFaces = 0; i < iNumCandidates; i++)
+  {
+    iFamily = piCandidates ? piCandidates[i] : i;
+    if (!InAllLists(iFamily, ppiLists, piLengths, piCursors, iNumLists))
+      continue;
+    /* the trigrams may be there, but not next to each other */
+    pEntry = pIndex->pFamilies + iFamily;
+    if (!stristr(pEntry->pchFamily, pchPart))
+      continue;
+    piMatches[iNumMatches++] = iFamily;
+    iNumFaces += pEntry->iCount;
+  }
+
+  if (!iNumFaces)
+    goto done;
+  ppResult = (FcFontRecord_p *) malloc(iNumFaces * sizeof(FcFontRecord_p));
+  if (!ppResult)
+    goto done;
+
+  /* the runs of the families are in list order each, merge them; for a
+   * good part of the list, marking the faces and walking the list is
+   * cheaper than sorting */
+  if (iNumFaces > pIndex->iNumFonts / 16)
+    pchMarks = (char *) calloc(pIndex->iNumFonts, 1);
+  for (i = 0; i < iNumMatches; i++)
+  {
+    pEntry = pIndex->pFamilies + piMatches[i];
+    if (pchMarks)
+      for (j = 0; j < pEntry->iCount; j++)
+        pchMarks[pIndex->ppFaces[pEntry->iFirst + j] - pIndex->pFonts] = 1;
+    else
+      memcpy(ppResult + *piCount, pIndex->ppFaces + pEntry->iFirst,
+             pEntry->iCount * sizeof(FcFontRecord_p));
+    *piCount += pEntry->iCount;
+  }
+  if (pchMarks)
+  {
+    for (i = 0, j = 0; i < pIndex->iNumFonts; i++)
+      if (pchMarks[i])
+        ppResult[j++] = pIndex->pFonts + i;
+  }
+  else
+    qsort(ppResult, *piCount, sizeof(FcFontRecord_p), CompareFaces);
+
+done:
+  if (ppiLists)
+    free((void *) ppiLists);
+  if (piLengths)
+    free(piLengths);
+  if (piCursors)
+    free(piCursors);
+  if (piMatches)
+    free(piMatches);
+  if (pchMarks)
+    free(pchMarks);
+  return ppResult;
+}
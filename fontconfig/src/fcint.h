@@ -17,15 +17,39 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <math.h> /* for fabs */
 #include <float.h> /* for DBL_EPSILON */
 #include <iconv.h>
+/* the input buffer of iconv() is const on OS/2, but not in POSIX */
+#ifndef ICONV_CONST
+#ifdef OS2
+#define ICONV_CONST const
+#else
+#define ICONV_CONST
+#endif
+#endif
+#ifdef OS2
 #define INCL_DOS
 #define INCL_WIN
 #define INCL_DOSERRORS
 #define INCL_SHLERRORS
 #include <os2.h>
+#else
+#include <stdint.h>
+#include <strings.h>
+#include <alloca.h>
+#include <sched.h>
+/* the font description cache is sized with the OS/2 constant, use a
+ * reasonable bound on other systems */
+#define CCHMAXPATH 1024
+#define stricmp  strcasecmp
+#define strnicmp strncasecmp
+#endif
 #include <fontconfig/fontconfig.h>
 #include <fontconfig/fcfreetype.h>
 #include <fontconfig/fcprivate.h>
@@ -34,11 +58,12 @@
 #include FT_FREETYPE_H
 #include FT_SFNT_NAMES_H
 #include FT_TRUETYPE_IDS_H
+#include FT_TRUETYPE_TABLES_H
 
 #ifdef FC_CACHE_VERSION_STRING
 #undef FC_CACHE_VERSION_STRING
 #endif
-#define FC_CACHE_VERSION_STRING "v1.3_with_GCC"
+#define FC_CACHE_VERSION_STRING "v1.5_with_GCC"
 
 #define FC_MEM_CHARSET	    0
 #define FC_MEM_CHARLEAF	    1
@@ -83,6 +108,26 @@
 # define fcExport
 #endif
 
+/*
+ * Atomic operations, for the reference counts of data shared between
+ * threads, and a simple lock on top of them. The lock is meant for short
+ * sections, waiters give up their time slice until it is free.
+ */
+#define FcAtomicInc(p)        __sync_add_and_fetch((p), 1)
+#define FcAtomicDec(p)        __sync_sub_and_fetch((p), 1)
+#define FcMemoryBarrier()     __sync_synchronize()
+
+#ifdef OS2
+#define FcYield()             DosSleep(0)
+#else
+#define FcYield()             sched_yield()
+#endif
+
+typedef volatile int FcLock_t;
+#define FcLockTry(l)          (!__sync_lock_test_and_set((l), 1))
+#define FcLockAcquire(l)      do { while (!FcLockTry(l)) FcYield(); } while (0)
+#define FcLockRelease(l)      __sync_lock_release(l)
+
 // #define LOOKUP_SFNT_NAME_DEBUG
 // #define FONTCONFIG_DEBUG_PRINTF
 // #define MATCH_DEBUG
@@ -94,7 +139,12 @@
 #define DEFAULT_SYMBOL_FONT         "Symbol Set"
 #define DEFAULT_DINGBATS_FONT       "DejaVu Sans"
 
-/* structure for the font cache in OS2.INI  */
+/* words of a language bitmap, one bit for every orthography of fclang.h
+ * (NUM_LANG_SET_MAP there) */
+#define FC_LANG_MAP_SIZE            8
+
+/* structure for the font cache in OS2.INI, and the description of a font
+ * while the font list is being built */
 typedef struct FontDescriptionCache_s
 {
   char achFileName[CCHMAXPATH];
@@ -102,15 +152,94 @@ typedef struct FontDescriptionCache_s
   char achFamilyName[128];
   char achStyleName[128];
   long lFontIndex;
+  int iWeight;       /* FC_WEIGHT_* of the face */
+  int iSlant;        /* FC_SLANT_* of the face */
+  int iWidth;        /* FC_WIDTH_* of the face */
+  FcCharSet *pCharSet; /* coverage of the face (compact, owned by the entry) */
+  FcChar32 aulLangs[FC_LANG_MAP_SIZE]; /* languages the coverage is good for */
 
   struct FontDescriptionCache_s *pNext;
 } FontDescriptionCache_t, *FontDescriptionCache_p;
 
+/*
+ * What a font description is made from, read either from an opened FreeType
+ * face or straight from an SFNT file (see fcsfnt.c).
+ */
+typedef struct FcSfntFile_s FcSfntFile;
+
+typedef struct FcFaceInfo_s
+{
+  const FT_SfntName *pNames;        /* the records of the name table */
+  FT_UInt            nNames;
+  const char        *pchFamilyName; /* names as FreeType has them, or NULL */
+  const char        *pchStyleName;
+  const TT_OS2      *pOS2;          /* NULL if the face has no OS/2 table */
+  FT_Long            lStyleFlags;   /* FT_STYLE_FLAG_* */
+  FcCharSet         *pCharSet;      /* Unicode coverage, or NULL */
+} FcFaceInfo_t;
+
+/*
+ * A font of a published font list. The records of a list are one array, and
+ * their strings are stored in one pool, every distinct string only once, so
+ * the list takes a fraction of the memory of the descriptions it was built
+ * from, and walking it runs straight through memory.
+ */
+typedef struct FcFontRecord_s
+{
+  const char *pchFileName;   /* in the string pool of the list */
+  const char *pchFamilyName;
+  const char *pchStyleName;
+  off_t       cbSize;        /* size and modification time of the file */
+  time_t      tMTime;
+  long        lFontIndex;
+  int         iWeight;       /* FC_WEIGHT_* of the face */
+  int         iSlant;        /* FC_SLANT_* of the face */
+  int         iWidth;        /* FC_WIDTH_* of the face */
+  FcCharSet  *pCharSet;      /* coverage of the face (compact, owned) */
+  FcChar32    aulLangs[FC_LANG_MAP_SIZE]; /* languages it covers */
+} FcFontRecord_t, *FcFontRecord_p;
+
+typedef struct FcFamilyIndex_s FcFamilyIndex;
+
+/*
+ * A snapshot of the font list. Once published it is never changed, so any
+ * number of threads can read it without locking. Readers take a reference
+ * for as long as they use it, and so does every pattern pointing to one of
+ * its fonts; the last one to let go frees it.
+ */
+typedef struct FcCatalog_s
+{
+  volatile int           iRefCount;
+  FcChar32               ulSerial;     /* unique, unlike the address */
+  FcFontRecord_t        *pFonts;       /* the fonts, in list order */
+  int                    iNumFonts;
+  char                  *pchPool;      /* the strings of the fonts */
+  FcFamilyIndex         *pFamilyIndex;
+  FcChar32              *pulLangFaces; /* per language bit, a bitmap of the */
+  int                    iLangWords;   /* fonts covering it, iLangWords long */
+  size_t                 cbSize;       /* memory all of it takes */
+} FcCatalog_t;
+
+/* A family substitution rule, see fcsubst.c */
+typedef struct FcSubstRule_s
+{
+  const char            *pchName;       /* the family asked for */
+  const char            *pchLang;       /* NULL for all languages */
+  const char           **ppchFamilies;  /* the families to try, in order */
+  int                    iNumFamilies;
+  FcChar32               ulHash;        /* of pchName, case insensitive */
+  struct FcSubstRule_s  *pNext;         /* all rules, in the order read */
+  struct FcSubstRule_s  *pBucketNext;
+} FcSubstRule_t;
+
+typedef struct FcFaceEntry_s FcFaceEntry_t;
+
 struct _FcPattern
 {
     char *family;
     int slant;
     int weight;
+    int width;
     double pixelsize;
     int spacing;
     FcBool hinting;
@@ -125,10 +254,19 @@ struct _FcPattern
     double size;
     char *style;
     FT_Face face;
-    int ref;
+    volatile int ref;
     char *lang;
-    FontDescriptionCache_p pFontDesc;
+    FcFontRecord_p pFontDesc;
+    FcCatalog_t *pCatalog; /* holds a reference, keeps pFontDesc valid */
     FcLangSet *langset;
+    FcChar32 hash;        /* FcPatternHash(), 0 if not computed yet */
+    FcBool interned;      /* canonical pattern of FcPatternIntern() */
+    struct _FcPattern *internnext;
+    unsigned long long ullObjects; /* FcObjectBit() of what it has, 0 all */
+    struct FcPatternArena_s *pArena; /* block of FcFontList(), or NULL */
+    const FcSubstRule_t *pSubst; /* rule found by FcConfigSubstitute() */
+    FcBool substituted;   /* pSubst is set, until the pattern changes */
+    FcFaceEntry_t * volatile pFaceEntry; /* pooled face of pFontDesc, or NULL */
 };
 
 struct _FcCharSet {
@@ -146,7 +284,9 @@ struct _FcStrSet {
     int		    ref;	/* reference count */
     int		    num;
     int		    size;
-    FcChar8	    **strs;
+    FcChar8	    **strs;	/* in the order they were added */
+    int		    *hash;	/* index + 1 into strs, 0 if empty, or 0 */
+    int		    hash_mask;
 };
 
 struct _FcStrList {
@@ -170,6 +310,206 @@ struct _FcStrList {
 
 typedef int FcObject;
 
-void *pConfig;
+/* ids of the standard objects, in the order of _FcBaseObjectTypes in fcname.c */
+#define FC_INVALID_OBJECT          0
+#define FC_FAMILY_OBJECT           1
+#define FC_FAMILYLANG_OBJECT       2
+#define FC_STYLE_OBJECT            3
+#define FC_STYLELANG_OBJECT        4
+#define FC_FULLNAME_OBJECT         5
+#define FC_FULLNAMELANG_OBJECT     6
+#define FC_SLANT_OBJECT            7
+#define FC_WEIGHT_OBJECT           8
+#define FC_WIDTH_OBJECT            9
+#define FC_SIZE_OBJECT             10
+#define FC_ASPECT_OBJECT           11
+#define FC_PIXEL_SIZE_OBJECT       12
+#define FC_SPACING_OBJECT          13
+#define FC_FOUNDRY_OBJECT          14
+#define FC_ANTIALIAS_OBJECT        15
+#define FC_HINT_STYLE_OBJECT       16
+#define FC_HINTING_OBJECT          17
+#define FC_VERTICAL_LAYOUT_OBJECT  18
+#define FC_AUTOHINT_OBJECT         19
+#define FC_GLOBAL_ADVANCE_OBJECT   20
+#define FC_FILE_OBJECT             21
+#define FC_INDEX_OBJECT            22
+#define FC_RASTERIZER_OBJECT       23
+#define FC_OUTLINE_OBJECT          24
+#define FC_SCALABLE_OBJECT         25
+#define FC_DPI_OBJECT              26
+#define FC_RGBA_OBJECT             27
+#define FC_SCALE_OBJECT            28
+#define FC_MINSPACE_OBJECT         29
+#define FC_CHAR_WIDTH_OBJECT       30
+#define FC_CHAR_HEIGHT_OBJECT      31
+#define FC_MATRIX_OBJECT           32
+#define FC_CHARSET_OBJECT          33
+#define FC_LANG_OBJECT             34
+#define FC_FONTVERSION_OBJECT      35
+#define FC_CAPABILITY_OBJECT       36
+#define FC_FONTFORMAT_OBJECT       37
+#define FC_EMBOLDEN_OBJECT         38
+#define FC_EMBEDDED_BITMAP_OBJECT  39
+#define FC_DECORATIVE_OBJECT       40
+#define FC_LCD_FILTER_OBJECT       41
+#define FC_MAX_BASE_OBJECT         FC_LCD_FILTER_OBJECT
+
+/*
+ * The patterns FcFontList() returns only have the objects of its object
+ * set, and the ones added to them later.
+ */
+#define FcObjectBit(o)             (1ULL << (o))
+#define FcPatternHasObject(p,o)    (!(p)->ullObjects || ((p)->ullObjects & FcObjectBit(o)))
+
+extern void *pConfig;
+
+/* fccharset.c */
+FcCharSet *FcNameParseCharSet(FcChar8 *string);
+FcCharSet *FcCharSetFreeze(const FcCharSet *src);
+size_t FcCharSetFrozenSize(const FcCharSet *fcs);
+int FcCharSetSerializedSize(const FcCharSet *fcs);
+void FcCharSetSerialize(const FcCharSet *fcs, void *buffer);
+FcCharSet *FcCharSetDeserialize(const void *buffer, int size);
+FcBool FcCharSetAddRange(FcCharSet *fcs, FcChar32 first, FcChar32 last);
+
+/* fclang.c */
+FcLangSet *FcNameParseLangSet(const FcChar8 *string);
+void FcLangMapOfCharSet(const FcCharSet *fcs, FcChar32 *map);
+FcBool FcLangSetFaces(const FcLangSet *ls, const FcCatalog_t *pCatalog, FcChar32 *faces);
+
+/* fcname.c */
+FcBool FcObjectInit(void);
+FcObject FcObjectFromName(const char *object);
+const char *FcObjectName(FcObject id);
+
+/* fcpat.c */
+FcChar32 FcStringHash(const FcChar8 *s);
+FcChar32 FcStringHashIgnoreCase(const FcChar8 *s);
+FcBool FcPatternBeginChange(FcPattern *p);
+FcPattern *FcPatternArenaCreate(FcCatalog_t *pCatalog, int iNumPatterns);
+const FcChar8 *FcStrStaticName(const FcChar8 *name);
+
+/* fcsubst.c - family substitution rules */
+FcBool FcSubstLoad(void);
+const FcSubstRule_t *FcSubstFind(const FcPattern *p);
+const FcSubstRule_t *FcSubstFallback(const FcPattern *p);
+void FcSubstApply(FcPattern *p);
+
+/* fcface.c - pool of opened FreeType faces */
+FcFaceEntry_t *FcFaceAcquire(const char *pchFileName, long lFontIndex,
+                             time_t tMTime, off_t cbSize);
+FT_Face FcFaceGet(const FcFaceEntry_t *pEntry);
+void FcFaceRelease(FcFaceEntry_t *pEntry);
+FT_Face FcFaceOfPattern(const FcPattern *p);
+void FcFacePoolFini(void);
+
+/* fontconfig.c */
+int FcFontDescriptionFill(FontDescriptionCache_p pFontCache, FT_Face ftface,
+                          const char *pchFontFileName, long lFaceIndex);
+long FcFontFileOpen(FT_Library hLib, const char *pchFileName, FcSfntFile **ppSfnt);
+int FcFontDescriptionRead(FT_Library hLib, FcSfntFile *pSfnt, FontDescriptionCache_p pFontCache,
+                          const char *pchFontFileName, long lFaceIndex);
+FcBool FcFontDescriptionLink(const FontDescriptionCache_t *pFontDesc);
+FontDescriptionCache_p FcFontDescriptionFirst(void);
+void FcFontDescriptionFree(FontDescriptionCache_p pFontDesc);
+int FcFontDescriptionFindOld(const char *pchFileName, const struct stat *pStat);
+int FcFontDescriptionReuse(const char *pchFileName, const struct stat *pStat);
+char *stristr(const char *str1, const char *str2);
+
+/* fcsfnt.c - reads the face information straight from SFNT files */
+FcSfntFile *FcSfntOpen(const char *pchFileName, long *plNumFaces);
+FcBool FcSfntReadFace(FcSfntFile *pFile, long lFaceIndex, FcFaceInfo_t *pInfo);
+void FcSfntFaceDone(FcFaceInfo_t *pInfo);
+void FcSfntClose(FcSfntFile *pFile);
+
+/* fcindex.c - family name index over the font description list */
+FcFamilyIndex *FcFamilyIndexBuild(FcFontRecord_t *pFonts, int iNumFonts);
+void FcFamilyIndexDestroy(FcFamilyIndex *pIndex);
+size_t FcFamilyIndexSize(const FcFamilyIndex *pIndex);
+FcFontRecord_p *FcFamilyIndexLookup(const FcFamilyIndex *pIndex,
+                                    const char *pchFamily, int *piCount);
+FcFontRecord_p *FcFamilyIndexSubstring(const FcFamilyIndex *pIndex,
+                                       const char *pchPart, int *piCount);
+
+/* fccatalog.c - reference counted snapshots of the font list */
+FcCatalog_t *FcCatalogCreate(FontDescriptionCache_p pHead);
+FcCatalog_t *FcCatalogAcquire(void);
+void FcCatalogReference(FcCatalog_t *pCatalog);
+void FcCatalogRelease(FcCatalog_t *pCatalog);
+FcBool FcCatalogIsCurrent(const FcCatalog_t *pCatalog);
+void FcCatalogPublish(FcCatalog_t *pCatalog);
+
+/* fcwatch.c - notices changes of the font directories and files */
+#define FC_WATCH_DIRECTORY  0     /* a font directory */
+#define FC_WATCH_FONT       1     /* a font file, noticed through its directory */
+
+void FcWatchBegin(void);
+void FcWatchAdd(const char *pchPath, time_t tMTime, off_t cbSize, int iKind);
+void FcWatchEnd(void);
+FcBool FcWatchUptoDate(void);
+FcBool FcWatchFileChanged(const char *pchFileName);
+void FcWatchStop(void);
+
+/* fcmemo.c - memo of recent FcFontMatch() results */
+void FcMatchMemoClear(void);
+FcBool FcMatchMemoLookup(const FcCatalog_t *pCatalog, const FcPattern *p,
+                         FcPattern **ppResult);
+void FcMatchMemoInsert(const FcCatalog_t *pCatalog, const FcPattern *p,
+                       FcPattern *pResult);
+
+/* fcstats.c - the counters of FcStatsGet() */
+#define FC_STAT_FACES_SCANNED       0
+#define FC_STAT_FACES_OPENED        1
+#define FC_STAT_CACHE_HITS          2
+#define FC_STAT_CACHE_MISSES        3
+#define FC_STAT_FACES_REUSED        4   /* taken over from the list being refreshed */
+#define FC_STAT_MATCH_CALLS         5
+#define FC_STAT_MATCH_MEMO_HITS     6
+#define FC_STAT_MATCH_FACES         7
+#define FC_STAT_MATCH_EXACT         8
+#define FC_STAT_MATCH_ALIAS         9
+#define FC_STAT_MATCH_SUBSTRING     10
+#define FC_STAT_MATCH_NONE          11
+#define FC_STAT_INITS               12
+#define FC_STAT_REINITS             13
+#define FC_STAT_NUM_COUNTERS        14
+
+void FcStatsAdd(int iCounter, unsigned long ulValue);
+unsigned long long FcStatsNow(void);
+void FcStatsInitDone(FcBool bReinit, unsigned long long ullStart);
+
+/* fcdir.c - the scan threads of both backends */
+#define MAX_SCAN_THREADS 32
+
+int FcScanThreadCount(int iNumFiles);
+
+#ifndef OS2
+/* a directory visited by the directory scanner, with its modification
+ * time ((time_t)-1 if it does not exist) */
+typedef struct FcScanDir_s
+{
+  char *pchPath;
+  time_t tMTime;
+} FcScanDir_t;
+
+/* fccache.c - the mmap'able binary font description cache */
+typedef struct FcBinCache_s FcBinCache;
+
+FcBinCache *FcBinCacheMap(const char *pchCacheFile);
+void FcBinCacheUnmap(FcBinCache *pCache);
+FcBool FcBinCacheIsCurrent(const FcBinCache *pCache, const char *pchFontPath);
+FcBool FcBinCacheLinkAll(const FcBinCache *pCache);
+void FcBinCacheWatch(const FcBinCache *pCache);
+int FcBinCacheFindFile(FcBinCache *pCache, const char *pchFileName,
+                       const struct stat *pStat);
+int FcBinCacheLinkFile(FcBinCache *pCache, const char *pchFileName,
+                       const struct stat *pStat);
+FcBool FcBinCacheWrite(const char *pchCacheFile, const FcBinCache *pOldCache,
+                       const char *pchFontPath, const FcScanDir_t *pDirs, int iNumDirs);
+
+/* fcdir.c - font directory scanning backend */
+FcBool FcDirScanFonts(FT_Library hLib);
+#endif
 
 #endif /* _FCINT_H_ */
@@ -138,6 +138,109 @@ FcLangResult FcLangCompare (const FcChar8 *s1, const FcChar8 *s2)
     }
 }
 
+/*
+ * The orthographies of the same language ("pa", "pa-in" and "pa-pk") follow
+ * each other in fcLangCharSets. For each of them we keep the bits of all
+ * orthographies of its language, and the index of the one without a
+ * territory (or -1), so that languages can be looked up in a set with a
+ * few bitmap operations instead of comparing their names. The tables are
+ * built on first use.
+ */
+static FcChar32	    fcLangGroupMaps[NUM_LANG_CHAR_SET][NUM_LANG_SET_MAP];
+static short	    fcLangGroupBase[NUM_LANG_CHAR_SET];
+static volatile int fcLangGroupsReady;
+static FcLock_t	    fcLangGroupsLock;
+
+typedef char FcLangMapSizeCheck[FC_LANG_MAP_SIZE == NUM_LANG_SET_MAP ? 1 : -1];
+
+static void FcLangGroupsInit (void)
+{
+    FcChar32	map[NUM_LANG_SET_MAP];
+    int		first, i, base, bit;
+
+    if (fcLangGroupsReady)
+	return;
+    FcLockAcquire (&fcLangGroupsLock);
+    if (!fcLangGroupsReady)
+    {
+	for (first = 0; first < NUM_LANG_CHAR_SET; first = i)
+	{
+	    memset (map, '\0', sizeof (map));
+	    base = -1;
+	    for (i = first; i < NUM_LANG_CHAR_SET; i++)
+	    {
+		if (i > first &&
+		    FcLangCompare (fcLangCharSets[first].lang,
+				   fcLangCharSets[i].lang) == FcLangDifferentLang)
+		    break;
+		bit = fcLangCharSetIndices[i];
+		map[bit >> 5] |= (FcChar32) 1 << (bit & 0x1f);
+		if (!strchr ((const char *) fcLangCharSets[i].lang, '-'))
+		    base = i;
+	    }
+	    while (first < i)
+	    {
+		memcpy (fcLangGroupMaps[first], map, sizeof (map));
+		fcLangGroupBase[first++] = base;
+	    }
+	}
+	FcMemoryBarrier ();
+	fcLangGroupsReady = FcTrue;
+    }
+    FcLockRelease (&fcLangGroupsLock);
+}
+
+/*
+ * Return the index of an orthography of the language of lang, or -1 if
+ * there is none. id is what FcLangSetIndex returned for lang.
+ */
+static int FcLangGroup (const FcChar8 *lang, int id)
+{
+    if (id >= 0)
+	return id;
+    /* the orthographies of the language would be around lang */
+    id = -id - 1;
+    if (id > 0 &&
+	FcLangCompare (fcLangCharSets[id - 1].lang, lang) != FcLangDifferentLang)
+	return id - 1;
+    if (id < NUM_LANG_CHAR_SET &&
+	FcLangCompare (fcLangCharSets[id].lang, lang) != FcLangDifferentLang)
+	return id;
+    return -1;
+}
+
+static FcBool FcLangSetMapIntersects (const FcLangSet *ls, const FcChar32 *map)
+{
+    int	    i;
+    int	    count = FC_MIN (ls->map_size, NUM_LANG_SET_MAP);
+
+    for (i = 0; i < count; i++)
+	if (ls->map[i] & map[i])
+	    return FcTrue;
+    return FcFalse;
+}
+
+/*
+ * Return the languages a coverage is good for: the bits of the
+ * orthographies all characters of which it has
+ */
+void FcLangMapOfCharSet (const FcCharSet *fcs, FcChar32 *map)
+{
+    int	    i, bit;
+
+    memset (map, '\0', NUM_LANG_SET_MAP * sizeof (FcChar32));
+    if (!fcs)
+	return;
+    for (i = 0; i < NUM_LANG_CHAR_SET; i++)
+    {
+	if (FcCharSetIsSubset (&fcLangCharSets[i].charset, fcs))
+	{
+	    bit = fcLangCharSetIndices[i];
+	    map[bit >> 5] |= (FcChar32) 1 << (bit & 0x1f);
+	}
+    }
+}
+
 /*
  * Return FcTrue when super contains sub. 
  *
@@ -176,30 +279,16 @@ fcExport FcLangResult FcLangSetHasLang(const FcLangSet *ls, const FcChar8 *lang)
 {
     int		    id;
     FcLangResult    best, r;
-    int		    i;
 
+    FcLangGroupsInit ();
     id = FcLangSetIndex (lang);
-    if (id < 0)
-	id = -id - 1;
-    else if (FcLangSetBitGet (ls, id))
+    if (id >= 0 && FcLangSetBitGet (ls, id))
 	return FcLangEqual;
+    /* any other orthography of the language is a different territory */
     best = FcLangDifferentLang;
-    for (i = id - 1; i >= 0; i--)
-    {
-	r = FcLangCompare (lang, fcLangCharSets[i].lang);
-	if (r == FcLangDifferentLang)
-	    break;
-	if (FcLangSetBitGet (ls, i) && r < best)
-	    best = r;
-    }
-    for (i = id; i < NUM_LANG_CHAR_SET; i++)
-    {
-	r = FcLangCompare (lang, fcLangCharSets[i].lang);
-	if (r == FcLangDifferentLang)
-	    break;
-	if (FcLangSetBitGet (ls, i) && r < best)
-	    best = r;
-    }
+    id = FcLangGroup (lang, id);
+    if (id >= 0 && FcLangSetMapIntersects (ls, fcLangGroupMaps[id]))
+	best = FcLangDifferentTerritory;
     if (ls->extra)
     {
 	FcStrList	*list = FcStrListCreate (ls->extra);
@@ -250,24 +339,12 @@ fcExport FcLangSet* FcLangSetCopy (const FcLangSet *ls)
     memcpy (new->map, ls->map, FC_MIN (sizeof (new->map), ls->map_size * sizeof (ls->map[0])));
     if (ls->extra)
     {
-	FcStrList	*list;
-	FcChar8		*extra;
-	
 	new->extra = FcStrSetCreate ();
 	if (!new->extra)
 	    goto bail1;
-
-	list = FcStrListCreate (ls->extra);	
-	if (!list)
+	if (!FcStrSetAddMany (new->extra, (const FcChar8 * const *) ls->extra->strs,
+			      ls->extra->num))
 	    goto bail1;
-	
-	while ((extra = FcStrListNext (list)))
-	    if (!FcStrSetAdd (new->extra, extra))
-	    {
-		FcStrListDone (list);
-		goto bail1;
-	    }
-	FcStrListDone (list);
     }
     return new;
 bail1:
@@ -295,53 +372,50 @@ FcBool FcLangSetAdd (FcLangSet *ls, const FcChar8 *lang)
     return FcStrSetAdd (ls->extra, lang);
 }
 
-static FcBool FcLangSetContainsLang (const FcLangSet *ls, const FcChar8 *lang)
+/*
+ * Return whether the bitmap of ls has lang or a variant of it: the language
+ * without a territory for a lang with one, any territory for a lang without
+ * one. id is what FcLangSetIndex returned for lang.
+ */
+static FcBool FcLangSetMapContains (const FcLangSet *ls, const FcChar8 *lang, int id)
 {
-    int		    id;
-    int		    i;
+    int		    group, base;
 
-    id = FcLangSetIndex (lang);
-    if (id < 0)
-	id = -id - 1;
-    else if (FcLangSetBitGet (ls, id))
+    if (id >= 0 && FcLangSetBitGet (ls, id))
 	return FcTrue;
-    /*
-     * search up and down among equal languages for a match
-     */
-    for (i = id - 1; i >= 0; i--)
-    {
-	if (FcLangCompare (fcLangCharSets[i].lang, lang) == FcLangDifferentLang)
-	    break;
-	if (FcLangSetBitGet (ls, i) &&
-	    FcLangContains (fcLangCharSets[i].lang, lang))
-	    return FcTrue;
-    }
-    for (i = id; i < NUM_LANG_CHAR_SET; i++)
-    {
-	if (FcLangCompare (fcLangCharSets[i].lang, lang) == FcLangDifferentLang)
-	    break;
-	if (FcLangSetBitGet (ls, i) &&
-	    FcLangContains (fcLangCharSets[i].lang, lang))
-	    return FcTrue;
-    }
-    if (ls->extra)
+    group = FcLangGroup (lang, id);
+    if (group < 0)
+	return FcFalse;
+    if (!strchr ((const char *) lang, '-'))
+	return FcLangSetMapIntersects (ls, fcLangGroupMaps[group]);
+    base = fcLangGroupBase[group];
+    return base >= 0 && FcLangSetBitGet (ls, base);
+}
+
+static FcBool FcLangSetExtraContains (const FcLangSet *ls, const FcChar8 *lang)
+{
+    FcStrList	*list;
+    FcChar8	*extra = NULL;
+
+    if (!ls->extra)
+	return FcFalse;
+    list = FcStrListCreate (ls->extra);
+    if (list)
     {
-	FcStrList	*list = FcStrListCreate (ls->extra);
-	FcChar8		*extra;
-	
-	if (list)
+	while ((extra = FcStrListNext (list)))
 	{
-	    while ((extra = FcStrListNext (list)))
-	    {
-		if (FcLangContains (extra, lang))
-		    break;
-	    }
-	    FcStrListDone (list);
-    	    if (extra)
-		return FcTrue;
+	    if (FcLangContains (extra, lang))
+		break;
 	}
+	FcStrListDone (list);
     }
-    return FcFalse;
+    return extra != NULL;
+}
+
+static FcBool FcLangSetContainsLang (const FcLangSet *ls, const FcChar8 *lang)
+{
+    return FcLangSetMapContains (ls, lang, FcLangSetIndex (lang)) ||
+	   FcLangSetExtraContains (ls, lang);
 }
 
 /*
@@ -349,9 +423,10 @@ static FcBool FcLangSetContainsLang (const FcLangSet *ls, const FcChar8 *lang)
  */
 FcBool FcLangSetContains (const FcLangSet *lsa, const FcLangSet *lsb)
 {
-    int		    i, j, count;
+    int		    i, j, id, count;
     FcChar32	    missing;
 
+    FcLangGroupsInit ();
     /*
      * check bitmaps for missing language support
      */
@@ -363,10 +438,11 @@ FcBool FcLangSetContains (const FcLangSet *lsa, const FcLangSet *lsb)
 	if (missing)
 	{
 	    for (j = 0; j < 32; j++)
-		if (missing & (1 << j)) 
+		if (missing & ((FcChar32) 1 << j)) 
 		{
-		    if (!FcLangSetContainsLang (lsa,
-						fcLangCharSets[fcLangCharSetIndicesInv[i*32 + j]].lang))
+		    id = fcLangCharSetIndicesInv[i*32 + j];
+		    if (!FcLangSetMapContains (lsa, fcLangCharSets[id].lang, id) &&
+			!FcLangSetExtraContains (lsa, fcLangCharSets[id].lang))
 		    {
 			return FcFalse;
 		    }
@@ -395,6 +471,71 @@ FcBool FcLangSetContains (const FcLangSet *lsa, const FcLangSet *lsb)
     return FcTrue;
 }
 
+/* And the fonts covering any orthography of the language of group */
+static void FcLangFacesAndGroup (const FcCatalog_t *pCatalog, int group, FcChar32 *faces)
+{
+    const FcChar32  *rows[NUM_LANG_CHAR_SET];
+    FcChar32	    bits;
+    int		    nrows = 0;
+    int		    i, j;
+
+    for (i = 0; i < NUM_LANG_SET_MAP; i++)
+	for (j = 0; j < 32; j++)
+	    if (fcLangGroupMaps[group][i] & ((FcChar32) 1 << j))
+		rows[nrows++] = pCatalog->pulLangFaces + (i * 32 + j) * pCatalog->iLangWords;
+    for (i = 0; i < pCatalog->iLangWords; i++)
+    {
+	bits = 0;
+	for (j = 0; j < nrows; j++)
+	    bits |= rows[j][i];
+	faces[i] &= bits;
+    }
+}
+
+/*
+ * Find the fonts of a snapshot that are good for every language of ls,
+ * through the per language bitmaps of the snapshot. Like FcLangSetHasLang,
+ * a font covering another territory of a language is good for it. faces
+ * gets one bit per font, pCatalog->iLangWords words. Returns FcFalse if
+ * ls has no languages at all.
+ */
+FcBool FcLangSetFaces (const FcLangSet *ls, const FcCatalog_t *pCatalog, FcChar32 *faces)
+{
+    FcBool	    any = FcFalse;
+    int		    count, i, j, group;
+
+    FcLangGroupsInit ();
+    memset (faces, 0xff, pCatalog->iLangWords * sizeof (FcChar32));
+    count = FC_MIN (ls->map_size, NUM_LANG_SET_MAP);
+    for (i = 0; i < count; i++)
+	for (j = 0; j < 32; j++)
+	    if (ls->map[i] & ((FcChar32) 1 << j))
+	    {
+		FcLangFacesAndGroup (pCatalog, fcLangCharSetIndicesInv[i * 32 + j], faces);
+		any = FcTrue;
+	    }
+    if (ls->extra)
+    {
+	FcStrList   *list = FcStrListCreate (ls->extra);
+	FcChar8	    *extra;
+
+	if (list)
+	{
+	    while ((extra = FcStrListNext (list)))
+	    {
+		group = FcLangGroup (extra, FcLangSetIndex (extra));
+		if (group >= 0)
+		    FcLangFacesAndGroup (pCatalog, group, faces);
+		else
+		    memset (faces, '\0', pCatalog->iLangWords * sizeof (FcChar32));
+		any = FcTrue;
+	    }
+	    FcStrListDone (list);
+	}
+    }
+    return any;
+}
+
 FcLangSet* FcNameParseLangSet (const FcChar8 *string)
 {
     FcChar8	    lang[32], c = 0;
@@ -0,0 +1,272 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Memo of recent FcFontMatch() results.
+ *
+ * Applications tend to ask for the same few patterns over and over again.
+ * The memo remembers the result for the pattern fields FcFontMatch() looks
+ * at, and hands out another reference to the same result pattern. The least
+ * recently used entry makes room for a new one. Entries belong to the
+ * snapshot of the font list their result was found in, and the memo is
+ * cleared whenever a new snapshot is published.
+ *
+ * The memo is shared by all threads. It is only ever tried to be locked:
+ * a thread that finds it busy just does the match itself.
+ */
+
+#define MATCH_MEMO_SIZE     64
+#define MATCH_MEMO_BUCKETS  128   /* power of two */
+
+typedef struct FcMatchMemoEntry_s
+{
+  FcChar32   ulHash;
+  FcChar32   ulSerial;            /* of the snapshot the result is from */
+  /* the pattern fields the result depends on */
+  char      *pchFamily;
+  int        iWeight;
+  int        iSlant;
+  int        iWidth;
+  int        iSpacing;
+  double     dPixelSize;
+  FcBool     bOutline;
+  const FcSubstRule_t *pSubst;    /* the rule depends on the language, too */
+  /* the result (NULL for no match), and a copy to find out if the caller
+   * modified the result he got */
+  FcPattern *pResult;
+  FcPattern *pSnapshot;
+  int        iHashNext;           /* chain of the bucket, entry + 1, 0 ends it */
+  int        iPrev, iNext;        /* LRU list, most recently used first */
+  FcBool     bUsed;
+} FcMatchMemoEntry_t;
+
+static FcMatchMemoEntry_t aEntries[MATCH_MEMO_SIZE];
+static int                aiBuckets[MATCH_MEMO_BUCKETS];   /* entry + 1 */
+static int                iFirst = -1;     /* most recently used */
+static int                iLast = -1;      /* least recently used */
+static int                iNumEntries;
+static FcLock_t           hMemoLock;
+
+static FcChar32 PatternHash(const FcPattern *p)
+{
+  const char *pch;
+  FcChar32 h = 0;
+
+  /* the family is compared case insensitively, so hash it that way */
+  if (p->family)
+    for (pch = p->family; *pch; pch++)
+      h = ((h << 1) | (h >> 31)) ^ FcToLower((FcChar8) *pch);
+
+  h = h * 31 + p->weight;
+  h = h * 31 + p->slant;
+  h = h * 31 + p->width;
+  h = h * 31 + p->spacing;
+  h = h * 31 + (FcChar32) (p->pixelsize * 64);
+  h = h * 31 + p->outline;
+  return h;
+}
+
+static FcBool EntryMatches(const FcMatchMemoEntry_t *pEntry, FcChar32 ulHash,
+                           FcChar32 ulSerial, const FcSubstRule_t *pSubst,
+                           const FcPattern *p)
+{
+  if ((pEntry->ulHash != ulHash) ||
+      (pEntry->pSubst != pSubst) ||
+      (pEntry->ulSerial != ulSerial) ||
+      (pEntry->iWeight != p->weight) ||
+      (pEntry->iSlant != p->slant) ||
+      (pEntry->iWidth != p->width) ||
+      (pEntry->iSpacing != p->spacing) ||
+      (pEntry->dPixelSize != p->pixelsize) ||
+      (pEntry->bOutline != p->outline))
+    return FcFalse;
+
+  if (!pEntry->pchFamily || !p->family)
+    return pEntry->pchFamily == p->family;
+  return !stricmp(pEntry->pchFamily, p->family);
+}
+
+static void Unlink(int i)
+{
+  FcMatchMemoEntry_t *pEntry = aEntries + i;
+
+  if (pEntry->iPrev >= 0)
+    aEntries[pEntry->iPrev].iNext = pEntry->iNext;
+  else
+    iFirst = pEntry->iNext;
+  if (pEntry->iNext >= 0)
+    aEntries[pEntry->iNext].iPrev = pEntry->iPrev;
+  else
+    iLast = pEntry->iPrev;
+}
+
+static void LinkFirst(int i)
+{
+  FcMatchMemoEntry_t *pEntry = aEntries + i;
+
+  pEntry->iPrev = -1;
+  pEntry->iNext = iFirst;
+  if (iFirst >= 0)
+    aEntries[iFirst].iPrev = i;
+  iFirst = i;
+  if (iLast < 0)
+    iLast = i;
+}
+
+/* remove an entry from its bucket, the LRU list and free what it holds */
+static void Evict(int i)
+{
+  FcMatchMemoEntry_t *pEntry = aEntries + i;
+  int *piLink;
+
+  for (piLink = aiBuckets + (pEntry->ulHash & (MATCH_MEMO_BUCKETS - 1));
+       *piLink != i + 1; piLink = &aEntries[*piLink - 1].iHashNext)
+    ;
+  *piLink = pEntry->iHashNext;
+  Unlink(i);
+
+  if (pEntry->pchFamily)
+    free(pEntry->pchFamily);
+  FcPatternDestroy(pEntry->pResult);
+  FcPatternDestroy(pEntry->pSnapshot);
+  memset(pEntry, 0, sizeof(*pEntry));
+  iNumEntries--;
+}
+
+void FcMatchMemoClear(void)
+{
+  int i;
+
+  FcLockAcquire(&hMemoLock);
+  for (i = 0; i < MATCH_MEMO_SIZE; i++)
+    if (aEntries[i].bUsed)
+      Evict(i);
+  FcLockRelease(&hMemoLock);
+}
+
+/*
+ * Look up the result for a pattern in a snapshot. Returns FcTrue if the memo
+ * knows the pattern, *ppResult is then a new reference to the result, or
+ * NULL if there is no match for the pattern.
+ */
+FcBool FcMatchMemoLookup(const FcCatalog_t *pCatalog, const FcPattern *p,
+                         FcPattern **ppResult)
+{
+  FcMatchMemoEntry_t *pEntry;
+  const FcSubstRule_t *pSubst;
+  FcChar32 ulHash;
+  int i;
+
+  ulHash = PatternHash(p);
+  pSubst = FcSubstFind(p);
+  if (!FcLockTry(&hMemoLock))
+    return FcFalse;
+
+  for (i = aiBuckets[ulHash & (MATCH_MEMO_BUCKETS - 1)] - 1; i >= 0; i = pEntry->iHashNext - 1)
+  {
+    pEntry = aEntries + i;
+    if (!EntryMatches(pEntry, ulHash, pCatalog->ulSerial, pSubst, p))
+      continue;
+
+    /* results are shared, so if someone changed ours, it can't be used
+     * any more */
+    if (pEntry->pResult &&
+        (!FcPatternEqual(pEntry->pResult, pEntry->pSnapshot) ||
+         (pEntry->pResult->pFontDesc != pEntry->pSnapshot->pFontDesc) ||
+         (pEntry->pResult->face != pEntry->pSnapshot->face) ||
+         (pEntry->pResult->lang != pEntry->pSnapshot->lang) ||
+         (pEntry->pResult->langset != pEntry->pSnapshot->langset)))
+    {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+      fprintf(stderr, "XX: Memoized match for [%s] was modified, dropping it\n",
+              p->family ? p->family : "");
+#endif
+      Evict(i);
+      break;
+    }
+
+    Unlink(i);
+    LinkFirst(i);
+    if (pEntry->pResult)
+      FcPatternReference(pEntry->pResult);
+    *ppResult = pEntry->pResult;
+    FcLockRelease(&hMemoLock);
+    return FcTrue;
+  }
+  FcLockRelease(&hMemoLock);
+  return FcFalse;
+}
+
+/*
+ * Remember the result for a pattern in a snapshot, the memo takes its own
+ * reference. Results from a snapshot that was replaced in the meantime
+ * are not worth keeping.
+ */
+void FcMatchMemoInsert(const FcCatalog_t *pCatalog, const FcPattern *p,
+                       FcPattern *pResult)
+{
+  FcMatchMemoEntry_t *pEntry;
+  FcPattern *pSnapshot = NULL;
+  char *pchFamily = NULL;
+  int i;
+
+  if (!FcCatalogIsCurrent(pCatalog))
+    return;
+
+  if ((p->family && !(pchFamily = strdup(p->family))) ||
+      (pResult && !(pSnapshot = FcPatternDuplicate(pResult))))
+  {
+    if (pchFamily)
+      free(pchFamily);
+    return;
+  }
+
+  if (!FcLockTry(&hMemoLock))
+  {
+    if (pchFamily)
+      free(pchFamily);
+    FcPatternDestroy(pSnapshot);
+    return;
+  }
+
+  if (iNumEntries >= MATCH_MEMO_SIZE)
+    Evict(iLast);
+  for (i = 0; aEntries[i].bUsed; i++)
+    ;
+
+  pEntry = aEntries + i;
+  pEntry->ulHash = PatternHash(p);
+  pEntry->ulSerial = pCatalog->ulSerial;
+  pEntry->pchFamily = pchFamily;
+  pEntry->iWeight = p->weight;
+  pEntry->iSlant = p->slant;
+  pEntry->iWidth = p->width;
+  pEntry->iSpacing = p->spacing;
+  pEntry->dPixelSize = p->pixelsize;
+  pEntry->bOutline = p->outline;
+  pEntry->pSubst = FcSubstFind(p);
+  pEntry->pResult = pResult;
+  pEntry->pSnapshot = pSnapshot;
+  pEntry->bUsed = FcTrue;
+  if (pResult)
+    FcPatternReference(pResult);
+
+  pEntry->iHashNext = aiBuckets[pEntry->ulHash & (MATCH_MEMO_BUCKETS - 1)];
+  aiBuckets[pEntry->ulHash & (MATCH_MEMO_BUCKETS - 1)] = i + 1;
+  LinkFirst(i);
+  iNumEntries++;
+  FcLockRelease(&hMemoLock);
+}
@@ -95,7 +95,8 @@ static FcObjectBucket	*FcObjectBuckets[OBJECT_HASH_SIZE];
 static FcObjectType	*FcObjects = (FcObjectType *) _FcBaseObjectTypes;
 static int		FcObjectsNumber = NUM_OBJECT_TYPES;
 static int		FcObjectsSize = 0;
-static FcBool		FcObjectsInited;
+static volatile FcBool	FcObjectsInited;
+static FcLock_t		FcObjectsLock;
 
 static FcObjectType* FcObjectInsert (const char *name, FcType type)
 {
@@ -138,8 +139,6 @@ static FcBool FcObjectHashInsert (const FcObjectType *object, FcBool copy)
     FcObjectBucket  *b;
     FcObjectType    *o;
 
-    if (!FcObjectsInited)
-	FcObjectInit ();
     for (p = &FcObjectBuckets[hash%OBJECT_HASH_SIZE]; (b = *p); p = &(b->next))
     {
 	o = FcObjects + b->id - 1;
@@ -177,10 +176,17 @@ FcBool FcObjectInit (void)
     if (FcObjectsInited)
 	return FcTrue;
 
-    FcObjectsInited = FcTrue;
-    for (i = 0; i < NUM_OBJECT_TYPES; i++)
-	if (!FcObjectHashInsert (&_FcBaseObjectTypes[i], FcFalse))
-	    return FcFalse;
+    /* the pattern accessors of all threads depend on the hash, so it must
+     * be complete before anyone gets to see it */
+    FcLockAcquire (&FcObjectsLock);
+    if (!FcObjectsInited)
+    {
+	for (i = 0; i < NUM_OBJECT_TYPES; i++)
+	    FcObjectHashInsert (&_FcBaseObjectTypes[i], FcFalse);
+	FcMemoryBarrier ();
+	FcObjectsInited = FcTrue;
+    }
+    FcLockRelease (&FcObjectsLock);
     return FcTrue;
 }
 
@@ -225,6 +231,64 @@ const FcObjectType* FcNameGetObjectType (const char *object)
     return FcObjectFindByName (object, FcFalse);
 }
 
+/*
+ * Map an object name to the id of a standard object, FC_INVALID_OBJECT if
+ * it is none. The pattern accessors get the FC_* constants passed over and
+ * over again, so the id is cached by the address of the name, and a name
+ * that is the very string of the object table needs no compare at all. As
+ * the name behind an address may change (a reused buffer), other hits are
+ * confirmed by comparing the name once.
+ */
+#define OBJECT_PTR_CACHE_SIZE	64
+
+typedef struct _FcObjectPtrSlot {
+    const char	*object;
+    FcObject	id;
+} FcObjectPtrSlot;
+
+static FcObjectPtrSlot	FcObjectPtrCache[OBJECT_PTR_CACHE_SIZE];
+
+FcObject FcObjectFromName (const char *object)
+{
+    FcObjectPtrSlot *s;
+    FcObjectType    *o;
+    const char	    *name;
+    FcObject	    id;
+
+    if (!object)
+	return FC_INVALID_OBJECT;
+
+    s = &FcObjectPtrCache[(((uintptr_t) object) ^ ((uintptr_t) object >> 6)) % OBJECT_PTR_CACHE_SIZE];
+    id = s->id;
+    if (s->object == object && id > FC_INVALID_OBJECT && id <= FC_MAX_BASE_OBJECT)
+    {
+	name = _FcBaseObjectTypes[id - 1].object;
+	if (name == object || !strcmp (name, object))
+	    return id;
+    }
+
+    o = FcObjectFindByName (object, FcFalse);
+    if (!o)
+	return FC_INVALID_OBJECT;
+    id = FcObjectId (o);
+    if (id > FC_MAX_BASE_OBJECT)
+	return FC_INVALID_OBJECT;
+
+    /* the slot is checked against the table above, other threads may
+     * only ever see a mismatch, never a wrong id */
+    s->id = id;
+    s->object = object;
+    return id;
+}
+
+/* the name of a standard object, in static storage */
+const char *FcObjectName (FcObject id)
+{
+    if (id <= FC_INVALID_OBJECT || id > FC_MAX_BASE_OBJECT)
+	return NULL;
+    return _FcBaseObjectTypes[id - 1].object;
+}
+
 static const FcConstant _FcBaseConstants[] = {
     { (FcChar8 *) "thin",	    "weight",   FC_WEIGHT_THIN, },
     { (FcChar8 *) "extralight",	    "weight",   FC_WEIGHT_EXTRALIGHT, },
@@ -14,13 +14,9 @@
 
 #include "fcint.h"
 
-fcExport FcPattern *FcPatternCreate(void)
+static void PatternInit(FcPattern *pResult)
 {
-  FcPattern *pResult = malloc(sizeof(FcPattern));
-  if (pResult)
-  {
-    memset(pResult, 0, sizeof(FcPattern));
-  }
+  memset(pResult, 0, sizeof(FcPattern));
   pResult->hinting = FcTrue; // default to hinting on
   pResult->antialias = FcTrue; // default to antialias on
   pResult->embolden = FcFalse; // no emboldening by default
@@ -34,15 +30,108 @@ fcExport FcPattern *FcPatternCreate(void)
   pResult->lang = NULL;
   pResult->langset = NULL;
   pResult->ref = 1;
+}
+
+fcExport FcPattern *FcPatternCreate(void)
+{
+  FcPattern *pResult = malloc(sizeof(FcPattern));
+  if (pResult)
+    PatternInit(pResult);
   return pResult;
 }
 
+/*
+ * The patterns of an FcFontList() result are allocated in one block, which
+ * also holds the one reference to the font list all of them need. The
+ * block goes away with the last of its patterns.
+ */
+typedef struct FcPatternArena_s
+{
+  volatile int  iRefCount;     /* patterns of the block still alive */
+  FcCatalog_t  *pCatalog;
+  FcPattern     aPatterns[1];
+} FcPatternArena_t;
+
+/* Create iNumPatterns patterns, the caller points them to their fonts */
+FcPattern *FcPatternArenaCreate(FcCatalog_t *pCatalog, int iNumPatterns)
+{
+  FcPatternArena_t *pArena;
+  int i;
+
+  if (iNumPatterns <= 0)
+    return NULL;
+  pArena = malloc(sizeof(FcPatternArena_t) + (iNumPatterns - 1) * sizeof(FcPattern));
+  if (!pArena)
+    return NULL;
+
+  pArena->iRefCount = iNumPatterns;
+  pArena->pCatalog = pCatalog;
+  FcCatalogReference(pCatalog);
+  for (i = 0; i < iNumPatterns; i++)
+  {
+    PatternInit(pArena->aPatterns + i);
+    pArena->aPatterns[i].pCatalog = pCatalog;
+    pArena->aPatterns[i].pArena = pArena;
+  }
+  return pArena->aPatterns;
+}
+
+static void ArenaRelease(FcPatternArena_t *pArena)
+{
+  if (FcAtomicDec(&pArena->iRefCount) > 0)
+    return;
+  FcCatalogRelease(pArena->pCatalog);
+  free(pArena);
+}
+
+/* Let an FcFontList() pattern have an object added to it */
+static void PatternAddObject(FcPattern *p, FcObject obj)
+{
+  if (p->ullObjects)
+    p->ullObjects |= FcObjectBit(obj);
+}
+
+/*
+ * Hash-consing of patterns. FcPatternIntern() returns the canonical copy of
+ * a pattern, shared by everybody interning an identical pattern, so that
+ * identical interned patterns are the same pointer, and they can serve as
+ * cheap keys of pattern keyed caches. Canonical patterns never change (the
+ * FcPatternAdd functions refuse to modify them), and they leave the table
+ * together with their last reference.
+ */
+static FcPattern **ppInternBuckets;
+static int         iInternBuckets;      /* power of two */
+static int         iInternCount;
+static FcLock_t    hInternLock;
+
+static void InternUnlink(FcPattern *p)
+{
+  FcPattern **pp;
+
+  for (pp = ppInternBuckets + (p->hash & (iInternBuckets - 1)); *pp != p; pp = &(*pp)->internnext)
+    ;
+  *pp = p->internnext;
+  iInternCount--;
+}
+
 fcExport void FcPatternDestroy(FcPattern *p)
 {
   if (!p)
     return;
 
-  if (--p->ref > 0)
+  if (p->interned)
+  {
+    // FcPatternIntern() must not hand out a pattern that is going away
+    FcLockAcquire(&hInternLock);
+    if (FcAtomicDec(&p->ref) > 0)
+    {
+      FcLockRelease(&hInternLock);
+      return;
+    }
+    InternUnlink(p);
+    FcLockRelease(&hInternLock);
+  }
+  else if (FcAtomicDec(&p->ref) > 0)
     return;
   if (p->family)
     free(p->family);
@@ -52,85 +141,99 @@ fcExport void FcPatternDestroy(FcPattern *p)
     free(p->lang);
   if (p->langset)
     FcLangSetDestroy(p->langset);
-  free(p);
+  FcFaceRelease(p->pFaceEntry);
+  if (p->pArena)
+    ArenaRelease(p->pArena);
+  else
+  {
+    FcCatalogRelease(p->pCatalog);
+    free(p);
+  }
 }
 
 fcExport FcResult FcPatternGetInteger(const FcPattern *p, const char *object, int id, int *i)
 {
+  FcObject obj;
+
   if (!p)
     return FcResultNoMatch;
 
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_INDEX)==0)
-  {
-    *i = p->pFontDesc->lFontIndex;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_SLANT)==0)
-  {
-    *i = p->slant;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_WEIGHT)==0)
-  {
-    *i = p->weight;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_HINT_STYLE)==0)
-  {
-    *i = p->hintstyle;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_RGBA)==0)
+  obj = FcObjectFromName(object);
+  if (!FcPatternHasObject(p, obj))
+    return FcResultNoMatch;
+
+  switch (obj)
   {
-    *i = p->rgba;
-    return FcResultMatch;
+    case FC_INDEX_OBJECT:
+      *i = p->pFontDesc->lFontIndex;
+      return FcResultMatch;
+    case FC_SLANT_OBJECT:
+      *i = p->slant;
+      return FcResultMatch;
+    case FC_WEIGHT_OBJECT:
+      *i = p->weight;
+      return FcResultMatch;
+    case FC_WIDTH_OBJECT:
+      *i = p->width;
+      return FcResultMatch;
+    case FC_HINT_STYLE_OBJECT:
+      *i = p->hintstyle;
+      return FcResultMatch;
+    case FC_RGBA_OBJECT:
+      *i = p->rgba;
+      return FcResultMatch;
   }
   return FcResultNoMatch;
 }
 
 fcExport FcResult FcPatternGetString(const FcPattern *p, const char *object, int id, FcChar8 **s)
 {
+  FcObject obj;
+
   if (!p)
     return FcResultNoMatch;
 
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_FILE)==0)
-  {
-    *s = (FcChar8 *)p->pFontDesc->achFileName;
-    return FcResultMatch;
-  }
+  obj = FcObjectFromName(object);
+  if (!FcPatternHasObject(p, obj))
+    return FcResultNoMatch;
 
-  if (strcmp(object, FC_FAMILY)==0)
+  switch (obj)
   {
-    if (p->family)
-    {
-      *s = (FcChar8 *)p->family;
+    case FC_FILE_OBJECT:
+      *s = (FcChar8 *)p->pFontDesc->pchFileName;
       return FcResultMatch;
-    } else
-    if (p->pFontDesc)
-    {
-      *s = (FcChar8 *)p->pFontDesc->achFamilyName;
-      return FcResultMatch;
-    }
-  }
 
-  if (strcmp(object, FC_STYLE)==0)
-  {
-    if (p->style)
-    {
-      *s = (FcChar8 *)p->style;
-      return FcResultMatch;
-    } else
-    if (p->pFontDesc)
-    {
-      *s = (FcChar8 *)p->pFontDesc->achStyleName;
-      return FcResultMatch;
-    }
+    case FC_FAMILY_OBJECT:
+      if (p->family)
+      {
+        *s = (FcChar8 *)p->family;
+        return FcResultMatch;
+      } else
+      if (p->pFontDesc)
+      {
+        *s = (FcChar8 *)p->pFontDesc->pchFamilyName;
+        return FcResultMatch;
+      }
+      break;
+
+    case FC_STYLE_OBJECT:
+      if (p->style)
+      {
+        *s = (FcChar8 *)p->style;
+        return FcResultMatch;
+      } else
+      if (p->pFontDesc)
+      {
+        *s = (FcChar8 *)p->pFontDesc->pchStyleName;
+        return FcResultMatch;
+      }
+      break;
   }
 
   return FcResultNoMatch;
@@ -138,62 +241,90 @@ fcExport FcResult FcPatternGetString(const FcPattern *p, const char *object, int
 
 fcExport FcResult FcPatternGetBool(const FcPattern *p, const char *object, int id, FcBool *b)
 {
+  FcObject obj;
+
   if (!p)
     return FcResultNoMatch;
 
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_HINTING)==0)
-  {
-    *b = p->hinting;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_ANTIALIAS)==0)
-  {
-    *b = p->antialias;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_EMBOLDEN)==0)
-  {
-    *b = p->embolden;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_VERTICAL_LAYOUT)==0)
-  {
-    *b = p->verticallayout;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_AUTOHINT)==0)
-  {
-    *b = p->autohint;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_EMBEDDED_BITMAP)==0)
-  {
-    *b = p->bitmap;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_OUTLINE)==0)
+  obj = FcObjectFromName(object);
+  if (!FcPatternHasObject(p, obj))
+    return FcResultNoMatch;
+
+  switch (obj)
   {
-    *b = p->outline;
-    return FcResultMatch;
+    case FC_HINTING_OBJECT:
+      *b = p->hinting;
+      return FcResultMatch;
+    case FC_ANTIALIAS_OBJECT:
+      *b = p->antialias;
+      return FcResultMatch;
+    case FC_EMBOLDEN_OBJECT:
+      *b = p->embolden;
+      return FcResultMatch;
+    case FC_VERTICAL_LAYOUT_OBJECT:
+      *b = p->verticallayout;
+      return FcResultMatch;
+    case FC_AUTOHINT_OBJECT:
+      *b = p->autohint;
+      return FcResultMatch;
+    case FC_EMBEDDED_BITMAP_OBJECT:
+      *b = p->bitmap;
+      return FcResultMatch;
+    case FC_OUTLINE_OBJECT:
+      *b = p->outline;
+      return FcResultMatch;
   }
   return FcResultNoMatch;
 }
 
 fcExport FcResult FcPatternGet(const FcPattern *p, const char *object, int id, FcValue *v)
 {
+  FcObject obj;
+
   if (!v)
     return FcResultNoMatch;
 
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_ANTIALIAS)==0)
+  obj = FcObjectFromName(object);
+  if (!FcPatternHasObject(p, obj))
+    return FcResultNoMatch;
+
+  switch (obj)
   {
-    v->type = FcTypeBool;
-    v->u.b  = FcTrue;
+    case FC_ANTIALIAS_OBJECT:
+      v->type = FcTypeBool;
+      v->u.b  = FcTrue;
+      return FcResultMatch;
+    case FC_CHARSET_OBJECT:
+      if (p->pFontDesc && p->pFontDesc->pCharSet)
+      {
+        v->type = FcTypeCharSet;
+        v->u.c  = p->pFontDesc->pCharSet;
+        return FcResultMatch;
+      }
+      break;
+  }
+  return FcResultNoMatch;
+}
+
+// the coverage belongs to the font description, it must not be destroyed
+fcExport FcResult FcPatternGetCharSet(const FcPattern *p, const char *object, int id, FcCharSet **c)
+{
+  if (!p)
+    return FcResultNoMatch;
+
+  if (id) // we don't support more than one property of the same type
+    return FcResultNoId;
+
+  if (FcObjectFromName(object) == FC_CHARSET_OBJECT && FcPatternHasObject(p, FC_CHARSET_OBJECT) &&
+      p->pFontDesc && p->pFontDesc->pCharSet)
+  {
+    *c = p->pFontDesc->pCharSet;
     return FcResultMatch;
   }
   return FcResultNoMatch;
@@ -205,7 +336,7 @@ fcExport FcResult FcPatternGetLangSet(const FcPattern *p, const char *object, in
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (p->langset)
+  if (p->langset && FcPatternHasObject(p, FC_LANG_OBJECT))
   {
     *ls = p->langset;
     return FcResultMatch;
@@ -215,33 +346,33 @@ fcExport FcResult FcPatternGetLangSet(const FcPattern *p, const char *object, in
 
 fcExport FcBool FcPatternAddInteger(FcPattern *p, const char *object, int i)
 {
-  if (!p)
-    return FcFalse;
+  FcObject obj = FcObjectFromName(object);
 
-  if (strcmp(object, FC_INDEX)==0)
-  {
-    p->pFontDesc->lFontIndex = i;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_SLANT)==0)
-  {
-    p->slant = i;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_WEIGHT)==0)
-  {
-    p->weight = i;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_HINT_STYLE)==0)
-  {
-    p->hintstyle = i;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_RGBA)==0)
-  {
-    p->rgba = i;
-    return FcTrue;
+  if (!FcPatternBeginChange(p))
+    return FcFalse;
+  PatternAddObject(p, obj);
+
+  switch (obj)
+  {
+    case FC_INDEX_OBJECT:
+      // the font description is shared by all patterns of the font, and
+      // other threads may be looking at it, so it can't be changed here
+      return p->pFontDesc && (p->pFontDesc->lFontIndex == i);
+    case FC_SLANT_OBJECT:
+      p->slant = i;
+      return FcTrue;
+    case FC_WEIGHT_OBJECT:
+      p->weight = i;
+      return FcTrue;
+    case FC_WIDTH_OBJECT:
+      p->width = i;
+      return FcTrue;
+    case FC_HINT_STYLE_OBJECT:
+      p->hintstyle = i;
+      return FcTrue;
+    case FC_RGBA_OBJECT:
+      p->rgba = i;
+      return FcTrue;
   }
 
   return FcFalse;
@@ -249,18 +380,20 @@ fcExport FcBool FcPatternAddInteger(FcPattern *p, const char *object, int i)
 
 fcExport FcBool FcPatternAddDouble(FcPattern *p, const char *object, double d)
 {
-  if (!p)
+  FcObject obj = FcObjectFromName(object);
+
+  if (!FcPatternBeginChange(p))
     return FcFalse;
+  PatternAddObject(p, obj);
 
-  if (strcmp(object, FC_PIXEL_SIZE)==0)
+  switch (obj)
   {
-    p->pixelsize = d;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_SIZE)==0)
-  {
-    p->size = d;
-    return FcTrue;
+    case FC_PIXEL_SIZE_OBJECT:
+      p->pixelsize = d;
+      return FcTrue;
+    case FC_SIZE_OBJECT:
+      p->size = d;
+      return FcTrue;
   }
 
   return FcFalse;
@@ -268,21 +401,26 @@ fcExport FcBool FcPatternAddDouble(FcPattern *p, const char *object, double d)
 
 fcExport FcResult FcPatternGetDouble(const FcPattern *p, const char *object, int id, double *d)
 {
+  FcObject obj;
+
   if (!p)
     return FcResultNoMatch;
 
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_PIXEL_SIZE)==0)
-  {
-    *d = p->pixelsize;
-    return FcResultMatch;
-  }
-  if (strcmp(object, FC_SIZE)==0)
+  obj = FcObjectFromName(object);
+  if (!FcPatternHasObject(p, obj))
+    return FcResultNoMatch;
+
+  switch (obj)
   {
-    *d = p->size;
-    return FcResultMatch;
+    case FC_PIXEL_SIZE_OBJECT:
+      *d = p->pixelsize;
+      return FcResultMatch;
+    case FC_SIZE_OBJECT:
+      *d = p->size;
+      return FcResultMatch;
   }
 
   return FcResultNoMatch;
@@ -290,53 +428,53 @@ fcExport FcResult FcPatternGetDouble(const FcPattern *p, const char *object, int
 
 fcExport FcBool FcPatternAddString(FcPattern *p, const char *object, const FcChar8 *s)
 {
-  if (!p)
-    return FcFalse;
-
-  if (strcmp(object, FC_FAMILY)==0)
-  {
-    if (p->family)
-    {
-      free(p->family); p->family = NULL;
-    }
-    p->family = strdup((const char *)s);
-    return FcTrue;
-  }
+  FcObject obj = FcObjectFromName(object);
 
-  if (strcmp(object, FC_STYLE)==0)
-  {
-    if (p->style)
-    {
-      free(p->style); p->style = NULL;
-    }
-    p->style = strdup((const char *)s);
-    return FcTrue;
-  }
-
-  if (strcmp(object, FC_LANG)==0)
-  {
-    if (p->lang)
-    {
-      free(p->lang); p->lang = NULL;
-    }
-    p->lang = strdup((const char *)s);
+  if (!FcPatternBeginChange(p))
+    return FcFalse;
+  PatternAddObject(p, obj);
+
+  switch (obj)
+  {
+    case FC_FAMILY_OBJECT:
+      if (p->family)
+      {
+        free(p->family); p->family = NULL;
+      }
+      p->family = strdup((const char *)s);
+      return FcTrue;
+
+    case FC_STYLE_OBJECT:
+      if (p->style)
+      {
+        free(p->style); p->style = NULL;
+      }
+      p->style = strdup((const char *)s);
+      return FcTrue;
+
+    case FC_LANG_OBJECT:
+      if (p->lang)
+      {
+        free(p->lang); p->lang = NULL;
+      }
+      p->lang = strdup((const char *)s);
 
 /* as in newer fontconfig also the langset is built we need to do that here also */
-    if (p->langset)
-    {
-      FcLangSetDestroy(p->langset); p->langset = NULL;
-    }
-    p->langset = FcLangSetCreate();
-    if (p->langset)
-    {
-      if (!FcLangSetAdd (p->langset, p->lang))
-         {
-	    FcLangSetDestroy(p->langset);
-            p->langset = NULL;
-         }
-
-    }
-    return FcTrue;
+      if (p->langset)
+      {
+        FcLangSetDestroy(p->langset); p->langset = NULL;
+      }
+      p->langset = FcLangSetCreate();
+      if (p->langset)
+      {
+        if (!FcLangSetAdd (p->langset, p->lang))
+           {
+	      FcLangSetDestroy(p->langset);
+              p->langset = NULL;
+           }
+
+      }
+      return FcTrue;
   }
 
   return FcFalse;
@@ -344,43 +482,35 @@ fcExport FcBool FcPatternAddString(FcPattern *p, const char *object, const FcCha
 
 fcExport FcBool FcPatternAddBool(FcPattern *p, const char *object, FcBool b)
 {
-  if (!p)
-    return FcFalse;
+  FcObject obj = FcObjectFromName(object);
 
-  if (strcmp(object, FC_HINTING)==0)
-  {
-    p->hinting = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_ANTIALIAS)==0)
-  {
-    p->antialias = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_EMBOLDEN)==0)
-  {
-    p->embolden = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_VERTICAL_LAYOUT)==0)
-  {
-    p->verticallayout = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_AUTOHINT)==0)
-  {
-    p->autohint = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_EMBEDDED_BITMAP)==0)
-  {
-    p->bitmap = b;
-    return FcTrue;
-  }
-  if (strcmp(object, FC_OUTLINE)==0)
-  {
-    p->outline = b;
-    return FcTrue;
+  if (!FcPatternBeginChange(p))
+    return FcFalse;
+  PatternAddObject(p, obj);
+
+  switch (obj)
+  {
+    case FC_HINTING_OBJECT:
+      p->hinting = b;
+      return FcTrue;
+    case FC_ANTIALIAS_OBJECT:
+      p->antialias = b;
+      return FcTrue;
+    case FC_EMBOLDEN_OBJECT:
+      p->embolden = b;
+      return FcTrue;
+    case FC_VERTICAL_LAYOUT_OBJECT:
+      p->verticallayout = b;
+      return FcTrue;
+    case FC_AUTOHINT_OBJECT:
+      p->autohint = b;
+      return FcTrue;
+    case FC_EMBEDDED_BITMAP_OBJECT:
+      p->bitmap = b;
+      return FcTrue;
+    case FC_OUTLINE_OBJECT:
+      p->outline = b;
+      return FcTrue;
   }
 
   return FcFalse;
@@ -388,7 +518,7 @@ fcExport FcBool FcPatternAddBool(FcPattern *p, const char *object, FcBool b)
 
 fcExport FcBool FcPatternAddFTFace(FcPattern *p, const char *object, const FT_Face f)
 {
-  if (!p)
+  if (!FcPatternBeginChange(p))
     return FcFalse;
 
   if (strcmp(object, FC_FT_FACE)==0)
@@ -408,10 +538,13 @@ fcExport FcResult FcPatternGetFTFace(const FcPattern *p, const char *object, int
   if (id) // we don't support more than one property of the same type
     return FcResultNoId;
 
-  if (strcmp(object, FC_FT_FACE)==0 && p && p->face)
+  if (strcmp(object, FC_FT_FACE)==0 && p)
   {
-    *f = p->face;
-    return FcResultMatch;
+    // patterns of a font without a face of their own share the one of
+    // the face pool, it belongs to the pattern and must not be closed
+    *f = p->face ? p->face : FcFaceOfPattern(p);
+    if (*f)
+      return FcResultMatch;
   }
 
   return FcResultNoMatch;
@@ -435,6 +568,11 @@ fcExport FcBool FcPatternEqual(const FcPattern *pa, const FcPattern *pb)
     return FcFalse;
   }
 
+  /* equal patterns have the same hash, and in a cache it is known */
+  if (pa->hash && pb->hash && pa->hash != pb->hash) {
+    return FcFalse;
+  }
+
   /* check string properties */
   /* If the string have the same address or they are both NULL it would mean
    * we had equal strings. If that is not the case we have to test if only
@@ -454,6 +592,7 @@ fcExport FcBool FcPatternEqual(const FcPattern *pa, const FcPattern *pb)
 
   /* check int properties */
   if (pa->weight != pb->weight ||
+      pa->width != pb->width ||
       pa->slant != pb->slant ||
       pa->spacing != pb->spacing ||
       pa->hintstyle != pb->hintstyle ||
@@ -462,9 +601,10 @@ fcExport FcBool FcPatternEqual(const FcPattern *pa, const FcPattern *pb)
     return FcFalse;
   }
 
-  /* check double properties, better not compare directly */
-  if (fabs(pa->pixelsize-pb->pixelsize) > DBL_EPSILON ||
-      fabs(pa->size-pb->size) > DBL_EPSILON)
+  /* check double properties, exactly, as FcPatternHash() hashes them.
+   * Allowing for rounding here would let equal patterns hash differently */
+  if (pa->pixelsize != pb->pixelsize ||
+      pa->size != pb->size)
   {
     return FcFalse;
   }
@@ -485,6 +625,156 @@ fcExport FcBool FcPatternEqual(const FcPattern *pa, const FcPattern *pb)
   return FcTrue;
 }
 
+/*
+ * Hash of a pattern, over the properties FcPatternEqual() compares, so
+ * equal patterns have equal hashes. The sizes are hashed by their bits,
+ * FcPatternEqual() compares them exactly. The hash is kept in the pattern
+ * until it is changed.
+ */
+static FcChar32 HashDouble(double d)
+{
+  unsigned long long ullBits;
+
+  /* -0.0 == 0.0 but has other bits */
+  if (d == 0)
+    return 0;
+  memcpy(&ullBits, &d, sizeof(ullBits));
+  return (FcChar32) (ullBits ^ (ullBits >> 32));
+}
+
+fcExport FcChar32 FcPatternHash(const FcPattern *p)
+{
+  FcChar32 h;
+
+  if (!p)
+    return 0;
+  if (p->hash)
+    return p->hash;
+
+  h = FcStringHashIgnoreCase((const FcChar8 *)p->family);
+  h = h * 31 + FcStringHashIgnoreCase((const FcChar8 *)p->style);
+  h = h * 31 + p->weight;
+  h = h * 31 + p->width;
+  h = h * 31 + p->slant;
+  h = h * 31 + p->spacing;
+  h = h * 31 + p->hintstyle;
+  h = h * 31 + p->rgba;
+  h = h * 31 + HashDouble(p->pixelsize);
+  h = h * 31 + HashDouble(p->size);
+  h = h * 31 + ((p->hinting        ? 0x01 : 0) |
+                (p->antialias      ? 0x02 : 0) |
+                (p->embolden       ? 0x04 : 0) |
+                (p->verticallayout ? 0x08 : 0) |
+                (p->autohint       ? 0x10 : 0) |
+                (p->bitmap         ? 0x20 : 0) |
+                (p->outline        ? 0x40 : 0));
+  if (!h)
+    h = 1;  /* 0 means not computed */
+
+  /* only a cache, every thread computes the same value */
+  ((FcPattern *)p)->hash = h;
+  return h;
+}
+
+/*
+ * Patterns are only the same for FcPatternIntern() if they also refer to
+ * the same font and language, which FcPatternEqual() does not look at.
+ */
+static FcBool PatternsIdentical(const FcPattern *pa, const FcPattern *pb)
+{
+  if (pa->pFontDesc != pb->pFontDesc ||
+      pa->face != pb->face ||
+      pa->ullObjects != pb->ullObjects)
+    return FcFalse;
+  if (!(pa->lang == pb->lang || (pa->lang && pb->lang && !strcmp(pa->lang, pb->lang))))
+    return FcFalse;
+  if (!(pa->family == pb->family || (pa->family && pb->family && !strcmp(pa->family, pb->family))))
+    return FcFalse;
+  if (!(pa->style == pb->style || (pa->style && pb->style && !strcmp(pa->style, pb->style))))
+    return FcFalse;
+  return FcPatternEqual(pa, pb);
+}
+
+static void InternGrow(void)
+{
+  FcPattern **ppBuckets, *p, *pNext;
+  int iBuckets = iInternBuckets ? iInternBuckets * 2 : 64;
+  int i;
+
+  ppBuckets = (FcPattern **) calloc(iBuckets, sizeof(FcPattern *));
+  if (!ppBuckets)
+    return;  /* longer chains then */
+
+  for (i = 0; i < iInternBuckets; i++)
+    for (p = ppInternBuckets[i]; p; p = pNext)
+    {
+      pNext = p->internnext;
+      p->internnext = ppBuckets[p->hash & (iBuckets - 1)];
+      ppBuckets[p->hash & (iBuckets - 1)] = p;
+    }
+  if (ppInternBuckets)
+    free(ppInternBuckets);
+  ppInternBuckets = ppBuckets;
+  iInternBuckets = iBuckets;
+}
+
+/*
+ * Return a reference to the canonical pattern identical to p, which must
+ * not be changed anymore. p itself stays with the caller.
+ */
+fcExport FcPattern *FcPatternIntern(FcPattern *p)
+{
+  FcPattern *pCanon;
+  FcChar32 ulHash;
+
+  if (!p)
+    return NULL;
+  if (p->interned)
+  {
+    FcPatternReference(p);
+    return p;
+  }
+
+  ulHash = FcPatternHash(p);
+  FcLockAcquire(&hInternLock);
+  if (ppInternBuckets)
+  {
+    for (pCanon = ppInternBuckets[ulHash & (iInternBuckets - 1)]; pCanon; pCanon = pCanon->internnext)
+    {
+      if (pCanon->hash == ulHash && PatternsIdentical(pCanon, p))
+      {
+        FcAtomicInc(&pCanon->ref);
+        FcLockRelease(&hInternLock);
+        return pCanon;
+      }
+    }
+  }
+
+  if (iInternCount >= iInternBuckets)
+    InternGrow();
+  pCanon = ppInternBuckets ? FcPatternDuplicate(p) : NULL;
+  if (pCanon)
+  {
+    pCanon->hash = ulHash;
+    pCanon->interned = FcTrue;
+    pCanon->internnext = ppInternBuckets[ulHash & (iInternBuckets - 1)];
+    ppInternBuckets[ulHash & (iInternBuckets - 1)] = pCanon;
+    iInternCount++;
+  }
+  FcLockRelease(&hInternLock);
+  return pCanon;
+}
+
+/* Check if p may be changed, and forget its hash, as it is about to */
+FcBool FcPatternBeginChange(FcPattern *p)
+{
+  if (!p || p->interned)
+    return FcFalse;
+  p->hash = 0;
+  p->substituted = FcFalse;
+  return FcTrue;
+}
+
 /*
  * Increment pattern reference count
  * Add another reference to p. Patterns are freed only when the reference
@@ -495,7 +785,7 @@ fcExport void FcPatternReference(FcPattern *p)
   if (!p)
     return;
 
-  p->ref++;
+  FcAtomicInc(&p->ref);
 }
 
 /*
@@ -520,6 +810,13 @@ fcExport FcPattern *FcPatternDuplicate(const FcPattern *p)
       pResult->lang = strdup(p->lang);
     if (p->langset)
       pResult->langset = FcLangSetCopy(p->langset);
+    FcCatalogReference(p->pCatalog);
+
+    /* the copy can be changed again */
+    pResult->interned = FcFalse;
+    pResult->internnext = NULL;
+    pResult->pArena = NULL;
+    pResult->pFaceEntry = NULL;
 
     /* this is doubtful, but for now set the reference to 1,
      * so that the duplicate pattern is treated like a new one
@@ -603,14 +900,31 @@ fcExport FcBool FcPatternAddWeak (FcPattern *p, const char *object,
   return rc;
 }
 
+/*
+ * FNV-1a, the tables using it take the low bits of the hash, and these
+ * have to differ for strings that only differ in a digit or two, like the
+ * file names of a font directory
+ */
 FcChar32 FcStringHash (const FcChar8 *s)
 {
     FcChar8	c;
-    FcChar32	h = 0;
+    FcChar32	h = 2166136261u;
     
     if (s)
 	while ((c = *s++))
-	    h = ((h << 1) | (h >> 31)) ^ c;
+	    h = (h ^ c) * 16777619u;
+    return h;
+}
+
+/* hash of a string as stricmp sees it */
+FcChar32 FcStringHashIgnoreCase (const FcChar8 *s)
+{
+    FcChar8	c;
+    FcChar32	h = 2166136261u;
+
+    if (s)
+	while ((c = *s++))
+	    h = (h ^ FcToLower (c)) * 16777619u;
     return h;
 }
 
@@ -0,0 +1,720 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * SFNT (TrueType and OpenType) reader for the font scan.
+ *
+ * To describe a face, the font list needs its names, its OS/2 table and its
+ * Unicode coverage. Having FreeType open the face for that makes it probe
+ * the drivers and load a good part of the font: metrics, kerning, glyph
+ * names, bitmap strikes. The reader below only reads the table directory
+ * and the name, OS/2, head, maxp and cmap tables. It comes to the same
+ * results as FreeType does, down to the names FreeType would give the face
+ * and the characters FT_Get_Next_Char() would walk over.
+ *
+ * Anything the reader does not understand (other formats, a cmap format it
+ * doesn't know, tables that don't add up) is left to FreeType.
+ */
+
+#define SFNT_TAG(a, b, c, d)  (((FT_ULong)(a) << 24) | ((FT_ULong)(b) << 16) | \
+                               ((FT_ULong)(c) << 8) | (FT_ULong)(d))
+
+#define SFNT_TTC_MAX_FACES    1024
+
+struct FcSfntFile_s
+{
+  FILE          *pFile;
+  long           lNumFaces;
+  FT_ULong      *pulOffsets;     /* of the table directory of every face */
+  /* the data of the face read last, the FcFaceInfo_t points into it */
+  FT_Byte       *pbName;
+  FT_SfntName   *pNames;
+  char          *pchFamilyName;
+  char          *pchStyleName;
+  TT_OS2         OS2;
+};
+
+/* a table of the face being read */
+typedef struct FcSfntTable_s
+{
+  FT_ULong  ulOffset;
+  FT_ULong  ulLength;
+} FcSfntTable_t;
+
+/* the cmap walk, collects the mapped characters in runs */
+typedef struct FcCmapWalk_s
+{
+  FcCharSet *pCharSet;
+  FT_UInt    nGlyphs;
+  FcBool     bSymbol;
+  FcChar32   ulFirst;            /* of the current run */
+  FcChar32   ulNext;             /* the character after it */
+  FcBool     bFailed;
+} FcCmapWalk_t;
+
+static FT_UInt ReadUShort(const FT_Byte *pb)
+{
+  return ((FT_UInt) pb[0] << 8) | pb[1];
+}
+
+static FT_Int ReadShort(const FT_Byte *pb)
+{
+  return (FT_Int) (short) ReadUShort(pb);
+}
+
+static FT_ULong ReadULong(const FT_Byte *pb)
+{
+  return ((FT_ULong) pb[0] << 24) | ((FT_ULong) pb[1] << 16) |
+         ((FT_ULong) pb[2] << 8) | pb[3];
+}
+
+static FcBool ReadAt(FILE *pFile, FT_ULong ulOffset, void *pBuffer, size_t cbBuffer)
+{
+  return (fseek(pFile, (long) ulOffset, SEEK_SET) == 0) &&
+         (fread(pBuffer, 1, cbBuffer, pFile) == cbBuffer);
+}
+
+/* Read a whole table into memory, NULL if it is missing or can't be read */
+static FT_Byte *ReadTable(FILE *pFile, const FcSfntTable_t *pTable)
+{
+  FT_Byte *pb;
+
+  if (!pTable->ulLength)
+    return NULL;
+  pb = (FT_Byte *) malloc(pTable->ulLength);
+  if (pb && !ReadAt(pFile, pTable->ulOffset, pb, pTable->ulLength))
+  {
+    free(pb);
+    pb = NULL;
+  }
+  return pb;
+}
+
+static FcBool IsSfntVersion(FT_ULong ulVersion)
+{
+  return (ulVersion == 0x00010000) ||
+         (ulVersion == SFNT_TAG('O', 'T', 'T', 'O')) ||
+         (ulVersion == SFNT_TAG('t', 'r', 'u', 'e'));
+}
+
+/*
+ * Open a font file, returns NULL if it is no SFNT file or font collection.
+ * *plNumFaces is set to the number of faces in it.
+ */
+FcSfntFile *FcSfntOpen(const char *pchFileName, long *plNumFaces)
+{
+  FcSfntFile *pSfnt;
+  FT_Byte abHeader[12];
+  FT_Byte *pbOffsets;
+  FT_ULong ulVersion;
+  long i;
+
+  pSfnt = (FcSfntFile *) calloc(1, sizeof(FcSfntFile));
+  if (!pSfnt)
+    return NULL;
+  pSfnt->pFile = fopen(pchFileName, "rb");
+  if (!pSfnt->pFile || !ReadAt(pSfnt->pFile, 0, abHeader, sizeof(abHeader)))
+    goto failed;
+
+  ulVersion = ReadULong(abHeader);
+  if (ulVersion == SFNT_TAG('t', 't', 'c', 'f'))
+  {
+    pSfnt->lNumFaces = (long) ReadULong(abHeader + 8);
+    if ((pSfnt->lNumFaces < 1) || (pSfnt->lNumFaces > SFNT_TTC_MAX_FACES))
+      goto failed;
+    pSfnt->pulOffsets = (FT_ULong *) malloc(pSfnt->lNumFaces * sizeof(FT_ULong));
+    pbOffsets = (FT_Byte *) alloca(pSfnt->lNumFaces * 4);
+    if (!pSfnt->pulOffsets ||
+        !ReadAt(pSfnt->pFile, sizeof(abHeader), pbOffsets, pSfnt->lNumFaces * 4))
+      goto failed;
+    for (i = 0; i < pSfnt->lNumFaces; i++)
+      pSfnt->pulOffsets[i] = ReadULong(pbOffsets + i * 4);
+  }
+  else if (IsSfntVersion(ulVersion))
+  {
+    pSfnt->lNumFaces = 1;
+    pSfnt->pulOffsets = (FT_ULong *) calloc(1, sizeof(FT_ULong));
+    if (!pSfnt->pulOffsets)
+      goto failed;
+  }
+  else
+    goto failed;
+
+  *plNumFaces = pSfnt->lNumFaces;
+  return pSfnt;
+
+failed:
+  FcSfntClose(pSfnt);
+  return NULL;
+}
+
+/* drop what the last face read left behind */
+static void FreeFaceData(FcSfntFile *pSfnt)
+{
+  if (pSfnt->pbName)
+    free(pSfnt->pbName);
+  if (pSfnt->pNames)
+    free(pSfnt->pNames);
+  if (pSfnt->pchFamilyName)
+    free(pSfnt->pchFamilyName);
+  if (pSfnt->pchStyleName)
+    free(pSfnt->pchStyleName);
+  pSfnt->pbName = NULL;
+  pSfnt->pNames = NULL;
+  pSfnt->pchFamilyName = NULL;
+  pSfnt->pchStyleName = NULL;
+}
+
+void FcSfntClose(FcSfntFile *pSfnt)
+{
+  if (!pSfnt)
+    return;
+  FreeFaceData(pSfnt);
+  if (pSfnt->pulOffsets)
+    free(pSfnt->pulOffsets);
+  if (pSfnt->pFile)
+    fclose(pSfnt->pFile);
+  free(pSfnt);
+}
+
+/*
+ * Collect the records of the name table, leaving out the ones FreeType
+ * leaves out: empty ones and those with the string outside of the table.
+ */
+static FcBool ParseNameTable(FcSfntFile *pSfnt, const FT_Byte *pbName, FT_ULong cbName,
+                             FT_UInt *pnNames)
+{
+  FT_ULong ulStorage, ulStorageStart, ulOffset;
+  FT_UInt nRecords, nLangTags, i, n;
+  const FT_Byte *pbRecord;
+  FT_SfntName *pName;
+
+  if (cbName < 6)
+    return FcFalse;
+  nRecords = ReadUShort(pbName + 2);
+  ulStorage = ReadUShort(pbName + 4);
+  ulStorageStart = 6 + 12 * (FT_ULong) nRecords;
+  if (ulStorageStart > cbName)
+    return FcFalse;
+  nLangTags = 0;
+  if (ReadUShort(pbName) == 1)
+  {
+    /* format 1 has language tag records after the name records */
+    if (ulStorageStart + 2 > cbName)
+      return FcFalse;
+    nLangTags = ReadUShort(pbName + ulStorageStart);
+    ulStorageStart += 2 + 4 * (FT_ULong) nLangTags;
+  }
+
+  pSfnt->pNames = (FT_SfntName *) malloc((nRecords + 1) * sizeof(FT_SfntName));
+  if (!pSfnt->pNames)
+    return FcFalse;
+
+  for (i = 0, n = 0, pbRecord = pbName + 6; i < nRecords; i++, pbRecord += 12)
+  {
+    pName = pSfnt->pNames + n;
+    pName->platform_id = ReadUShort(pbRecord);
+    pName->encoding_id = ReadUShort(pbRecord + 2);
+    pName->language_id = ReadUShort(pbRecord + 4);
+    pName->name_id = ReadUShort(pbRecord + 6);
+    pName->string_len = ReadUShort(pbRecord + 8);
+    ulOffset = ulStorage + ReadUShort(pbRecord + 10);
+    if (!pName->string_len ||
+        (ulOffset < ulStorageStart) || (ulOffset + pName->string_len > cbName))
+      continue;
+    /* so are names in a language tag that doesn't exist */
+    if ((ReadUShort(pbName) == 1) && (pName->language_id >= 0x8000) &&
+        (pName->language_id - 0x8000 >= nLangTags))
+      continue;
+    pName->string = (FT_Byte *) pbName + ulOffset;
+    n++;
+  }
+  *pnNames = n;
+  return FcTrue;
+}
+
+/*
+ * The name FreeType gives a face for a name id: English Windows names come
+ * first, then Apple ones, then Unicode platform ones, squeezed to ASCII.
+ * Returns NULL if there is none or out of memory.
+ */
+static char *GetFreeTypeName(const FT_SfntName *pNames, FT_UInt nNames, FT_UShort usNameId)
+{
+  const FT_SfntName *pName = NULL;
+  int iApple = -1, iAppleRoman = -1, iAppleEnglish = -1, iWin = -1, iUnicode = -1;
+  FcBool bEnglish = FcFalse, bUtf16;
+  FT_UInt i, n, nLen, uiCode;
+  char *pchName;
+
+  for (i = 0; i < nNames; i++)
+  {
+    if (pNames[i].name_id != usNameId)
+      continue;
+    switch (pNames[i].platform_id)
+    {
+      case TT_PLATFORM_APPLE_UNICODE:
+      case TT_PLATFORM_ISO:
+        iUnicode = i;
+        break;
+
+      case TT_PLATFORM_MACINTOSH:
+        if (pNames[i].language_id == TT_MAC_LANGID_ENGLISH)
+          iAppleEnglish = i;
+        else if (pNames[i].encoding_id == TT_MAC_ID_ROMAN)
+          iAppleRoman = i;
+        break;
+
+      case TT_PLATFORM_MICROSOFT:
+        if ((iWin == -1 || (pNames[i].language_id & 0x3FF) == 0x009) &&
+            ((pNames[i].encoding_id == TT_MS_ID_SYMBOL_CS) ||
+             (pNames[i].encoding_id == TT_MS_ID_UNICODE_CS) ||
+             (pNames[i].encoding_id == TT_MS_ID_UCS_4)))
+        {
+          bEnglish = ((pNames[i].language_id & 0x3FF) == 0x009);
+          iWin = i;
+        }
+        break;
+    }
+  }
+
+  iApple = (iAppleEnglish >= 0) ? iAppleEnglish : iAppleRoman;
+  if (iWin >= 0 && !(iApple >= 0 && !bEnglish))
+  {
+    pName = pNames + iWin;
+    bUtf16 = FcTrue;
+  }
+  else if (iApple >= 0)
+  {
+    pName = pNames + iApple;
+    bUtf16 = FcFalse;
+  }
+  else if (iUnicode >= 0)
+  {
+    pName = pNames + iUnicode;
+    bUtf16 = FcTrue;
+  }
+  else
+    return NULL;
+
+  nLen = bUtf16 ? pName->string_len / 2 : pName->string_len;
+  pchName = (char *) malloc(nLen + 1);
+  if (!pchName)
+    return NULL;
+  for (n = 0; n < nLen; n++)
+  {
+    uiCode = bUtf16 ? ReadUShort(pName->string + n * 2) : pName->string[n];
+    if (!uiCode)
+      break;
+    pchName[n] = (uiCode < 32 || uiCode > 127) ? '?' : (char) uiCode;
+  }
+  pchName[n] = 0;
+  return pchName;
+}
+
+/* Pick family and style name the way FreeType does */
+static void GetFreeTypeNames(FcSfntFile *pSfnt, FT_UInt nNames, FcBool bHaveOS2)
+{
+  static const FT_UShort ausWWSFirst[][3] =
+  {
+    { TT_NAME_ID_WWS_FAMILY, TT_NAME_ID_TYPOGRAPHIC_FAMILY, TT_NAME_ID_FONT_FAMILY },
+    { TT_NAME_ID_WWS_SUBFAMILY, TT_NAME_ID_TYPOGRAPHIC_SUBFAMILY, TT_NAME_ID_FONT_SUBFAMILY }
+  };
+  static const FT_UShort ausTypographicFirst[][3] =
+  {
+    { TT_NAME_ID_TYPOGRAPHIC_FAMILY, TT_NAME_ID_FONT_FAMILY, 0 },
+    { TT_NAME_ID_TYPOGRAPHIC_SUBFAMILY, TT_NAME_ID_FONT_SUBFAMILY, 0 }
+  };
+  const FT_UShort (*pausIds)[3];
+  int i;
+
+  /* FreeType 2.8.1 only asks for the WWS names if fsSelection bit 8 (WWS)
+   * is NOT set */
+  if (bHaveOS2 && (pSfnt->OS2.fsSelection & 256))
+    pausIds = ausTypographicFirst;
+  else
+    pausIds = ausWWSFirst;
+
+  for (i = 0; i < 3 && pausIds[0][i] && !pSfnt->pchFamilyName; i++)
+    pSfnt->pchFamilyName = GetFreeTypeName(pSfnt->pNames, nNames, pausIds[0][i]);
+  for (i = 0; i < 3 && pausIds[1][i] && !pSfnt->pchStyleName; i++)
+    pSfnt->pchStyleName = GetFreeTypeName(pSfnt->pNames, nNames, pausIds[1][i]);
+}
+
+/*
+ * Read the fields of the OS/2 table the font list uses. FreeType regards
+ * a table that is too short for its version as missing, and so does this.
+ */
+static FcBool ReadOS2Table(FcSfntFile *pSfnt, const FcSfntTable_t *pTable)
+{
+  FT_Byte abOS2[78];
+  FT_ULong ulNeeded;
+  FT_UInt uiVersion;
+
+  if ((pTable->ulLength < sizeof(abOS2)) ||
+      !ReadAt(pSfnt->pFile, pTable->ulOffset, abOS2, sizeof(abOS2)))
+    return FcFalse;
+
+  uiVersion = ReadUShort(abOS2);
+  ulNeeded = (uiVersion >= 5) ? 100 : (uiVersion >= 2) ? 96 : (uiVersion >= 1) ? 86 : 78;
+  if (pTable->ulLength < ulNeeded)
+    return FcFalse;
+
+  memset(&pSfnt->OS2, 0, sizeof(pSfnt->OS2));
+  pSfnt->OS2.version = (FT_UShort) uiVersion;
+  pSfnt->OS2.usWeightClass = (FT_UShort) ReadUShort(abOS2 + 4);
+  pSfnt->OS2.usWidthClass = (FT_UShort) ReadUShort(abOS2 + 6);
+  pSfnt->OS2.fsSelection = (FT_UShort) ReadUShort(abOS2 + 62);
+  return FcTrue;
+}
+
+/* end the current run of mapped characters */
+static void FlushRun(FcCmapWalk_t *pWalk)
+{
+  FcChar32 ulFirst = pWalk->ulFirst, ulLast = pWalk->ulNext - 1;
+
+  if (pWalk->ulNext == pWalk->ulFirst)
+    return;
+  if (!FcCharSetAddRange(pWalk->pCharSet, ulFirst, ulLast))
+    pWalk->bFailed = FcTrue;
+
+  /* symbol fonts are addressed with Latin-1 codes too */
+  if (pWalk->bSymbol && ulFirst <= 0xF0FF && ulLast >= 0xF020)
+  {
+    if (ulFirst < 0xF020)
+      ulFirst = 0xF020;
+    if (ulLast > 0xF0FF)
+      ulLast = 0xF0FF;
+    if (!FcCharSetAddRange(pWalk->pCharSet, ulFirst - 0xF000, ulLast - 0xF000))
+      pWalk->bFailed = FcTrue;
+  }
+  pWalk->ulFirst = pWalk->ulNext;
+}
+
+/* characters first to last are mapped to existing glyphs */
+static void MapRange(FcCmapWalk_t *pWalk, FcChar32 ulFirst, FcChar32 ulLast)
+{
+  if (ulFirst != pWalk->ulNext)
+  {
+    FlushRun(pWalk);
+    pWalk->ulFirst = ulFirst;
+  }
+  pWalk->ulNext = ulLast + 1;
+}
+
+/* like FT_Get_Next_Char(), only take characters mapped to existing glyphs */
+static void MapChar(FcCmapWalk_t *pWalk, FcChar32 ulChar, FT_UInt uiGlyph)
+{
+  if (uiGlyph && uiGlyph < pWalk->nGlyphs)
+    MapRange(pWalk, ulChar, ulChar);
+}
+
+static FcBool WalkCmap4(FcCmapWalk_t *pWalk, const FT_Byte *pb, const FT_Byte *pbLimit)
+{
+  const FT_Byte *pbEnd, *pbStart, *pbDelta, *pbRangeOffset, *pbGlyph;
+  FT_UInt uiSegCountX2, uiStart, uiEnd, uiRangeOffset, uiGlyph, i;
+  FT_Int iDelta;
+  FcChar32 ulChar;
+
+  if (pb + 14 > pbLimit)
+    return FcFalse;
+  uiSegCountX2 = ReadUShort(pb + 6) & ~1U;
+  pbEnd = pb + 14;
+  pbStart = pbEnd + uiSegCountX2 + 2;
+  pbDelta = pbStart + uiSegCountX2;
+  pbRangeOffset = pbDelta + uiSegCountX2;
+  if (pbRangeOffset + uiSegCountX2 > pbLimit)
+    return FcFalse;
+
+  for (i = 0; i < uiSegCountX2; i += 2)
+  {
+    uiStart = ReadUShort(pbStart + i);
+    uiEnd = ReadUShort(pbEnd + i);
+    iDelta = ReadShort(pbDelta + i);
+    uiRangeOffset = ReadUShort(pbRangeOffset + i);
+    if (uiStart > uiEnd)
+      return FcFalse;   /* FreeType rejects the cmap */
+    if (uiRangeOffset == 0xFFFF)
+      continue;
+
+    for (ulChar = uiStart; ulChar <= uiEnd; ulChar++)
+    {
+      if (uiRangeOffset)
+      {
+        pbGlyph = pbRangeOffset + i + uiRangeOffset + (ulChar - uiStart) * 2;
+        if (pbGlyph + 2 > pbLimit)
+          break;
+        uiGlyph = ReadUShort(pbGlyph);
+        if (uiGlyph)
+          uiGlyph = (FT_UInt) ((FT_Int) uiGlyph + iDelta) & 0xFFFF;
+      }
+      else
+        uiGlyph = (FT_UInt) ((FT_Int) ulChar + iDelta) & 0xFFFF;
+      MapChar(pWalk, ulChar, uiGlyph);
+    }
+  }
+  return FcTrue;
+}
+
+/* formats 12 and 13, the groups of 13 map all their characters to one glyph */
+static FcBool WalkCmap12(FcCmapWalk_t *pWalk, const FT_Byte *pb, const FT_Byte *pbLimit,
+                         FcBool bManyToOne)
+{
+  FT_ULong ulGroups, ulStart, ulEnd, ulGlyph, ulLast = 0, i;
+
+  if (pb + 16 > pbLimit)
+    return FcFalse;
+  ulGroups = ReadULong(pb + 12);
+  if (ulGroups > (FT_ULong) (pbLimit - pb - 16) / 12)
+    return FcFalse;
+
+  for (i = 0, pb += 16; i < ulGroups; i++, pb += 12)
+  {
+    ulStart = ReadULong(pb);
+    ulEnd = ReadULong(pb + 4);
+    ulGlyph = ReadULong(pb + 8);
+    /* FreeType rejects unsorted groups */
+    if ((ulStart > ulEnd) || (i && ulStart <= ulLast))
+      return FcFalse;
+    ulLast = ulEnd;
+
+    if (bManyToOne)
+    {
+      if (ulGlyph && ulGlyph < pWalk->nGlyphs)
+        MapRange(pWalk, ulStart, ulEnd);
+      continue;
+    }
+
+    /* only the part mapped to existing glyphs other than .notdef counts */
+    if (ulGlyph >= pWalk->nGlyphs)
+      continue;
+    if (!ulGlyph)
+    {
+      if (ulStart == ulEnd)
+        continue;
+      ulStart++;
+      ulGlyph++;
+    }
+    if (ulEnd - ulStart >= pWalk->nGlyphs - ulGlyph)
+      ulEnd = ulStart + (pWalk->nGlyphs - 1 - ulGlyph);
+    MapRange(pWalk, ulStart, ulEnd);
+  }
+  return FcTrue;
+}
+
+/*
+ * Build the coverage from the cmap FreeType would select: the last UCS-4
+ * subtable, else the last other Unicode one, else the first symbol one.
+ * *ppCharSet is NULL if there is none of them. Returns FcFalse if the cmap
+ * has to be left to FreeType.
+ */
+static FcBool ReadCharSet(const FT_Byte *pbCmap, FT_ULong cbCmap, FT_UInt nGlyphs,
+                          FcCharSet **ppCharSet)
+{
+  const FT_Byte *pbLimit = pbCmap + cbCmap, *pbRecord, *pb;
+  int iUcs4 = -1, iUnicode = -1, iSymbol = -1, iChosen;
+  FT_UInt uiPlatform, uiEncoding, uiFormat, nTables, i;
+  FT_ULong ulOffset;
+  FcCmapWalk_t Walk;
+  FcBool bOk;
+
+  *ppCharSet = NULL;
+  if ((cbCmap < 4) || ReadUShort(pbCmap))
+    return FcFalse;
+  nTables = ReadUShort(pbCmap + 2);
+  if (4 + 8 * (FT_ULong) nTables > cbCmap)
+    return FcFalse;
+
+  for (i = 0, pbRecord = pbCmap + 4; i < nTables; i++, pbRecord += 8)
+  {
+    uiPlatform = ReadUShort(pbRecord);
+    uiEncoding = ReadUShort(pbRecord + 2);
+    ulOffset = ReadULong(pbRecord + 4);
+    if (!ulOffset || ulOffset > cbCmap - 2)
+      continue;
+    /* the variation sequences of format 14 don't map characters */
+    if (ReadUShort(pbCmap + ulOffset) == 14)
+      continue;
+
+    if ((uiPlatform == TT_PLATFORM_MICROSOFT && uiEncoding == TT_MS_ID_UCS_4) ||
+        (uiPlatform == TT_PLATFORM_APPLE_UNICODE && uiEncoding == TT_APPLE_ID_UNICODE_32))
+      iUcs4 = i;
+    else if ((uiPlatform == TT_PLATFORM_MICROSOFT && uiEncoding == TT_MS_ID_UNICODE_CS) ||
+             (uiPlatform == TT_PLATFORM_APPLE_UNICODE) || (uiPlatform == TT_PLATFORM_ISO))
+      iUnicode = i;
+    else if ((uiPlatform == TT_PLATFORM_MICROSOFT && uiEncoding == TT_MS_ID_SYMBOL_CS) &&
+             (iSymbol < 0))
+      iSymbol = i;
+  }
+  iChosen = (iUcs4 >= 0) ? iUcs4 : (iUnicode >= 0) ? iUnicode : iSymbol;
+  if (iChosen < 0)
+    return FcTrue;
+
+  memset(&Walk, 0, sizeof(Walk));
+  Walk.nGlyphs = nGlyphs;
+  Walk.bSymbol = (iChosen == iSymbol);
+  Walk.pCharSet = FcCharSetCreate();
+  if (!Walk.pCharSet)
+    return FcFalse;
+
+  pb = pbCmap + ReadULong(pbCmap + 4 + 8 * iChosen + 4);
+  uiFormat = ReadUShort(pb);
+  switch (uiFormat)
+  {
+    case 0:
+      bOk = (pb + 6 + 256 <= pbLimit);
+      for (i = 0; bOk && i < 256; i++)
+        MapChar(&Walk, i, pb[6 + i]);
+      break;
+
+    case 4:
+      bOk = WalkCmap4(&Walk, pb, pbLimit);
+      break;
+
+    case 6:
+      bOk = (pb + 10 <= pbLimit) && (pb + 10 + 2 * ReadUShort(pb + 8) <= pbLimit);
+      for (i = 0; bOk && i < ReadUShort(pb + 8); i++)
+        MapChar(&Walk, ReadUShort(pb + 6) + i, ReadUShort(pb + 10 + 2 * i));
+      break;
+
+    case 12:
+    case 13:
+      bOk = WalkCmap12(&Walk, pb, pbLimit, uiFormat == 13);
+      break;
+
+    default:
+      bOk = FcFalse;
+      break;
+  }
+  FlushRun(&Walk);
+
+  if (!bOk || Walk.bFailed)
+  {
+    FcCharSetDestroy(Walk.pCharSet);
+    return FcFalse;
+  }
+  *ppCharSet = Walk.pCharSet;
+  return FcTrue;
+}
+
+/*
+ * Read what a font description needs of a face. The names, OS/2 table and
+ * strings in *pInfo stay valid until the next face is read or the file is
+ * closed, FcSfntFaceDone() frees the coverage. Returns FcFalse if the face
+ * should be opened with FreeType instead.
+ */
+FcBool FcSfntReadFace(FcSfntFile *pSfnt, long lFaceIndex, FcFaceInfo_t *pInfo)
+{
+  FcSfntTable_t Name, OS2, Head, Maxp, Cmap, *pTable;
+  FT_Byte abHeader[12], abHead[54], abMaxp[6];
+  FT_Byte *pbDirectory = NULL, *pbCmap = NULL, *pbEntry;
+  FT_UInt nTables, i;
+  FcBool bHaveOS2;
+
+  FreeFaceData(pSfnt);
+  memset(pInfo, 0, sizeof(*pInfo));
+  memset(&Name, 0, sizeof(Name));
+  memset(&OS2, 0, sizeof(OS2));
+  memset(&Head, 0, sizeof(Head));
+  memset(&Maxp, 0, sizeof(Maxp));
+  memset(&Cmap, 0, sizeof(Cmap));
+  if ((lFaceIndex < 0) || (lFaceIndex >= pSfnt->lNumFaces))
+    return FcFalse;
+
+  /* the table directory */
+  if (!ReadAt(pSfnt->pFile, pSfnt->pulOffsets[lFaceIndex], abHeader, sizeof(abHeader)) ||
+      !IsSfntVersion(ReadULong(abHeader)))
+    return FcFalse;
+  nTables = ReadUShort(abHeader + 4);
+  pbDirectory = (FT_Byte *) malloc(nTables * 16 + 1);
+  if (!pbDirectory ||
+      !ReadAt(pSfnt->pFile, pSfnt->pulOffsets[lFaceIndex] + 12, pbDirectory, nTables * 16))
+    goto failed;
+  for (i = 0, pbEntry = pbDirectory; i < nTables; i++, pbEntry += 16)
+  {
+    switch (ReadULong(pbEntry))
+    {
+      case SFNT_TAG('n', 'a', 'm', 'e'): pTable = &Name; break;
+      case SFNT_TAG('O', 'S', '/', '2'): pTable = &OS2; break;
+      case SFNT_TAG('h', 'e', 'a', 'd'): pTable = &Head; break;
+      case SFNT_TAG('m', 'a', 'x', 'p'): pTable = &Maxp; break;
+      case SFNT_TAG('c', 'm', 'a', 'p'): pTable = &Cmap; break;
+      default: pTable = NULL; break;
+    }
+    if (pTable)
+    {
+      pTable->ulOffset = ReadULong(pbEntry + 8);
+      pTable->ulLength = ReadULong(pbEntry + 12);
+    }
+  }
+  free(pbDirectory);
+  pbDirectory = NULL;
+
+  /* FreeType can't do without head and maxp, and there is no family name
+   * without the name table, leave such faces to it */
+  if ((Head.ulLength < sizeof(abHead)) || (Maxp.ulLength < sizeof(abMaxp)) || !Name.ulLength ||
+      !ReadAt(pSfnt->pFile, Head.ulOffset, abHead, sizeof(abHead)) ||
+      !ReadAt(pSfnt->pFile, Maxp.ulOffset, abMaxp, sizeof(abMaxp)))
+    goto failed;
+
+  pSfnt->pbName = ReadTable(pSfnt->pFile, &Name);
+  if (!pSfnt->pbName || !ParseNameTable(pSfnt, pSfnt->pbName, Name.ulLength, &pInfo->nNames))
+    goto failed;
+  pInfo->pNames = pSfnt->pNames;
+
+  bHaveOS2 = OS2.ulLength && ReadOS2Table(pSfnt, &OS2);
+  if (bHaveOS2)
+    pInfo->pOS2 = &pSfnt->OS2;
+  else
+  {
+    /* old Mac fonts, FreeType takes the style from the head table */
+    if (ReadUShort(abHead + 44) & 1)
+      pInfo->lStyleFlags |= FT_STYLE_FLAG_BOLD;
+    if (ReadUShort(abHead + 44) & 2)
+      pInfo->lStyleFlags |= FT_STYLE_FLAG_ITALIC;
+  }
+
+  GetFreeTypeNames(pSfnt, pInfo->nNames, bHaveOS2);
+  pInfo->pchFamilyName = pSfnt->pchFamilyName;
+  pInfo->pchStyleName = pSfnt->pchStyleName;
+
+  if (Cmap.ulLength)
+  {
+    pbCmap = ReadTable(pSfnt->pFile, &Cmap);
+    if (!pbCmap ||
+        !ReadCharSet(pbCmap, Cmap.ulLength, ReadUShort(abMaxp + 4), &pInfo->pCharSet))
+      goto failed;
+    free(pbCmap);
+  }
+  return FcTrue;
+
+failed:
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Leaving face %ld of a font file to FreeType\n", lFaceIndex);
+#endif
+  if (pbDirectory)
+    free(pbDirectory);
+  if (pbCmap)
+    free(pbCmap);
+  FreeFaceData(pSfnt);
+  memset(pInfo, 0, sizeof(*pInfo));
+  return FcFalse;
+}
+
+void FcSfntFaceDone(FcFaceInfo_t *pInfo)
+{
+  FcCharSetDestroy(pInfo->pCharSet);
+  pInfo->pCharSet = NULL;
+}
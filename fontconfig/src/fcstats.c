@@ -0,0 +1,130 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Runtime statistics.
+ *
+ * The library counts what it does as it goes: faces scanned and opened,
+ * hits and misses of the font cache, matches and how they were found, and
+ * how long building and refreshing the font list took. Counting is an
+ * atomic addition, cheap enough to be always on, unlike the debug output.
+ * FcStatsGet() hands out the counters, FcStatsReset() starts them over.
+ */
+
+static volatile unsigned long aulCounters[FC_STAT_NUM_COUNTERS];
+
+/* microseconds, of all and of the last init and reinit */
+static unsigned long long ullInitTime, ullLastInitTime;
+static unsigned long long ullReinitTime, ullLastReinitTime;
+static FcLock_t hTimeLock;
+
+void FcStatsAdd(int iCounter, unsigned long ulValue)
+{
+  __sync_fetch_and_add(aulCounters + iCounter, ulValue);
+}
+
+/* A monotonic clock in microseconds */
+unsigned long long FcStatsNow(void)
+{
+#ifdef OS2
+  ULONG ulMs = 0;
+
+  DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ulMs, sizeof(ULONG));
+  return (unsigned long long) ulMs * 1000;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* Count a font list built from scratch or refreshed, which began at
+ * ullStart (see FcStatsNow()) */
+void FcStatsInitDone(FcBool bReinit, unsigned long long ullStart)
+{
+  unsigned long long ullTime = FcStatsNow() - ullStart;
+
+  FcLockAcquire(&hTimeLock);
+  if (bReinit)
+  {
+    ullReinitTime += ullTime;
+    ullLastReinitTime = ullTime;
+  }
+  else
+  {
+    ullInitTime += ullTime;
+    ullLastInitTime = ullTime;
+  }
+  FcLockRelease(&hTimeLock);
+  FcStatsAdd(bReinit ? FC_STAT_REINITS : FC_STAT_INITS, 1);
+}
+
+fcExport void FcStatsGet(FcStats *stats)
+{
+  FcCatalog_t *pCatalog;
+  unsigned long ulCompared;
+
+  if (!stats)
+    return;
+
+  memset(stats, 0, sizeof(FcStats));
+  stats->faces_scanned = aulCounters[FC_STAT_FACES_SCANNED];
+  stats->faces_opened = aulCounters[FC_STAT_FACES_OPENED];
+  stats->cache_hits = aulCounters[FC_STAT_CACHE_HITS];
+  stats->cache_misses = aulCounters[FC_STAT_CACHE_MISSES];
+  stats->faces_reused = aulCounters[FC_STAT_FACES_REUSED];
+  stats->match_calls = aulCounters[FC_STAT_MATCH_CALLS];
+  stats->match_memo_hits = aulCounters[FC_STAT_MATCH_MEMO_HITS];
+  stats->match_faces = aulCounters[FC_STAT_MATCH_FACES];
+  stats->match_exact = aulCounters[FC_STAT_MATCH_EXACT];
+  stats->match_alias = aulCounters[FC_STAT_MATCH_ALIAS];
+  stats->match_substring = aulCounters[FC_STAT_MATCH_SUBSTRING];
+  stats->match_none = aulCounters[FC_STAT_MATCH_NONE];
+  ulCompared = stats->match_exact + stats->match_alias +
+               stats->match_substring + stats->match_none;
+  if (ulCompared)
+    stats->match_faces_avg = (double) stats->match_faces / ulCompared;
+
+  stats->inits = aulCounters[FC_STAT_INITS];
+  stats->reinits = aulCounters[FC_STAT_REINITS];
+  FcLockAcquire(&hTimeLock);
+  stats->init_seconds = ullInitTime / 1e6;
+  stats->last_init_seconds = ullLastInitTime / 1e6;
+  stats->reinit_seconds = ullReinitTime / 1e6;
+  stats->last_reinit_seconds = ullLastReinitTime / 1e6;
+  FcLockRelease(&hTimeLock);
+
+  pCatalog = FcCatalogAcquire();
+  if (pCatalog)
+  {
+    stats->catalog_fonts = pCatalog->iNumFonts;
+    stats->catalog_bytes = pCatalog->cbSize;
+    FcCatalogRelease(pCatalog);
+  }
+}
+
+fcExport void FcStatsReset(void)
+{
+  int i;
+
+  for (i = 0; i < FC_STAT_NUM_COUNTERS; i++)
+    __sync_lock_test_and_set(aulCounters + i, 0);
+  FcLockAcquire(&hTimeLock);
+  ullInitTime = ullLastInitTime = 0;
+  ullReinitTime = ullLastReinitTime = 0;
+  FcLockRelease(&hTimeLock);
+}
@@ -40,6 +40,15 @@ fcExport FcChar8* FcStrCopy (const FcChar8 *s)
     return r;
 }
 
+/*
+ * Small sets, like the extra languages of a language set, are searched
+ * linearly. Once a set has room for more than FC_STR_SET_LINEAR strings it
+ * gets an open addressing hash table of the indices of its strings, so
+ * looking for a string doesn't depend on the size of the set. The strings
+ * stay in the order they were added, for FcStrList.
+ */
+#define FC_STR_SET_LINEAR   8
+
 fcExport FcStrSet* FcStrSetCreate (void)
 {
     FcStrSet	*set = malloc (sizeof (FcStrSet));
@@ -49,6 +58,8 @@ fcExport FcStrSet* FcStrSetCreate (void)
     set->num = 0;
     set->size = 0;
     set->strs = 0;
+    set->hash = 0;
+    set->hash_mask = 0;
     return set;
 }
 
@@ -64,32 +75,73 @@ void FcStrSetDestroy (FcStrSet *set)
 	{
 	    free (set->strs);
 	}
+	if (set->hash)
+	    free (set->hash);
 	free (set);
     }
 }
 
-static FcBool _FcStrSetAppend (FcStrSet *set, FcChar8 *s)
+/* Return the hash slot of s, or of the empty slot where it would go */
+static int FcStrSetSlot (const FcStrSet *set, const FcChar8 *s)
 {
-    if (FcStrSetMember (set, s))
+    int	    slot = FcStringHash (s) & set->hash_mask;
+
+    while (set->hash[slot] &&
+	   strcmp ((char *) set->strs[set->hash[slot] - 1], (char *) s))
+	slot = (slot + 1) & set->hash_mask;
+    return slot;
+}
+
+/* Make room for size strings, doubling the room there is at least */
+static FcBool FcStrSetGrow (FcStrSet *set, int size)
+{
+    FcChar8	**strs;
+    int		*hash = 0;
+    int		i, slots = 0;
+
+    if (size < set->size * 2)
+	size = set->size * 2;
+    if (size < 4)
+	size = 4;
+    if (size > FC_STR_SET_LINEAR)
     {
-	free (s);
-	return FcTrue;
+	/* at most half of the slots are used */
+	for (slots = 16; slots < size * 2; slots <<= 1)
+	    ;
+	hash = calloc (slots, sizeof (int));
+	if (!hash)
+	    return FcFalse;
     }
-    if (set->num == set->size)
+    /* one more for the terminating 0 */
+    strs = realloc (set->strs, (size + 1) * sizeof (FcChar8 *));
+    if (!strs)
     {
-	FcChar8 **strs = malloc ((set->size + 2) * sizeof (FcChar8 *));
+	if (hash)
+	    free (hash);
+	return FcFalse;
+    }
+    set->strs = strs;
+    set->size = size;
 
-	if (!strs)
-	    return FcFalse;
-	if (set->num)
-	    memcpy (strs, set->strs, set->num * sizeof (FcChar8 *));
-	if (set->strs)
-	{
-	    free (set->strs);
-	}
-	set->size = set->size + 1;
-	set->strs = strs;
+    if (hash)
+    {
+	if (set->hash)
+	    free (set->hash);
+	set->hash = hash;
+	set->hash_mask = slots - 1;
+	for (i = 0; i < set->num; i++)
+	    set->hash[FcStrSetSlot (set, set->strs[i])] = i + 1;
     }
+    return FcTrue;
+}
+
+/* Add a string the set doesn't have yet, the set takes it over */
+static FcBool _FcStrSetAppend (FcStrSet *set, FcChar8 *s)
+{
+    if (set->num == set->size && !FcStrSetGrow (set, set->num + 1))
+	return FcFalse;
+    if (set->hash)
+	set->hash[FcStrSetSlot (set, s)] = set->num + 1;
     set->strs[set->num++] = s;
     set->strs[set->num] = 0;
     return FcTrue;
@@ -99,6 +151,8 @@ fcExport FcBool FcStrSetMember (FcStrSet *set, const FcChar8 *s)
 {
     int	i;
 
+    if (set->hash)
+	return set->hash[FcStrSetSlot (set, s)] != 0;
     for (i = 0; i < set->num; i++)
 	if (!strcmp((char *)set->strs[i], (char *)s)) // i don't use FcStrCmp here as strcmp does the same
 	    return FcTrue;
@@ -107,7 +161,11 @@ fcExport FcBool FcStrSetMember (FcStrSet *set, const FcChar8 *s)
 
 fcExport FcBool FcStrSetAdd (FcStrSet *set, const FcChar8 *s)
 {
-    FcChar8 *new = FcStrCopy (s);
+    FcChar8 *new;
+
+    if (FcStrSetMember (set, s))
+	return FcTrue;
+    new = FcStrCopy (s);
     if (!new)
 	return FcFalse;
     if (!_FcStrSetAppend (set, new))
@@ -118,6 +176,22 @@ fcExport FcBool FcStrSetAdd (FcStrSet *set, const FcChar8 *s)
     return FcTrue;
 }
 
+/*
+ * Add num strings at once. The room for all of them is made first, strings
+ * the set already has, or that come more than once, are only added once.
+ */
+fcExport FcBool FcStrSetAddMany (FcStrSet *set, const FcChar8 * const *strs, int num)
+{
+    int	i;
+
+    if (set->num + num > set->size && !FcStrSetGrow (set, set->num + num))
+	return FcFalse;
+    for (i = 0; i < num; i++)
+	if (!FcStrSetAdd (set, strs[i]))
+	    return FcFalse;
+    return FcTrue;
+}
+
 fcExport FcStrList* FcStrListCreate (FcStrSet *set)
 {
     FcStrList	*list;
@@ -0,0 +1,341 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+/*
+ * Family substitution rules.
+ *
+ * A rule names the families to try for a family that is asked for but not
+ * installed, like the generic families and the OS/2 names of the standard
+ * fonts. The rules are lines of
+ *
+ *    <family>[:<lang>] = <family>[, <family>...]
+ *
+ * where a rule with :<lang> is only used for patterns of that language.
+ * Families are compared case insensitively, a family in double quotes keeps
+ * its spaces. Family "monospace" is also used for patterns asking for
+ * monospaced fonts, and family "*" is what FcFontSort() falls back to if
+ * nothing matches. Everything after a '#' is a comment.
+ *
+ * The built-in rules below come first, then the rules of the file named by
+ * FC_SUBST_FILE, or of fcsubst.cfg in %ETC% on OS/2 and
+ * /etc/fonts/fcsubst.conf elsewhere, which replace built-in rules for the
+ * same family and language. The rules are read once, by the first
+ * FcInit(), and compiled into a hash table of the families, so looking up
+ * the rule of a pattern is a single hash probe.
+ */
+
+static const char achBuiltinRules[] =
+  "monospace       = " DEFAULT_MONOSPACED_FONT "\n"
+  "swiss           = " DEFAULT_SANSSERIF_FONT "\n"
+  "helv            = " DEFAULT_SANSSERIF_FONT "\n"
+  "sans-serif      = " DEFAULT_SANSSERIF_FONT "\n"
+  "sans            = " DEFAULT_SANSSERIF_FONT "\n"
+  /* Times New Roman also comes with an additional trailing space */
+  "serif           = " DEFAULT_SERIF_FONT ", \"" DEFAULT_SERIF_FONT " \"\n"
+  "tms rmn         = " DEFAULT_SERIF_FONT ", \"" DEFAULT_SERIF_FONT " \"\n"
+  DEFAULT_SERIF_FONT " = " DEFAULT_SERIF_FONT ", \"" DEFAULT_SERIF_FONT " \"\n"
+  "opensymbol      = " DEFAULT_SYMBOL_FONT "\n"
+  "zapfdingbats    = " DEFAULT_DINGBATS_FONT "\n"
+  "zapf dingbats   = " DEFAULT_DINGBATS_FONT "\n"
+  "*               = " DEFAULT_SERIF_FONT "\n"
+  "*:ja            = " DEFAULT_SERIF_FONTJA "\n";
+
+static FcSubstRule_t  *pRules;          /* in the order they were read */
+static FcSubstRule_t **ppRuleBuckets;
+static int             iRuleBuckets;    /* power of two */
+static FcBool          bRulesLoaded;
+
+/* Cut the blanks off both ends of a string */
+static char *Trim(char *pch)
+{
+  char *pchEnd;
+
+  while (*pch == ' ' || *pch == '\t')
+    pch++;
+  pchEnd = pch + strlen(pch);
+  while (pchEnd > pch && (pchEnd[-1] == ' ' || pchEnd[-1] == '\t' ||
+                          pchEnd[-1] == '\r' || pchEnd[-1] == '\n'))
+    pchEnd--;
+  *pchEnd = 0;
+  return pch;
+}
+
+/* Add the rule of a line, a rule for the same family and language replaces
+ * the one there is */
+static void ParseRule(char *pchLine)
+{
+  char *apchFamilies[16];
+  char *pchName, *pchLang, *pchFamilies, *pch;
+  FcSubstRule_t *pRule, **ppRule;
+  int iNumFamilies = 0;
+  int cbStrings, i;
+
+  pch = strchr(pchLine, '#');
+  if (pch)
+    *pch = 0;
+  pchFamilies = strchr(pchLine, '=');
+  if (!pchFamilies)
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    if (Trim(pchLine)[0])
+      fprintf(stderr, "XX: Substitution rule without '=': [%s]\n", pchLine);
+#endif
+    return;
+  }
+  *pchFamilies++ = 0;
+
+  pchName = Trim(pchLine);
+  pchLang = strchr(pchName, ':');
+  if (pchLang)
+  {
+    *pchLang++ = 0;
+    pchName = Trim(pchName);
+    pchLang = Trim(pchLang);
+  }
+
+  // split the families, a quoted one may contain anything but quotes
+  for (pch = pchFamilies; *pch && iNumFamilies < 16; )
+  {
+    char *pchFamily;
+
+    pch = Trim(pch);
+    if (*pch == '"')
+    {
+      pchFamily = ++pch;
+      pch = strchr(pch, '"');
+      if (!pch)
+        break;
+      *pch++ = 0;
+      pch = strchr(pch, ',');
+      if (pch)
+        pch++;
+    }
+    else
+    {
+      pchFamily = pch;
+      pch = strchr(pch, ',');
+      if (pch)
+        *pch++ = 0;
+      pchFamily = Trim(pchFamily);
+    }
+    if (pchFamily[0])
+      apchFamilies[iNumFamilies++] = pchFamily;
+    if (!pch)
+      break;
+  }
+
+  if (!pchName[0] || !iNumFamilies)
+  {
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Incomplete substitution rule for [%s]\n", pchName);
+#endif
+    return;
+  }
+
+  // the rule, its family array and its strings are one block
+  cbStrings = strlen(pchName) + 1 + (pchLang ? strlen(pchLang) + 1 : 0);
+  for (i = 0; i < iNumFamilies; i++)
+    cbStrings += strlen(apchFamilies[i]) + 1;
+  pRule = (FcSubstRule_t *) malloc(sizeof(FcSubstRule_t) +
+                                   iNumFamilies * sizeof(const char *) + cbStrings);
+  if (!pRule)
+    return;
+
+  pRule->ppchFamilies = (const char **) (pRule + 1);
+  pRule->iNumFamilies = iNumFamilies;
+  pch = (char *) (pRule->ppchFamilies + iNumFamilies);
+  pRule->pchName = strcpy(pch, pchName);
+  pch += strlen(pch) + 1;
+  pRule->pchLang = NULL;
+  if (pchLang && pchLang[0])
+  {
+    pRule->pchLang = strcpy(pch, pchLang);
+    pch += strlen(pch) + 1;
+  }
+  for (i = 0; i < iNumFamilies; i++)
+  {
+    pRule->ppchFamilies[i] = strcpy(pch, apchFamilies[i]);
+    pch += strlen(pch) + 1;
+  }
+  pRule->ulHash = FcStringHashIgnoreCase((const FcChar8 *) pRule->pchName);
+  pRule->pNext = NULL;
+  pRule->pBucketNext = NULL;
+
+  for (ppRule = &pRules; *ppRule; ppRule = &(*ppRule)->pNext)
+  {
+    if (!stricmp((*ppRule)->pchName, pRule->pchName) &&
+        ((!(*ppRule)->pchLang && !pRule->pchLang) ||
+         ((*ppRule)->pchLang && pRule->pchLang && !stricmp((*ppRule)->pchLang, pRule->pchLang))))
+    {
+      pRule->pNext = (*ppRule)->pNext;
+      free(*ppRule);
+      break;
+    }
+  }
+  *ppRule = pRule;
+}
+
+static void ParseRules(FILE *fp, const char *pchRules)
+{
+  char achLine[512];
+  int cchLine;
+
+  for (;;)
+  {
+    if (fp)
+    {
+      if (!fgets(achLine, sizeof(achLine), fp))
+        break;
+    }
+    else
+    {
+      if (!*pchRules)
+        break;
+      cchLine = strcspn(pchRules, "\n");
+      if (cchLine >= (int) sizeof(achLine))
+        cchLine = sizeof(achLine) - 1;
+      memcpy(achLine, pchRules, cchLine);
+      achLine[cchLine] = 0;
+      pchRules += strcspn(pchRules, "\n");
+      if (*pchRules)
+        pchRules++;
+    }
+    ParseRule(achLine);
+  }
+}
+
+static FILE *OpenRulesFile(void)
+{
+  char achFileName[CCHMAXPATH];
+  const char *pchEnvVar;
+
+  pchEnvVar = getenv("FC_SUBST_FILE");
+  if (pchEnvVar && pchEnvVar[0])
+    return fopen(pchEnvVar, "r");
+#ifdef OS2
+  pchEnvVar = getenv("ETC");
+  if (!pchEnvVar || !pchEnvVar[0])
+    return NULL;
+  snprintf(achFileName, sizeof(achFileName), "%s\\fcsubst.cfg", pchEnvVar);
+#else
+  snprintf(achFileName, sizeof(achFileName), "/etc/fonts/fcsubst.conf");
+#endif
+  return fopen(achFileName, "r");
+}
+
+/* Read the rules and compile them into the hash table, once */
+FcBool FcSubstLoad(void)
+{
+  FcSubstRule_t *pRule;
+  FILE *fp;
+  int iNumRules = 0;
+
+  if (bRulesLoaded)
+    return FcTrue;
+
+  ParseRules(NULL, achBuiltinRules);
+  fp = OpenRulesFile();
+  if (fp)
+  {
+    ParseRules(fp, NULL);
+    fclose(fp);
+  }
+
+  for (pRule = pRules; pRule; pRule = pRule->pNext)
+    iNumRules++;
+  for (iRuleBuckets = 16; iRuleBuckets < iNumRules * 2; iRuleBuckets *= 2)
+    ;
+  ppRuleBuckets = (FcSubstRule_t **) calloc(iRuleBuckets, sizeof(FcSubstRule_t *));
+  if (!ppRuleBuckets)
+    return FcFalse;
+
+  // the rules of a family with a language go before the one without
+  for (pRule = pRules; pRule; pRule = pRule->pNext)
+  {
+    FcSubstRule_t **ppRule = ppRuleBuckets + (pRule->ulHash & (iRuleBuckets - 1));
+
+    if (!pRule->pchLang)
+      while (*ppRule)
+        ppRule = &(*ppRule)->pBucketNext;
+    pRule->pBucketNext = *ppRule;
+    *ppRule = pRule;
+  }
+  bRulesLoaded = FcTrue;
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: %d substitution rules loaded\n", iNumRules);
+#endif
+  return FcTrue;
+}
+
+/* Check if a rule language is the one of a pattern, "ja" is also "ja-JP" */
+static FcBool LangMatches(const char *pchRuleLang, const char *pchLang)
+{
+  int cch = strlen(pchRuleLang);
+
+  return pchLang && !strnicmp(pchRuleLang, pchLang, cch) &&
+         (!pchLang[cch] || pchLang[cch] == '-' || pchLang[cch] == '_');
+}
+
+static const FcSubstRule_t *FindRule(const char *pchName, const char *pchLang)
+{
+  const FcSubstRule_t *pRule;
+  FcChar32 ulHash;
+
+  if (!ppRuleBuckets || !pchName)
+    return NULL;
+
+  ulHash = FcStringHashIgnoreCase((const FcChar8 *) pchName);
+  for (pRule = ppRuleBuckets[ulHash & (iRuleBuckets - 1)]; pRule; pRule = pRule->pBucketNext)
+  {
+    if (pRule->ulHash == ulHash && !stricmp(pRule->pchName, pchName) &&
+        (!pRule->pchLang || LangMatches(pRule->pchLang, pchLang)))
+      return pRule;
+  }
+  return NULL;
+}
+
+static const FcSubstRule_t *LookupRule(const FcPattern *p)
+{
+  if (p->spacing == FC_MONO)
+    return FindRule("monospace", p->lang);
+  // "*" is not a family
+  if (p->family && strcmp(p->family, "*"))
+    return FindRule(p->family, p->lang);
+  return NULL;
+}
+
+/* The rule for the family of a pattern, or NULL if it has none */
+const FcSubstRule_t *FcSubstFind(const FcPattern *p)
+{
+  if (p->substituted)
+    return p->pSubst;
+  return LookupRule(p);
+}
+
+/* The rule of the families to fall back to if nothing matches a pattern */
+const FcSubstRule_t *FcSubstFallback(const FcPattern *p)
+{
+  return FindRule("*", p->lang);
+}
+
+/* Remember the rule in the pattern, until it is changed */
+void FcSubstApply(FcPattern *p)
+{
+  if (!FcPatternBeginChange(p))
+    return;
+  p->pSubst = LookupRule(p);
+  p->substituted = FcTrue;
+}
@@ -0,0 +1,517 @@
+/*
+ * This code is (C) Netlabs.org
+ * Authors:
+ *    Doodle <doodle@netlabs.org>
+ *    Peter Weilbacher <mozilla@weilbacher.org>
+ *
+ * Contributors:
+ *    KO Myung-Hun <komh78@gmail.com>
+ *    Alex Taylor <alex@altsan.org>
+ *    Rich Walsh <rich@e-vertise.com>
+ *    Silvan Scherrer <silvan.scherrer@aroa.ch>
+ *
+ */
+
+#include "fcint.h"
+
+#if defined(__linux__)
+#define FC_HAVE_INOTIFY
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+/*
+ * Noticing changes of the fonts.
+ *
+ * While a scan builds the font list, it tells us about every font
+ * directory and font file it looked at, together with the modification
+ * time and size it saw. When the scan is done, the directories are watched
+ * with inotify where there is one, through a single instance that stays
+ * open until FcFini(): closing one takes the kernel several milliseconds,
+ * too long for every refresh. Otherwise, and for directories that don't
+ * exist (yet), the recorded times and sizes are compared with the real
+ * ones every FC_POLL_INTERVAL seconds.
+ *
+ * Every change noticed increments a generation counter. The font list is up
+ * to date as long as the counter is still where it was when the scan of
+ * the list started, so FcConfigUptoDate() and FcInitBringUptoDate() only
+ * have to look at pending events, and refreshes only happen when fonts
+ * actually changed.
+ *
+ * The names of the files that were reported changed are remembered until
+ * the next scan, which opens them again even if their size and time look
+ * the same as before (a file rewritten within the second it was scanned
+ * in, for example).
+ *
+ * The cache file is not watched: another process sharing it rewrites it
+ * after scanning the same fonts, which is no change of the fonts.
+ */
+
+#define FC_POLL_INTERVAL 30 // poll after 30s, the reinit time of original FC
+
+typedef struct FcWatchEntry_s
+{
+  char   *pchPath;
+  time_t  tMTime;          /* (time_t)-1 if it does not exist */
+  off_t   cbSize;
+  int     iKind;           /* FC_WATCH_* */
+  int     iWatch;          /* inotify watch descriptor, -1 if none */
+} FcWatchEntry_t;
+
+typedef struct FcWatchList_s
+{
+  FcWatchEntry_t *pEntries;
+  int             iNumEntries;
+  int             iSize;
+} FcWatchList_t;
+
+/* set of changed file names */
+typedef struct FcNameSet_s
+{
+  char     **ppchNames;
+  FcChar32   ulHashMask;
+  int        iNumNames;
+  FcBool     bAll;         /* events were lost, treat every file as changed */
+} FcNameSet_t;
+
+static FcWatchList_t NewList;        /* being filled by the scan */
+static FcWatchList_t CurList;        /* watched */
+static FcNameSet_t   Changed;        /* changes noticed since the scan started */
+static FcNameSet_t   ScanChanged;    /* changes the running scan takes care of */
+static int           iInotify = -1;  /* open from the first scan to FcFini() */
+static FcBool        bWatching;
+static time_t        tLastPoll;
+#ifdef OS2
+static ULONG         ulProfileSize;  /* of the PM_Fonts key list */
+#endif
+static volatile int  iGeneration;
+static volatile int  iListGeneration;    /* the font list reflects */
+static int           iBeginGeneration;
+static FcLock_t      hWatchLock;
+
+static void FreeList(FcWatchList_t *pList)
+{
+  int i;
+
+  for (i = 0; i < pList->iNumEntries; i++)
+    free(pList->pEntries[i].pchPath);
+  if (pList->pEntries)
+    free(pList->pEntries);
+  memset(pList, 0, sizeof(*pList));
+}
+
+static void FreeNameSet(FcNameSet_t *pSet)
+{
+  FcChar32 i;
+
+  if (pSet->ppchNames)
+  {
+    for (i = 0; i <= pSet->ulHashMask; i++)
+      if (pSet->ppchNames[i])
+        free(pSet->ppchNames[i]);
+    free(pSet->ppchNames);
+  }
+  memset(pSet, 0, sizeof(*pSet));
+}
+
+static FcBool NameSetFind(const FcNameSet_t *pSet, const char *pchName)
+{
+  FcChar32 ulSlot;
+
+  if (!pSet->ppchNames)
+    return FcFalse;
+  for (ulSlot = FcStringHash((const FcChar8 *)pchName) & pSet->ulHashMask;
+       pSet->ppchNames[ulSlot];
+       ulSlot = (ulSlot + 1) & pSet->ulHashMask)
+    if (!strcmp(pSet->ppchNames[ulSlot], pchName))
+      return FcTrue;
+  return FcFalse;
+}
+
+/* Remember a changed file, if that fails every file counts as changed */
+static void NameSetAdd(FcNameSet_t *pSet, const char *pchName)
+{
+  char **ppchOld = pSet->ppchNames;
+  FcChar32 ulOldMask = pSet->ulHashMask;
+  FcChar32 ulSlot, i;
+
+  if (pSet->bAll || NameSetFind(pSet, pchName))
+    return;
+
+  /* keep it at most half full */
+  if (!ppchOld || (pSet->iNumNames + 1) * 2 > ulOldMask + 1)
+  {
+    pSet->ulHashMask = ppchOld ? ulOldMask * 2 + 1 : 63;
+    pSet->ppchNames = (char **) calloc(pSet->ulHashMask + 1, sizeof(char *));
+    if (!pSet->ppchNames)
+    {
+      pSet->ppchNames = ppchOld;
+      pSet->ulHashMask = ulOldMask;
+      pSet->bAll = FcTrue;
+      return;
+    }
+    for (i = 0; ppchOld && i <= ulOldMask; i++)
+    {
+      if (!ppchOld[i])
+        continue;
+      for (ulSlot = FcStringHash((const FcChar8 *)ppchOld[i]) & pSet->ulHashMask;
+           pSet->ppchNames[ulSlot];
+           ulSlot = (ulSlot + 1) & pSet->ulHashMask)
+        ;
+      pSet->ppchNames[ulSlot] = ppchOld[i];
+    }
+    if (ppchOld)
+      free(ppchOld);
+  }
+
+  for (ulSlot = FcStringHash((const FcChar8 *)pchName) & pSet->ulHashMask;
+       pSet->ppchNames[ulSlot];
+       ulSlot = (ulSlot + 1) & pSet->ulHashMask)
+    ;
+  if (!(pSet->ppchNames[ulSlot] = strdup(pchName)))
+    pSet->bAll = FcTrue;
+  else
+    pSet->iNumNames++;
+}
+
+static void NoticeChange(const char *pchPath)
+{
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Noticed a change of [%s]\n", pchPath ? pchPath : "?");
+#endif
+  if (pchPath)
+    NameSetAdd(&Changed, pchPath);
+  else
+    Changed.bAll = FcTrue;
+  FcAtomicInc(&iGeneration);
+}
+
+#ifdef FC_HAVE_INOTIFY
+#define DIRECTORY_EVENTS  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                           IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* Take the pending events of an inotify instance watching a list */
+static void ReadEvents(int iFd, const FcWatchList_t *pList)
+{
+  /* aligned for struct inotify_event */
+  long alBuffer[1024];
+  const struct inotify_event *pEvent;
+  const char *pch;
+  char achPath[CCHMAXPATH];
+  ssize_t cbRead;
+  int i;
+
+  while ((cbRead = read(iFd, alBuffer, sizeof(alBuffer))) > 0)
+  {
+    for (pch = (const char *) alBuffer; pch < (const char *) alBuffer + cbRead;
+         pch += sizeof(struct inotify_event) + pEvent->len)
+    {
+      pEvent = (const struct inotify_event *) pch;
+      if (pEvent->mask & IN_Q_OVERFLOW)
+      {
+        NoticeChange(NULL);
+        continue;
+      }
+
+      for (i = 0; i < pList->iNumEntries; i++)
+        if (pList->pEntries[i].iWatch == pEvent->wd)
+          break;
+      /* events of a watch we removed ourselves */
+      if (i >= pList->iNumEntries)
+        continue;
+
+      if (pEvent->len && pEvent->name[0] &&
+          (snprintf(achPath, sizeof(achPath), "%s/%s", pList->pEntries[i].pchPath,
+                    pEvent->name) < sizeof(achPath)))
+        NoticeChange(achPath);
+      else
+        NoticeChange(pList->pEntries[i].pchPath);
+    }
+  }
+}
+
+/* Stop watching, all of a list or the watches it shares with nothing in
+ * the list pKeep */
+static void RemoveWatches(FcWatchList_t *pList, const FcWatchList_t *pKeep)
+{
+  char *pchKeep = NULL;
+  int iMaxWatch = -1;
+  int i;
+
+  /* watch descriptors are small numbers, mark the ones still in use */
+  for (i = 0; pKeep && (i < pKeep->iNumEntries); i++)
+    if (pKeep->pEntries[i].iWatch > iMaxWatch)
+      iMaxWatch = pKeep->pEntries[i].iWatch;
+  if (iMaxWatch >= 0)
+  {
+    pchKeep = (char *) calloc(iMaxWatch + 1, 1);
+    /* without the marks keep all, a stale watch only costs a few events */
+    if (!pchKeep)
+      return;
+    for (i = 0; i < pKeep->iNumEntries; i++)
+      if (pKeep->pEntries[i].iWatch >= 0)
+        pchKeep[pKeep->pEntries[i].iWatch] = 1;
+  }
+
+  for (i = 0; i < pList->iNumEntries; i++)
+  {
+    if ((pList->pEntries[i].iWatch >= 0) &&
+        ((pList->pEntries[i].iWatch > iMaxWatch) || !pchKeep[pList->pEntries[i].iWatch]))
+      inotify_rm_watch(iInotify, pList->pEntries[i].iWatch);
+    pList->pEntries[i].iWatch = -1;
+  }
+
+  if (pchKeep)
+    free(pchKeep);
+}
+
+/*
+ * Watch the directories of a list, returns FcFalse if the list has to be
+ * polled. Paths that don't exist are polled in any case. A directory that
+ * is watched already keeps its watch descriptor.
+ */
+static FcBool AddWatches(FcWatchList_t *pList)
+{
+  FcWatchEntry_t *pEntry;
+  int i;
+
+  if (iInotify < 0)
+    iInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (iInotify < 0)
+    return FcFalse;
+
+  for (i = 0; i < pList->iNumEntries; i++)
+  {
+    pEntry = pList->pEntries + i;
+    if ((pEntry->iKind == FC_WATCH_FONT) || (pEntry->tMTime == (time_t)-1))
+      continue;
+
+    pEntry->iWatch = inotify_add_watch(iInotify, pEntry->pchPath, DIRECTORY_EVENTS);
+    if ((pEntry->iWatch < 0) && (errno != ENOENT))
+    {
+      /* most likely out of watches, poll all of it then */
+#ifdef FONTCONFIG_DEBUG_PRINTF
+      fprintf(stderr, "XX: Could not watch [%s], polling\n", pEntry->pchPath);
+#endif
+      RemoveWatches(pList, NULL);
+      return FcFalse;
+    }
+  }
+  return FcTrue;
+}
+#endif /* FC_HAVE_INOTIFY */
+
+/* Compare the recorded state of the entries that are not watched with the
+ * real one */
+static void Poll(void)
+{
+  FcWatchEntry_t *pEntry;
+  struct stat statBuf;
+  time_t tMTime;
+  off_t cbSize;
+  int i;
+#ifdef OS2
+  ULONG ulSize = 0;
+
+  PrfQueryProfileSize(HINI_USER, (PSZ)"PM_Fonts", NULL, &ulSize);
+  if (ulSize != ulProfileSize)
+  {
+    ulProfileSize = ulSize;
+    NoticeChange("PM_Fonts");
+  }
+#endif
+
+  for (i = 0; i < CurList.iNumEntries; i++)
+  {
+    pEntry = CurList.pEntries + i;
+    if (pEntry->iWatch >= 0)
+      continue;
+
+    if (stat(pEntry->pchPath, &statBuf) == -1)
+    {
+      tMTime = (time_t)-1;
+      cbSize = 0;
+    }
+    else
+    {
+      tMTime = statBuf.st_mtime;
+      cbSize = (pEntry->iKind == FC_WATCH_DIRECTORY) ? 0 : statBuf.st_size;
+    }
+
+    if ((tMTime != pEntry->tMTime) || (cbSize != pEntry->cbSize))
+    {
+      pEntry->tMTime = tMTime;
+      pEntry->cbSize = cbSize;
+      NoticeChange(pEntry->pchPath);
+    }
+  }
+  tLastPoll = time(NULL);
+}
+
+/* Look for changes, hWatchLock must be held */
+static void CheckForChanges(FcBool bPollNow)
+{
+  if (!bWatching)
+    return;
+#ifdef FC_HAVE_INOTIFY
+  if (iInotify >= 0)
+    ReadEvents(iInotify, &CurList);
+#endif
+  if (bPollNow || (difftime(time(NULL), tLastPoll) >= FC_POLL_INTERVAL))
+    Poll();
+}
+
+/*
+ * A scan starts: the changes noticed so far are the ones it takes care of.
+ * The current watches stay active until the scan is done.
+ */
+void FcWatchBegin(void)
+{
+  FcLockAcquire(&hWatchLock);
+  CheckForChanges(FcFalse);
+  FreeNameSet(&ScanChanged);
+  ScanChanged = Changed;
+  memset(&Changed, 0, sizeof(Changed));
+  iBeginGeneration = iGeneration;
+  FreeList(&NewList);
+  FcLockRelease(&hWatchLock);
+}
+
+/*
+ * Tell what the scan found at a path. tMTime is (time_t)-1 if the path does
+ * not exist. Only the scanning thread calls this.
+ */
+void FcWatchAdd(const char *pchPath, time_t tMTime, off_t cbSize, int iKind)
+{
+  FcWatchEntry_t *pEntry;
+
+  if (NewList.iNumEntries >= NewList.iSize)
+  {
+    int iNewSize = NewList.iSize ? NewList.iSize * 2 : 256;
+    FcWatchEntry_t *pNewEntries;
+
+    pNewEntries = (FcWatchEntry_t *) realloc(NewList.pEntries, iNewSize * sizeof(FcWatchEntry_t));
+    if (!pNewEntries)
+      return;
+    NewList.pEntries = pNewEntries;
+    NewList.iSize = iNewSize;
+  }
+
+  pEntry = NewList.pEntries + NewList.iNumEntries;
+  pEntry->pchPath = strdup(pchPath);
+  if (!pEntry->pchPath)
+    return;
+  pEntry->tMTime = tMTime;
+  pEntry->cbSize = (iKind == FC_WATCH_DIRECTORY) ? 0 : cbSize;
+  pEntry->iKind = iKind;
+  pEntry->iWatch = -1;
+  NewList.iNumEntries++;
+}
+
+/*
+ * The scan is done, watch what it has seen. Changes that happened while it
+ * ran may or may not be in the new font list, so they leave it out of date.
+ */
+void FcWatchEnd(void)
+{
+#ifdef FC_HAVE_INOTIFY
+  FcBool bInotify;
+  FcWatchEntry_t *pEntry;
+  struct stat statBuf;
+  int i, j;
+#endif
+
+  FcLockAcquire(&hWatchLock);
+
+#ifdef FC_HAVE_INOTIFY
+  /* the events so far belong to the old watches. The directories that
+   * are in both lists keep their watch, so nothing gets lost in between */
+  if (iInotify >= 0)
+    ReadEvents(iInotify, &CurList);
+  bInotify = AddWatches(&NewList);
+  if (iInotify >= 0)
+    RemoveWatches(&CurList, &NewList);
+
+  if (bInotify)
+  {
+    /* the font files are covered by their directories, and anything that
+     * changed between the scan and adding the watches shows here */
+    for (i = 0, j = 0; i < NewList.iNumEntries; i++)
+    {
+      pEntry = NewList.pEntries + i;
+      if (pEntry->iKind == FC_WATCH_FONT)
+      {
+        free(pEntry->pchPath);
+        continue;
+      }
+      if ((pEntry->iWatch >= 0) &&
+          ((stat(pEntry->pchPath, &statBuf) == -1) ||
+           (statBuf.st_mtime != pEntry->tMTime)))
+        NoticeChange(pEntry->pchPath);
+      NewList.pEntries[j++] = *pEntry;
+    }
+    NewList.iNumEntries = j;
+  }
+#endif
+#ifdef OS2
+  ulProfileSize = 0;
+  PrfQueryProfileSize(HINI_USER, (PSZ)"PM_Fonts", NULL, &ulProfileSize);
+#endif
+
+  FreeList(&CurList);
+  CurList = NewList;
+  memset(&NewList, 0, sizeof(NewList));
+  FreeNameSet(&ScanChanged);
+  iListGeneration = iBeginGeneration;
+  bWatching = FcTrue;
+  tLastPoll = time(NULL);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Watching %d paths\n", CurList.iNumEntries);
+#endif
+  FcLockRelease(&hWatchLock);
+}
+
+/* Is the font list of the last scan still up to date? */
+FcBool FcWatchUptoDate(void)
+{
+  /* if another thread is looking already, its answer will do */
+  if (FcLockTry(&hWatchLock))
+  {
+    CheckForChanges(FcFalse);
+    FcLockRelease(&hWatchLock);
+  }
+  return iGeneration == iListGeneration;
+}
+
+/*
+ * Was a file reported changed before the running scan started? NULL asks
+ * whether any file was. Only the scanning thread calls this.
+ */
+FcBool FcWatchFileChanged(const char *pchFileName)
+{
+  if (ScanChanged.bAll)
+    return FcTrue;
+  if (!pchFileName)
+    return ScanChanged.iNumNames > 0;
+  return NameSetFind(&ScanChanged, pchFileName);
+}
+
+/* Only FcFini() calls this, it is the one place the inotify instance is
+ * closed */
+void FcWatchStop(void)
+{
+  FcLockAcquire(&hWatchLock);
+#ifdef FC_HAVE_INOTIFY
+  if (iInotify >= 0)
+    close(iInotify);
+#endif
+  iInotify = -1;
+  FreeList(&CurList);
+  FreeList(&NewList);
+  FreeNameSet(&Changed);
+  FreeNameSet(&ScanChanged);
+  bWatching = FcFalse;
+  iListGeneration = iGeneration;
+  FcLockRelease(&hWatchLock);
+}
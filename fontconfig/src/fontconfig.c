@@ -14,17 +14,28 @@
 
 #include "fcint.h"
 
+#ifdef OS2
+#include <process.h>
+#endif
+
+void *pConfig;
+
 static FT_Library hFtLib;
+#ifdef OS2
 static HINI       hiniFontCacheStorage;
+#endif
+/* the font description list a scan is building, it is published as a
+ * snapshot (see fccatalog.c) when the scan is done */
 static FontDescriptionCache_p pFontDescriptionCacheHead;
 static FontDescriptionCache_p pFontDescriptionCacheLast;
-static time_t initTime;
-#define FC_TIMER_DEFAULT 30 // reinit after 30s by default, as in original FC
+static int iNumNewFonts;   /* entries not taken over from the previous list */
+/* only one thread at a time may initialize, refresh or uninitialize, the
+ * others only use the published snapshot of the font list */
+static FcLock_t hInitLock;
 
 fcExport void FcFini()
 {
-  FontDescriptionCache_p pToDelete;
-
+  FcLockAcquire(&hInitLock);
   if (hFtLib) {
     /* Uninitialize FreeType */
     FT_Done_FreeType(hFtLib);
@@ -36,23 +47,28 @@ fcExport void FcFini()
     pConfig = NULL;
   }
 
-  /* Destroy Font Description Cache */
-  while (pFontDescriptionCacheHead)
-  {
-    pToDelete = pFontDescriptionCacheHead;
-    pFontDescriptionCacheHead = pFontDescriptionCacheHead->pNext;
-    free(pToDelete);
-  }
+  /* Let go of the font list, it is freed as soon as the patterns
+   * still referring to it are destroyed, too */
+  FcCatalogPublish(NULL);
+  FcMatchMemoClear();
+  FcWatchStop();
+  FcFacePoolFini();
+  FcLockRelease(&hInitLock);
 }
 
+#ifdef OS2
+/* profile application holding the coverage of the cached fonts */
+#define CHARSET_CACHE_APP_NAME "PM_Fonts_FontConfig_CharSet_"FC_CACHE_VERSION_STRING
+
 static void ConstructINIKeyName(char *pchDestinationBuffer, unsigned int uiDestinationBufferSize,
                                 char *pchFontName, long lFaceIndex)
 {
   snprintf(pchDestinationBuffer, uiDestinationBufferSize,
            "%s\\%04ld", pchFontName, lFaceIndex);
 }
+#endif
 
-static const char CP_UCS2BE[] = "UCS-2BE";  /* UCS-2BE */
+static const char CP_UTF16BE[] = "UTF-16BE"; /* UTF-16BE */
 static const char CP_UTF8[]   = "UTF-8";    /* UTF-8   */
 static const char CP_KOR[]    = "IBM-949";  /* KSC5601 */
 static const char CP_JPN[]    = "IBM-943";  /* SJIS    */
@@ -62,6 +78,148 @@ static const char CP_SYSTEM[] = "";         /* System  */
 
 enum {LANG_NONE, LANG_KOR, LANG_JPN, LANG_PRC, LANG_ROC};
 
+/*
+ * Conversion of font names to UTF-8. Most names are UTF-16BE, those are
+ * decoded right here. Only names in a DBCS or the system code page go
+ * through iconv, with one descriptor per code page that is opened when it
+ * is first needed and kept until the scan is done. The scan threads share
+ * the descriptors, one thread at a time. The locale is looked at once per
+ * scan as well.
+ */
+static const char *const apchNameCodePages[] = {CP_KOR, CP_JPN, CP_PRC, CP_ROC, CP_SYSTEM};
+#define NUM_NAME_CODE_PAGES (sizeof(apchNameCodePages) / sizeof(apchNameCodePages[0]))
+
+static iconv_t  ahNameConv[NUM_NAME_CODE_PAGES];
+static FcBool   abNameConvTried[NUM_NAME_CODE_PAGES];
+static FcLock_t hNameConvLock;
+static int      iNameLangCode = LANG_NONE;
+
+/* Look at the locale, before the scan threads are started */
+static void NameConvBegin(void)
+{
+  const char *langEnv = getenv("LANG");
+
+  iNameLangCode = LANG_NONE;
+  if (langEnv)
+  {
+    if (!strnicmp(langEnv, "ko_KR", 5))
+      iNameLangCode = LANG_KOR;
+    else if (!strnicmp(langEnv, "ja_JP", 5))
+      iNameLangCode = LANG_JPN;
+    else if (!strnicmp(langEnv, "zh_CN", 5))
+      iNameLangCode = LANG_PRC;
+    else if (!strnicmp(langEnv, "zh_TW", 5))
+      iNameLangCode = LANG_ROC;
+  }
+}
+
+/* Close the descriptors the scan opened, after the scan threads are done */
+static void NameConvEnd(void)
+{
+  unsigned i;
+
+  for (i = 0; i < NUM_NAME_CODE_PAGES; i++)
+  {
+    if (abNameConvTried[i] && ahNameConv[i] != (iconv_t) -1)
+      iconv_close(ahNameConv[i]);
+    abNameConvTried[i] = FcFalse;
+  }
+}
+
+/*
+ * Decode a UTF-16BE name into a zero terminated UTF-8 buffer of cbOut bytes.
+ * Like iconv, stop at the first character that is invalid or doesn't fit
+ * in anymore.
+ */
+static void ConvertUTF16BE(const unsigned char *pbIn, int cbIn, char *pchOut, int cbOut)
+{
+  unsigned char *pbOut = (unsigned char *) pchOut;
+  unsigned char *pbEnd = pbOut + cbOut - 1;
+  FcChar32 ulChar, ulLow;
+
+  while (cbIn >= 2)
+  {
+    ulChar = (pbIn[0] << 8) | pbIn[1];
+    pbIn += 2;
+    cbIn -= 2;
+    if (ulChar >= 0xD800 && ulChar < 0xE000)
+    {
+      /* a high surrogate followed by a low one */
+      if (ulChar >= 0xDC00 || cbIn < 2)
+        break;
+      ulLow = (pbIn[0] << 8) | pbIn[1];
+      if (ulLow < 0xDC00 || ulLow >= 0xE000)
+        break;
+      ulChar = 0x10000 + ((ulChar - 0xD800) << 10) + (ulLow - 0xDC00);
+      pbIn += 2;
+      cbIn -= 2;
+    }
+
+    if (!ulChar)
+      break;
+    else if (ulChar < 0x80)
+    {
+      if (pbEnd - pbOut < 1)
+        break;
+      *pbOut++ = (unsigned char) ulChar;
+    }
+    else if (ulChar < 0x800)
+    {
+      if (pbEnd - pbOut < 2)
+        break;
+      *pbOut++ = (unsigned char) (0xC0 | (ulChar >> 6));
+      *pbOut++ = (unsigned char) (0x80 | (ulChar & 0x3F));
+    }
+    else if (ulChar < 0x10000)
+    {
+      if (pbEnd - pbOut < 3)
+        break;
+      *pbOut++ = (unsigned char) (0xE0 | (ulChar >> 12));
+      *pbOut++ = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+      *pbOut++ = (unsigned char) (0x80 | (ulChar & 0x3F));
+    }
+    else
+    {
+      if (pbEnd - pbOut < 4)
+        break;
+      *pbOut++ = (unsigned char) (0xF0 | (ulChar >> 18));
+      *pbOut++ = (unsigned char) (0x80 | ((ulChar >> 12) & 0x3F));
+      *pbOut++ = (unsigned char) (0x80 | ((ulChar >> 6) & 0x3F));
+      *pbOut++ = (unsigned char) (0x80 | (ulChar & 0x3F));
+    }
+  }
+  *pbOut = 0;
+}
+
+/* Convert a name in a DBCS or the system code page with iconv */
+static void ConvertCodePage(const char *fromCode, const char *name, int name_len,
+                            char *pName, int nNameSize)
+{
+  ICONV_CONST char *inbuf = (ICONV_CONST char *) name;
+  char *outbuf = pName;
+  size_t inleft = name_len,
+         outleft = nNameSize - 1;
+  unsigned i;
+
+  for (i = 0; apchNameCodePages[i] != fromCode; i++)
+    ;
+
+  FcLockAcquire(&hNameConvLock);
+  if (!abNameConvTried[i])
+  {
+    ahNameConv[i] = iconv_open(CP_UTF8, fromCode);
+    abNameConvTried[i] = FcTrue;
+  }
+  if (ahNameConv[i] != (iconv_t) -1)
+  {
+    /* start over in the initial shift state */
+    iconv(ahNameConv[i], NULL, NULL, NULL, NULL);
+    iconv(ahNameConv[i], &inbuf, &inleft, &outbuf, &outleft);
+  }
+  FcLockRelease(&hNameConvLock);
+  *outbuf = 0;
+}
+
 
 /*
  * Employ a simple check to make sure a self-identified DBCS string isn't
@@ -86,39 +244,22 @@ static FcBool RealDBCSName( unsigned char *name, int len )
  * encoded font information in the font tables; use the current locale (LANG)
  * to determine the appropriate string.
  */
-static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
-                             int nNameSize)
+static FcBool LookupSfntName(const FT_SfntName *pNames, FT_UInt nNameCount,
+                             FT_UShort name_id, char *pName, int nNameSize)
 {
-  FT_UInt nNameCount;
   FT_UInt i;
   FT_SfntName sfntName;
   char *name = NULL;
   int name_len = 0;
-  const char *langEnv;
-  int langCode = LANG_NONE;
+  int langCode = iNameLangCode;
   const char *fromCode = NULL;
   int found;
   int best;
 
-  nNameCount = FT_Get_Sfnt_Name_Count(ftface);
-
   // shortcut for Postscript fonts
   if (nNameCount == 0)
     return FcFalse;
 
-  langEnv = getenv("LANG");
-  if (langEnv)
-  {
-    if (!strnicmp(langEnv, "ko_KR", 5))
-      langCode = LANG_KOR;
-    else if (!strnicmp(langEnv, "ja_JP", 5))
-      langCode = LANG_JPN;
-    else if (!strnicmp(langEnv, "zh_CN", 5))
-      langCode = LANG_PRC;
-    else if (!strnicmp(langEnv, "zh_TW", 5))
-      langCode = LANG_ROC;
-  }
-
   found = -1;
   best  = -1;
 
@@ -128,7 +269,7 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
 #endif
   for (i = 0; found == -1 && i < nNameCount; i++)
   {
-    FT_Get_Sfnt_Name(ftface, i, &sfntName);
+    sfntName = pNames[i];
 
     if (sfntName.name_id     == name_id &&
         sfntName.platform_id == TT_PLATFORM_MICROSOFT &&
@@ -173,12 +314,12 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
 
   if (found != -1)
   {
-    FT_Get_Sfnt_Name(ftface, found, &sfntName);
+    sfntName = pNames[found];
 
     name     = (char*)sfntName.string;
     name_len = sfntName.string_len;
 
-    fromCode = CP_UCS2BE;
+    fromCode = CP_UTF16BE;
   }
   else
   {
@@ -191,7 +332,7 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
 #endif
     for (i = 0; found == -1 && i < nNameCount; i++)
     {
-      FT_Get_Sfnt_Name(ftface, i, &sfntName);
+      sfntName = pNames[i];
 
       if (sfntName.name_id     == name_id &&
           sfntName.platform_id == TT_PLATFORM_MICROSOFT)
@@ -241,34 +382,34 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
     {
       int j;
 
-      FT_Get_Sfnt_Name(ftface, found, &sfntName);
+      sfntName = pNames[found];
 
       switch (sfntName.encoding_id)
       {
         case TT_MS_ID_WANSUNG:
           if (!RealDBCSName(sfntName.string, sfntName.string_len))
-             fromCode = CP_UCS2BE;
+             fromCode = CP_UTF16BE;
           else
              fromCode = CP_KOR;
           break;
 
         case TT_MS_ID_SJIS:
           if (!RealDBCSName(sfntName.string, sfntName.string_len))
-             fromCode = CP_UCS2BE;
+             fromCode = CP_UTF16BE;
           else
              fromCode = CP_JPN;
           break;
 
         case TT_MS_ID_GB2312:
           if (!RealDBCSName(sfntName.string, sfntName.string_len))
-             fromCode = CP_UCS2BE;
+             fromCode = CP_UTF16BE;
           else
              fromCode = CP_PRC;
           break;
 
         case TT_MS_ID_BIG_5:
           if (!RealDBCSName(sfntName.string, sfntName.string_len))
-             fromCode = CP_UCS2BE;
+             fromCode = CP_UTF16BE;
           else
              fromCode = CP_ROC;
           break;
@@ -279,7 +420,7 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
           break;
       }
 
-      if (fromCode == CP_UCS2BE) {
+      if (fromCode == CP_UTF16BE) {
           name     = (char*)sfntName.string;
           name_len = sfntName.string_len;
       } else {
@@ -295,17 +436,10 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
 
   if (fromCode)
   {
-    iconv_t cd = iconv_open(CP_UTF8, fromCode);
-    const char *inbuf = name;
-    char *outbuf = pName;
-    size_t inleft = name_len,
-           outleft = nNameSize - 1;
-
-    iconv(cd, &inbuf, &inleft, &outbuf, &outleft);
-    *outbuf = 0;
-
-    iconv_close(cd);
-
+    if (fromCode == CP_UTF16BE)
+      ConvertUTF16BE((const unsigned char *) name, name_len, pName, nNameSize);
+    else
+      ConvertCodePage(fromCode, name, name_len, pName, nNameSize);
     return FcTrue;
   }
 
@@ -315,53 +449,193 @@ static FcBool LookupSfntName(FT_Face ftface, FT_UShort name_id, char *pName,
   return FcFalse;
 }
 
-static int CreateCache(FontDescriptionCache_p pFontCache, char *pchFontName,
-                       char *pchFontFileName, long lFaceIndex)
+/*
+ * Style keywords, checked in this order against the upper cased style name
+ * with blanks and dashes removed, so compound names come before their parts
+ */
+typedef struct StyleKeyword_s
 {
-  FT_Face ftface;
-  char achKeyName[128];
-  ULONG ulSize;
+  const char *pchKeyword;
+  int iValue;
+} StyleKeyword_t;
 
-#ifdef LOOKUP_SFNT_NAME_DEBUG
-  printf("FontFileName = [%s], lFaceIndex = %ld\n", pchFontFileName, lFaceIndex);
-#endif
+static const StyleKeyword_t aWeightKeywords[] =
+{
+  { "EXTRALIGHT",     FC_WEIGHT_EXTRALIGHT },
+  { "ULTRALIGHT",     FC_WEIGHT_EXTRALIGHT },
+  { "SEMILIGHT",      FC_WEIGHT_LIGHT },
+  { "DEMILIGHT",      FC_WEIGHT_LIGHT },
+  { "HAIRLINE",       FC_WEIGHT_THIN },
+  { "THIN",           FC_WEIGHT_THIN },
+  { "LIGHT",          FC_WEIGHT_LIGHT },
+  { "DEMIBOLD",       FC_WEIGHT_DEMIBOLD },
+  { "SEMIBOLD",       FC_WEIGHT_DEMIBOLD },
+  { "EXTRABOLD",      FC_WEIGHT_EXTRABOLD },
+  { "ULTRABOLD",      FC_WEIGHT_EXTRABOLD },
+  { "EXTRABLACK",     FC_WEIGHT_EXTRABLACK },
+  { "ULTRABLACK",     FC_WEIGHT_EXTRABLACK },
+  { "HEAVY",          FC_WEIGHT_BLACK },
+  { "BLACK",          FC_WEIGHT_BLACK },
+  { "BOLD",           FC_WEIGHT_BOLD },
+  { "MEDIUM",         FC_WEIGHT_MEDIUM },
+  { "BOOK",           FC_WEIGHT_BOOK },
+  { NULL,             FC_WEIGHT_REGULAR }
+};
+
+static const StyleKeyword_t aWidthKeywords[] =
+{
+  { "ULTRACONDENSED", FC_WIDTH_ULTRACONDENSED },
+  { "EXTRACONDENSED", FC_WIDTH_EXTRACONDENSED },
+  { "SEMICONDENSED",  FC_WIDTH_SEMICONDENSED },
+  { "CONDENSED",      FC_WIDTH_CONDENSED },
+  { "NARROW",         FC_WIDTH_CONDENSED },
+  { "ULTRAEXPANDED",  FC_WIDTH_ULTRAEXPANDED },
+  { "EXTRAEXPANDED",  FC_WIDTH_EXTRAEXPANDED },
+  { "SEMIEXPANDED",   FC_WIDTH_SEMIEXPANDED },
+  { "EXPANDED",       FC_WIDTH_EXPANDED },
+  { "WIDE",           FC_WIDTH_EXPANDED },
+  { NULL,             FC_WIDTH_NORMAL }
+};
+
+static int StyleKeywordValue(const char *pchStyle, const StyleKeyword_t *pKeywords)
+{
+  while (pKeywords->pchKeyword && !strstr(pchStyle, pKeywords->pchKeyword))
+    pKeywords++;
+  return pKeywords->iValue;
+}
+
+/* map the usWeightClass of the OS/2 table to the fontconfig weights */
+static int WeightFromOS2Table(int iWeightClass)
+{
+  /* some old fonts use 1..9 instead of 100..900 */
+  if (iWeightClass < 10)
+    iWeightClass *= 100;
+
+  if (iWeightClass <= 100)
+    return FC_WEIGHT_THIN;
+  if (iWeightClass <= 200)
+    return FC_WEIGHT_EXTRALIGHT;
+  if (iWeightClass <= 300)
+    return FC_WEIGHT_LIGHT;
+  if (iWeightClass <= 350)
+    return FC_WEIGHT_BOOK;
+  if (iWeightClass <= 400)
+    return FC_WEIGHT_REGULAR;
+  if (iWeightClass <= 500)
+    return FC_WEIGHT_MEDIUM;
+  if (iWeightClass <= 600)
+    return FC_WEIGHT_DEMIBOLD;
+  if (iWeightClass <= 700)
+    return FC_WEIGHT_BOLD;
+  if (iWeightClass <= 800)
+    return FC_WEIGHT_EXTRABOLD;
+  if (iWeightClass <= 900)
+    return FC_WEIGHT_BLACK;
+  return FC_WEIGHT_EXTRABLACK;
+}
+
+/*
+ * Work out weight, slant and width of a face once at scan time. The OS/2
+ * table is the authority where it exists, the style name (and for fonts
+ * without one, like Type 1 fonts, the FreeType style flags) is used
+ * otherwise. A face is regarded as slanted if either source says so, as
+ * older fonts often forget to set the italic bit.
+ */
+static void FcFontDescriptionParseStyle(FontDescriptionCache_p pFontCache,
+                                        const FcFaceInfo_t *pInfo)
+{
+  static const int aiWidthClasses[] =
+  {
+    FC_WIDTH_ULTRACONDENSED, FC_WIDTH_EXTRACONDENSED, FC_WIDTH_CONDENSED,
+    FC_WIDTH_SEMICONDENSED, FC_WIDTH_NORMAL, FC_WIDTH_SEMIEXPANDED,
+    FC_WIDTH_EXPANDED, FC_WIDTH_EXTRAEXPANDED, FC_WIDTH_ULTRAEXPANDED
+  };
+  char achStyle[sizeof(pFontCache->achStyleName)];
+  const char *pchSrc;
+  char *pchDst;
+  const TT_OS2 *pOS2 = pInfo->pOS2;
+
+  /* upper case the style name and drop blanks and dashes */
+  for (pchSrc = pFontCache->achStyleName, pchDst = achStyle;
+       *pchSrc && pchDst < achStyle + sizeof(achStyle) - 1; pchSrc++)
+  {
+    if (*pchSrc != ' ' && *pchSrc != '-')
+      *pchDst++ = toupper((unsigned char) *pchSrc);
+  }
+  *pchDst = 0;
+
+  pFontCache->iWeight = StyleKeywordValue(achStyle, aWeightKeywords);
+  pFontCache->iWidth = StyleKeywordValue(achStyle, aWidthKeywords);
+  if (strstr(achStyle, "OBLIQUE") || strstr(achStyle, "SLANTED"))
+    pFontCache->iSlant = FC_SLANT_OBLIQUE;
+  else if (strstr(achStyle, "ITALIC") || strstr(achStyle, "KURSIV"))
+    pFontCache->iSlant = FC_SLANT_ITALIC;
+  else
+    pFontCache->iSlant = FC_SLANT_ROMAN;
 
-  if (FT_New_Face(hFtLib, pchFontFileName, lFaceIndex, &ftface))
+  if (pOS2 && pOS2->version != 0xFFFF)
   {
-    /* Could not load font. */
-    return 0;
+    if (pOS2->usWeightClass > 0 && pOS2->usWeightClass <= 1000)
+      pFontCache->iWeight = WeightFromOS2Table(pOS2->usWeightClass);
+    if (pOS2->usWidthClass >= 1 && pOS2->usWidthClass <= 9)
+      pFontCache->iWidth = aiWidthClasses[pOS2->usWidthClass - 1];
+    /* bit 9 is OBLIQUE (OS/2 table version 4), bit 0 is ITALIC */
+    if ((pOS2->version >= 4) && (pOS2->fsSelection & (1 << 9)))
+      pFontCache->iSlant = FC_SLANT_OBLIQUE;
+    else if ((pOS2->fsSelection & 1) && (pFontCache->iSlant == FC_SLANT_ROMAN))
+      pFontCache->iSlant = FC_SLANT_ITALIC;
+  }
+  else
+  {
+    if ((pInfo->lStyleFlags & FT_STYLE_FLAG_BOLD) &&
+        (pFontCache->iWeight < FC_WEIGHT_BOLD))
+      pFontCache->iWeight = FC_WEIGHT_BOLD;
+    if ((pInfo->lStyleFlags & FT_STYLE_FLAG_ITALIC) &&
+        (pFontCache->iSlant == FC_SLANT_ROMAN))
+      pFontCache->iSlant = FC_SLANT_ITALIC;
   }
+}
+
+/*
+ * Fill the names, style attributes, coverage and the face index of a font
+ * description. The file status is left to the caller, as the backends get
+ * it in different ways.
+ */
+static int FillDescription(FontDescriptionCache_p pFontCache, const FcFaceInfo_t *pInfo,
+                           const char *pchFontFileName, long lFaceIndex)
+{
+#ifdef LOOKUP_SFNT_NAME_DEBUG
+  printf("FontFileName = [%s], lFaceIndex = %ld\n", pchFontFileName, lFaceIndex);
+#endif
 
   strncpy(pFontCache->achFileName,
           pchFontFileName,
-          sizeof(pFontCache->achFileName));
-  if (stat(pchFontFileName, &(pFontCache->FileStatus))==-1)
-  {
-    /* Could not get status info, skip this font! */
-    return 0;
-  }
+          sizeof(pFontCache->achFileName)-1);
+  pFontCache->achFileName[sizeof(pFontCache->achFileName)-1] = 0;
 
-  if (!LookupSfntName(ftface, TT_NAME_ID_FONT_FAMILY, pFontCache->achFamilyName,
-                      sizeof(pFontCache->achFamilyName)))
+  if (!LookupSfntName(pInfo->pNames, pInfo->nNames, TT_NAME_ID_FONT_FAMILY,
+                      pFontCache->achFamilyName, sizeof(pFontCache->achFamilyName)))
   {
-    if (!ftface->family_name)
+    if (!pInfo->pchFamilyName)
     {
       /* Could not get the family name */
       return 0;
     }
 
-    strncpy(pFontCache->achFamilyName, ftface->family_name,
-            sizeof(pFontCache->achFamilyName));
+    strncpy(pFontCache->achFamilyName, pInfo->pchFamilyName,
+            sizeof(pFontCache->achFamilyName)-1);
+    pFontCache->achFamilyName[sizeof(pFontCache->achFamilyName)-1] = 0;
   }
 
 #ifdef LOOKUP_SFNT_NAME_DEBUG
   printf("achFamilyName = [%s]\n", pFontCache->achFamilyName);
 #endif
 
-  if (ftface->style_name)
+  if (pInfo->pchStyleName)
   {
-    strncpy(pFontCache->achStyleName, ftface->style_name,
-            sizeof(pFontCache->achStyleName));
+    strncpy(pFontCache->achStyleName, pInfo->pchStyleName,
+            sizeof(pFontCache->achStyleName)-1);
+    pFontCache->achStyleName[sizeof(pFontCache->achStyleName)-1] = 0;
   }
   else
   {
@@ -369,139 +643,663 @@ static int CreateCache(FontDescriptionCache_p pFontCache, char *pchFontName,
     strcpy(pFontCache->achStyleName, "Regular");
   }
 
+  pFontCache->achFamilyName[sizeof(pFontCache->achFamilyName)-1] = 0;
+
 #ifdef LOOKUP_SFNT_NAME_DEBUG
   printf("achStyleName = [%s]\n", pFontCache->achStyleName);
 #endif
 
-  pFontCache->lFontIndex = lFaceIndex;
-
-  FT_Done_Face(ftface);
+  FcFontDescriptionParseStyle(pFontCache, pInfo);
 
-  // Ok, font cache entry prepared
+  /* Keep the coverage, so that nobody has to open the face for it, and
+   * the languages it is good for */
+  pFontCache->pCharSet = FcCharSetFreeze(pInfo->pCharSet);
+  FcLangMapOfCharSet(pInfo->pCharSet, pFontCache->aulLangs);
 
-  /* Also add this to the cache */
-  /* construct actual INI key from font name and number */
-  ConstructINIKeyName(achKeyName, sizeof(achKeyName),
-                      pchFontFileName, lFaceIndex);
-#ifdef FONTCONFIG_DEBUG_PRINTF
-  fprintf(stderr, "XX: Cache is updated: [%s] : [%s]-%ld\n", achKeyName, pchFontFileName, lFaceIndex);
+#ifdef LOOKUP_SFNT_NAME_DEBUG
+  printf("weight = %d, slant = %d, width = %d\n",
+         pFontCache->iWeight, pFontCache->iSlant, pFontCache->iWidth);
 #endif
-  ulSize = sizeof(FontDescriptionCache_t);
-  /* Store font cache in INI file */
-  PrfWriteProfileData(hiniFontCacheStorage, (PSZ)"PM_Fonts_FontConfig_Cache_"FC_CACHE_VERSION_STRING,
-                      (PSZ)achKeyName, pFontCache, ulSize);
+
+  pFontCache->lFontIndex = lFaceIndex;
 
   return 1;
 }
 
-static void CacheFontDescription(char *pchFontName, char *pchFontFileName)
+/* Fill a font description from an opened face */
+int FcFontDescriptionFill(FontDescriptionCache_p pFontCache, FT_Face ftface,
+                          const char *pchFontFileName, long lFaceIndex)
 {
+  FcFaceInfo_t Info;
+  FT_SfntName *pNames = NULL;
+  FT_UInt i;
   int rc;
-  FontDescriptionCache_t FontDesc;
-  FontDescriptionCache_p pNewFontCacheEntry;
-  ULONG ulSize;
-  FT_Face ftface;
-  FT_Open_Args ftopenargs;
-  long lNumFacesInFile;
-  long lCurFace;
-  int iLen = strlen(pchFontFileName);
-  char achKeyName[128];
 
-  /* Modify filename if needed */
-  if (stricmp(pchFontFileName + (iLen-4), ".OFM") == 0)
+  memset(&Info, 0, sizeof(Info));
+  Info.nNames = FT_Get_Sfnt_Name_Count(ftface);
+  if (Info.nNames)
   {
-    pchFontFileName[iLen-3] = 'P';
-    pchFontFileName[iLen-1] = 'B';
+    pNames = (FT_SfntName *) malloc(Info.nNames * sizeof(FT_SfntName));
+    if (!pNames)
+      return 0;
+    for (i = 0; i < Info.nNames; i++)
+      FT_Get_Sfnt_Name(ftface, i, pNames + i);
   }
+  Info.pNames = pNames;
+  Info.pchFamilyName = ftface->family_name;
+  Info.pchStyleName = ftface->style_name;
+  Info.pOS2 = (const TT_OS2 *) FT_Get_Sfnt_Table(ftface, FT_SFNT_OS2);
+  Info.lStyleFlags = ftface->style_flags;
+  Info.pCharSet = FcFreeTypeCharSet(ftface, NULL);
+
+  rc = FillDescription(pFontCache, &Info, pchFontFileName, lFaceIndex);
+
+  FcCharSetDestroy(Info.pCharSet);
+  if (pNames)
+    free(pNames);
+  return rc;
+}
+
+/*
+ * Open a font file for FcFontDescriptionRead(). SFNT files are opened with
+ * the SFNT reader (*ppSfnt, to be closed with FcSfntClose()), everything
+ * else is left to FreeType (*ppSfnt is NULL then). Returns the number of
+ * faces in the file, 0 if it can't be read.
+ */
+long FcFontFileOpen(FT_Library hLib, const char *pchFileName, FcSfntFile **ppSfnt)
+{
+  FT_Open_Args ftopenargs;
+  FT_Face ftface;
+  long lNumFaces;
+
+  *ppSfnt = FcSfntOpen(pchFileName, &lNumFaces);
+  if (*ppSfnt)
+    return lNumFaces;
 
-  /* Query the number of font faces contained in this font file */
   /* Documentation for FT_Open_Face() says that this is the way to */
   /* quickly query the number of supported font faces of a file. */
   ftopenargs.flags = FT_OPEN_PATHNAME;
-  ftopenargs.pathname = pchFontFileName;
+  ftopenargs.pathname = (char *) pchFileName;
   ftopenargs.num_params = 0;
   ftopenargs.params = NULL;
-  if (FT_Open_Face(hFtLib, &ftopenargs, -1, &ftface))
+  if (FT_Open_Face(hLib, &ftopenargs, -1, &ftface))
+    return 0;
+  lNumFaces = ftface->num_faces;
+  FT_Done_Face(ftface);
+  return lNumFaces;
+}
+
+/*
+ * Fill the description of a face of a font file opened with
+ * FcFontFileOpen(). FreeType only opens the face if it is not an SFNT
+ * face, or one the SFNT reader can't make sense of.
+ */
+int FcFontDescriptionRead(FT_Library hLib, FcSfntFile *pSfnt, FontDescriptionCache_p pFontCache,
+                          const char *pchFontFileName, long lFaceIndex)
+{
+  FcFaceInfo_t Info;
+  FT_Face ftface;
+  int rc;
+
+  if (pSfnt && FcSfntReadFace(pSfnt, lFaceIndex, &Info))
   {
-    /* Could not load font. */
-#ifdef FONTCONFIG_DEBUG_PRINTF
-    fprintf(stderr, "XX: Could not create cache for Font [%s] : [%s] as it could not be opened\n", pchFontName, pchFontFileName);
-#endif
+    rc = FillDescription(pFontCache, &Info, pchFontFileName, lFaceIndex);
+    FcSfntFaceDone(&Info);
+  }
+  else
+  {
+    if (FT_New_Face(hLib, pchFontFileName, lFaceIndex, &ftface))
+      return 0;
+    FcStatsAdd(FC_STAT_FACES_OPENED, 1);
+    rc = FcFontDescriptionFill(pFontCache, ftface, pchFontFileName, lFaceIndex);
+    FT_Done_Face(ftface);
+  }
+  if (rc)
+    FcStatsAdd(FC_STAT_FACES_SCANNED, 1);
+  return rc;
+}
+
+static void LinkFontDescription(FontDescriptionCache_p pEntry)
+{
+  pEntry->pNext = NULL;
+  if (pFontDescriptionCacheLast)
+  {
+    pFontDescriptionCacheLast->pNext = pEntry;
+    pFontDescriptionCacheLast = pEntry;
+  } else
+  {
+    pFontDescriptionCacheLast = pFontDescriptionCacheHead = pEntry;
+  }
+}
+
+/* Link a copy of a prepared font description to the list of available fonts */
+FcBool FcFontDescriptionLink(const FontDescriptionCache_t *pFontDesc)
+{
+  FontDescriptionCache_p pNewFontCacheEntry;
+
+  pNewFontCacheEntry = (FontDescriptionCache_p) malloc(sizeof(FontDescriptionCache_t));
+  if (!pNewFontCacheEntry)
+    return FcFalse;
+
+  memcpy(pNewFontCacheEntry, pFontDesc, sizeof(FontDescriptionCache_t));
+  LinkFontDescription(pNewFontCacheEntry);
+  iNumNewFonts++;
+  return FcTrue;
+}
+
+/*
+ * Incremental refresh of the font list. FcFontDescriptionReuseBegin()
+ * indexes the font files of the current snapshot, while the backend builds
+ * the new list. For every font file the backend finds, it asks
+ * FcFontDescriptionReuse() first, which copies the old entries of the file
+ * over to the new list if the file has the same size and modification time
+ * as before. Only files that are new or changed are opened again. The old
+ * snapshot itself is left alone, other threads may still be using it.
+ * FcFontDescriptionReuseEnd() tells whether the new list differs from it.
+ */
+static FcFontRecord_p *ppOldFonts;
+static int             iNumOldFonts;
+static int            *piOldFileHash;   /* first face of a file + 1 */
+static FcChar32        ulOldFileHashMask;
+
+static void FcFontDescriptionReuseBegin(const FcCatalog_t *pCatalog)
+{
+  FcFontRecord_p pFont;
+  FcChar32 ulSize, ulHash;
+  int i;
+
+  iNumNewFonts = 0;
+  iNumOldFonts = 0;
+  if (!pCatalog)
+    return;
+  iNumOldFonts = pCatalog->iNumFonts;
+
+  for (ulSize = 16; ulSize < iNumOldFonts * 2; ulSize <<= 1)
+    ;
+  ppOldFonts = (FcFontRecord_p *) malloc((iNumOldFonts + 1) * sizeof(FcFontRecord_p));
+  piOldFileHash = (int *) calloc(ulSize, sizeof(int));
+  if (!ppOldFonts || !piOldFileHash)
+  {
+    /* no reuse then, everything gets scanned again */
+    if (ppOldFonts)
+      free(ppOldFonts);
+    if (piOldFileHash)
+      free(piOldFileHash);
+    ppOldFonts = NULL;
+    piOldFileHash = NULL;
+    iNumOldFonts = 0;
     return;
   }
-  lNumFacesInFile = ftface->num_faces;
-  FT_Done_Face(ftface);
+  ulOldFileHashMask = ulSize - 1;
 
-  /* Now go through all the faces of this font, and check if we have */
-  /* a cache entry for all of them in INI file */
-  for (lCurFace=0; lCurFace<lNumFacesInFile; lCurFace++)
+  /* the faces of a font file follow each other, only hash the first one;
+   * they share the pooled file name, so comparing pointers is enough */
+  for (i = 0; i < iNumOldFonts; i++)
   {
-    /* Construct key name for font file + face index pair */
-    ConstructINIKeyName(achKeyName, sizeof(achKeyName),
-                        pchFontFileName, lCurFace);
+    pFont = pCatalog->pFonts + i;
+    ppOldFonts[i] = pFont;
+    if (i && ppOldFonts[i-1]->pchFileName == pFont->pchFileName)
+      continue;
+    ulHash = FcStringHash((const FcChar8 *)pFont->pchFileName) & ulOldFileHashMask;
+    while (piOldFileHash[ulHash])
+      ulHash = (ulHash + 1) & ulOldFileHashMask;
+    piOldFileHash[ulHash] = i + 1;
+  }
+}
 
-    /* Try to read back the font cache for this pair from the INI file */
-    memset(&FontDesc, 0, sizeof(FontDesc));
-    ulSize = sizeof(FontDesc);
-    rc = PrfQueryProfileData(hiniFontCacheStorage, (PSZ)"PM_Fonts_FontConfig_Cache_"FC_CACHE_VERSION_STRING,
-                             (PSZ)achKeyName,
-                             &FontDesc,  &ulSize);
-    if ((ulSize!=sizeof(FontDesc)) || (!rc))
+/*
+ * Return the index of the first old entry of an unchanged font file, or -1
+ * if the file is new, changed or was already taken over.
+ */
+int FcFontDescriptionFindOld(const char *pchFileName, const struct stat *pStat)
+{
+  FcChar32 ulHash;
+  int i;
+
+  if (!piOldFileHash)
+    return -1;
+
+  ulHash = FcStringHash((const FcChar8 *)pchFileName) & ulOldFileHashMask;
+  while ((i = piOldFileHash[ulHash]))
+  {
+    if (ppOldFonts[i-1] && !strcmp(ppOldFonts[i-1]->pchFileName, pchFileName))
+      break;
+    ulHash = (ulHash + 1) & ulOldFileHashMask;
+  }
+  if (!i)
+    return -1;
+
+  if ((ppOldFonts[i-1]->cbSize != pStat->st_size) ||
+      (ppOldFonts[i-1]->tMTime != pStat->st_mtime))
+    return -1;
+
+  return i - 1;
+}
+
+/* copy a pooled name back into a description, CCHMAXPATH at most */
+#define CopyName(achName, pchName) \
+  (strncpy((achName), (pchName), sizeof(achName) - 1), (achName)[sizeof(achName) - 1] = 0)
+
+/*
+ * Copy the old entries of an unchanged font file to the new list. Returns
+ * the number of entries copied, or -1 if the file has to be scanned.
+ */
+int FcFontDescriptionReuse(const char *pchFileName, const struct stat *pStat)
+{
+  FontDescriptionCache_p pCopies = NULL, pLastCopy = NULL, pCopy;
+  int i, iFirst;
+
+  iFirst = FcFontDescriptionFindOld(pchFileName, pStat);
+  if (iFirst < 0)
+    return -1;
+
+  /* copy all faces of the file first, so that it is all or nothing */
+  for (i = iFirst; (i < iNumOldFonts) && ppOldFonts[i] &&
+                   ppOldFonts[i]->pchFileName == ppOldFonts[iFirst]->pchFileName; i++)
+  {
+    pCopy = (FontDescriptionCache_p) calloc(1, sizeof(FontDescriptionCache_t));
+    if (pCopy)
     {
-      /* Hm, there is no cache for this file, try to create it! */
-      if (!CreateCache(&FontDesc, pchFontName, pchFontFileName, lCurFace))
+      CopyName(pCopy->achFileName, ppOldFonts[i]->pchFileName);
+      CopyName(pCopy->achFamilyName, ppOldFonts[i]->pchFamilyName);
+      CopyName(pCopy->achStyleName, ppOldFonts[i]->pchStyleName);
+      pCopy->FileStatus.st_size = ppOldFonts[i]->cbSize;
+      pCopy->FileStatus.st_mtime = ppOldFonts[i]->tMTime;
+      pCopy->lFontIndex = ppOldFonts[i]->lFontIndex;
+      pCopy->iWeight = ppOldFonts[i]->iWeight;
+      pCopy->iSlant = ppOldFonts[i]->iSlant;
+      pCopy->iWidth = ppOldFonts[i]->iWidth;
+      memcpy(pCopy->aulLangs, ppOldFonts[i]->aulLangs, sizeof(pCopy->aulLangs));
+      if (ppOldFonts[i]->pCharSet &&
+          !(pCopy->pCharSet = FcCharSetFreeze(ppOldFonts[i]->pCharSet)))
       {
-#ifdef FONTCONFIG_DEBUG_PRINTF
-        fprintf(stderr, "XX: Could not create cache for Font [%s] : [%s]-%ld\n", pchFontName, pchFontFileName, lCurFace);
-#endif
-        continue;
+        free(pCopy);
+        pCopy = NULL;
       }
-    } else
+    }
+    if (!pCopy)
     {
-      struct stat statBuf;
-
-      /* There is cache for this file, check if it's up to date! */
-      if (stat(pchFontFileName, &statBuf)==-1)
-      {
-        /* Could not get status info, skip this font! */
-        continue;
-      }
-      if ((statBuf.st_size != FontDesc.FileStatus.st_size) ||
-          (statBuf.st_mtime != FontDesc.FileStatus.st_mtime))
+      while (pCopies)
       {
-        /* The cache is not up to date, so recreate it! */
-#ifdef FONTCONFIG_DEBUG_PRINTF
-        fprintf(stderr, "XX: Cache is not up to date, recreating it for Font [%s] : [%s]-%ld\n", pchFontName, pchFontFileName, lCurFace);
-#endif
-        if (!CreateCache(&FontDesc, pchFontName, pchFontFileName, lCurFace))
-          continue;
+        pCopy = pCopies;
+        pCopies = pCopies->pNext;
+        FcFontDescriptionFree(pCopy);
       }
+      return -1;
     }
 
-    /* Link this font to the list of available fonts */
-    pNewFontCacheEntry = (FontDescriptionCache_p) malloc(sizeof(FontDescriptionCache_t));
-    if (!pNewFontCacheEntry)
-      return;
+    if (pLastCopy)
+      pLastCopy->pNext = pCopy;
+    else
+      pCopies = pCopy;
+    pLastCopy = pCopy;
+  }
 
-    memcpy(pNewFontCacheEntry, &FontDesc, sizeof(FontDesc));
-    pNewFontCacheEntry->pNext = NULL;
-    if (pFontDescriptionCacheLast)
-    {
-      pFontDescriptionCacheLast->pNext = pNewFontCacheEntry;
-      pFontDescriptionCacheLast = pNewFontCacheEntry;
-    } else
+  for (i = iFirst; pCopies; i++)
+  {
+    ppOldFonts[i] = NULL;   /* taken over */
+    pCopy = pCopies;
+    pCopies = pCopies->pNext;
+    LinkFontDescription(pCopy);
+  }
+  FcStatsAdd(FC_STAT_FACES_REUSED, i - iFirst);
+  return i - iFirst;
+}
+
+/* Returns FcTrue if the new list differs from the one of the old snapshot */
+static FcBool FcFontDescriptionReuseEnd(void)
+{
+  FcBool bChanged = (iNumNewFonts != 0);
+  int i;
+
+  for (i = 0; i < iNumOldFonts; i++)
+  {
+    if (ppOldFonts[i])
     {
-      pFontDescriptionCacheLast = pFontDescriptionCacheHead = pNewFontCacheEntry;
+#ifdef FONTCONFIG_DEBUG_PRINTF
+      fprintf(stderr, "XX: Font [%s]-%ld is gone\n", ppOldFonts[i]->pchFileName, ppOldFonts[i]->lFontIndex);
+#endif
+      bChanged = FcTrue;
     }
   }
+  if (ppOldFonts)
+    free(ppOldFonts);
+  if (piOldFileHash)
+    free(piOldFileHash);
+  ppOldFonts = NULL;
+  piOldFileHash = NULL;
+  iNumOldFonts = 0;
+
+  return bChanged;
 }
 
-static void OpenCacheStorageIniFile()
+FontDescriptionCache_p FcFontDescriptionFirst(void)
 {
-  char achCacheStorageFilename[CCHMAXPATH];
-  char *pchEnvVar;
+  return pFontDescriptionCacheHead;
+}
 
-  // Get home directory of current user
+/* Free a font description together with the data it owns */
+void FcFontDescriptionFree(FontDescriptionCache_p pFontDesc)
+{
+  if (pFontDesc->pCharSet)
+    free(pFontDesc->pCharSet);
+  free(pFontDesc);
+}
+
+#ifdef OS2
+/*
+ * The PM_Fonts entries are scanned like the font directories elsewhere (see
+ * fcdir.c): the entries are collected first, then the files are read on a
+ * pool of threads, each with a FreeType library of its own, and finally the
+ * faces are linked in the order of the entries. fccache.ini is only written
+ * while linking, on the calling thread, the reads of the scan threads take
+ * turns through hProfileLock.
+ */
+typedef struct FcProfileFace_s
+{
+  FontDescriptionCache_t Desc;
+  FcBool                 bCached;   /* from fccache.ini, else to be stored there */
+} FcProfileFace_t;
+
+typedef struct FcProfileFile_s
+{
+  char            *pchFontName;
+  char            *pchFileName;
+  struct stat      FileStatus;
+  FcBool           bReuse;          /* taken over from the list being refreshed */
+  FcProfileFace_t *pFaces;
+  int              iNumFaces;
+} FcProfileFile_t;
+
+typedef struct FcProfileScan_s
+{
+  FcProfileFile_t *pFiles;
+  int              iNumFiles;
+  int              iFilesSize;
+  volatile int     iNextFile;       /* next file for the scan threads */
+} FcProfileScan_t;
+
+static FcLock_t hProfileLock;
+
+/* Store a description read from the font file in the cache */
+static void StoreCache(const FontDescriptionCache_t *pFontCache, char *pchFontFileName)
+{
+  char achKeyName[128];
+  ULONG ulSize;
+  void *pCharSetData;
+
+  /* construct actual INI key from font name and number */
+  ConstructINIKeyName(achKeyName, sizeof(achKeyName),
+                      pchFontFileName, pFontCache->lFontIndex);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Cache is updated: [%s] : [%s]-%ld\n", achKeyName, pchFontFileName, pFontCache->lFontIndex);
+#endif
+  ulSize = sizeof(FontDescriptionCache_t);
+  /* Store font cache in INI file */
+  PrfWriteProfileData(hiniFontCacheStorage, (PSZ)"PM_Fonts_FontConfig_Cache_"FC_CACHE_VERSION_STRING,
+                      (PSZ)achKeyName, (PVOID)pFontCache, ulSize);
+
+  /* The coverage varies in size, so it is stored under the same key in an
+   * application of its own */
+  if (pFontCache->pCharSet)
+  {
+    ulSize = FcCharSetSerializedSize(pFontCache->pCharSet);
+    pCharSetData = malloc(ulSize);
+    if (pCharSetData)
+    {
+      FcCharSetSerialize(pFontCache->pCharSet, pCharSetData);
+      PrfWriteProfileData(hiniFontCacheStorage, (PSZ)CHARSET_CACHE_APP_NAME,
+                          (PSZ)achKeyName, pCharSetData, ulSize);
+      free(pCharSetData);
+    }
+  }
+}
+
+/* Read back the coverage StoreCache() stored for a font */
+static FcCharSet *QueryCachedCharSet(char *pchKeyName)
+{
+  FcCharSet *pCharSet = NULL;
+  ULONG ulSize = 0;
+  void *pCharSetData;
+
+  if (!PrfQueryProfileSize(hiniFontCacheStorage, (PSZ)CHARSET_CACHE_APP_NAME,
+                           (PSZ)pchKeyName, &ulSize) || !ulSize)
+    return NULL;
+
+  pCharSetData = malloc(ulSize);
+  if (!pCharSetData)
+    return NULL;
+  if (PrfQueryProfileData(hiniFontCacheStorage, (PSZ)CHARSET_CACHE_APP_NAME,
+                          (PSZ)pchKeyName, pCharSetData, &ulSize))
+    pCharSet = FcCharSetDeserialize(pCharSetData, ulSize);
+  free(pCharSetData);
+  return pCharSet;
+}
+
+/* Remember a PM_Fonts entry for the scan threads */
+static void AddProfileFile(FcProfileScan_t *pScan, char *pchFontName, char *pchFontFileName)
+{
+  FcProfileFile_t *pFile;
+  struct stat statFile;
+  int iLen = strlen(pchFontFileName);
+
+  /* Modify filename if needed */
+  if ((iLen >= 4) && (stricmp(pchFontFileName + (iLen-4), ".OFM") == 0))
+  {
+    pchFontFileName[iLen-3] = 'P';
+    pchFontFileName[iLen-1] = 'B';
+  }
+
+  if (stat(pchFontFileName, &statFile) == -1)
+  {
+    /* so that it is noticed when the file shows up */
+    FcWatchAdd(pchFontFileName, (time_t)-1, 0, FC_WATCH_FONT);
+    return;
+  }
+  FcWatchAdd(pchFontFileName, statFile.st_mtime, statFile.st_size, FC_WATCH_FONT);
+
+  if (pScan->iNumFiles >= pScan->iFilesSize)
+  {
+    int iNewSize = pScan->iFilesSize ? pScan->iFilesSize * 2 : 256;
+    FcProfileFile_t *pNewFiles;
+
+    pNewFiles = (FcProfileFile_t *) realloc(pScan->pFiles, iNewSize * sizeof(FcProfileFile_t));
+    if (!pNewFiles)
+      return;
+    pScan->pFiles = pNewFiles;
+    pScan->iFilesSize = iNewSize;
+  }
+
+  pFile = pScan->pFiles + pScan->iNumFiles;
+  memset(pFile, 0, sizeof(*pFile));
+  pFile->pchFontName = strdup(pchFontName);
+  pFile->pchFileName = strdup(pchFontFileName);
+  if (!pFile->pchFontName || !pFile->pchFileName)
+  {
+    free(pFile->pchFontName);
+    free(pFile->pchFileName);
+    return;
+  }
+  pFile->FileStatus = statFile;
+  /* On a refresh, take over the descriptions of unchanged fonts */
+  pFile->bReuse = FcFontDescriptionFindOld(pchFontFileName, &statFile) >= 0;
+  pScan->iNumFiles++;
+}
+
+/*
+ * Fill in the descriptions of all faces of a font file, from fccache.ini if
+ * it has them as the file is now, else from the file. Runs on the scan
+ * threads.
+ */
+static void ScanProfileFile(FT_Library hLib, FcProfileFile_t *pFile)
+{
+  FcProfileFace_t *pFace;
+  FcSfntFile *pSfnt;
+  long lNumFacesInFile;
+  long lCurFace;
+  char achKeyName[128];
+  ULONG ulSize;
+  BOOL rc;
+
+  /* Query the number of font faces contained in this font file */
+  lNumFacesInFile = FcFontFileOpen(hLib, pFile->pchFileName, &pSfnt);
+  if (!lNumFacesInFile)
+  {
+    /* Could not load font. */
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Could not create cache for Font [%s] : [%s] as it could not be opened\n", pFile->pchFontName, pFile->pchFileName);
+#endif
+    return;
+  }
+
+  pFile->pFaces = (FcProfileFace_t *) calloc(lNumFacesInFile, sizeof(FcProfileFace_t));
+  if (!pFile->pFaces)
+  {
+    FcSfntClose(pSfnt);
+    return;
+  }
+
+  /* Now go through all the faces of this font, and check if we have */
+  /* a cache entry for all of them in INI file */
+  for (lCurFace=0; lCurFace<lNumFacesInFile; lCurFace++)
+  {
+    pFace = pFile->pFaces + pFile->iNumFaces;
+
+    /* Construct key name for font file + face index pair */
+    ConstructINIKeyName(achKeyName, sizeof(achKeyName),
+                        pFile->pchFileName, lCurFace);
+
+    /* Try to read back the font cache for this pair from the INI file */
+    ulSize = sizeof(pFace->Desc);
+    FcLockAcquire(&hProfileLock);
+    rc = PrfQueryProfileData(hiniFontCacheStorage, (PSZ)"PM_Fonts_FontConfig_Cache_"FC_CACHE_VERSION_STRING,
+                             (PSZ)achKeyName,
+                             &pFace->Desc,  &ulSize);
+    /* a stored pointer is of no use */
+    pFace->Desc.pCharSet = NULL;
+    /* There is cache for this file, check if it's up to date! */
+    pFace->bCached = rc && (ulSize == sizeof(pFace->Desc)) &&
+                     (pFile->FileStatus.st_size == pFace->Desc.FileStatus.st_size) &&
+                     (pFile->FileStatus.st_mtime == pFace->Desc.FileStatus.st_mtime);
+    if (pFace->bCached)
+      pFace->Desc.pCharSet = QueryCachedCharSet(achKeyName);
+    FcLockRelease(&hProfileLock);
+
+    if (pFace->bCached)
+      FcStatsAdd(FC_STAT_CACHE_HITS, 1);
+    else
+    {
+      /* Hm, there is no cache for this face or it is not up to date, the
+       * description is stored when the face is linked */
+#ifdef FONTCONFIG_DEBUG_PRINTF
+      fprintf(stderr, "XX: No cache or not up to date, recreating it for Font [%s] : [%s]-%ld\n", pFile->pchFontName, pFile->pchFileName, lCurFace);
+#endif
+      FcStatsAdd(FC_STAT_CACHE_MISSES, 1);
+      memset(&pFace->Desc, 0, sizeof(pFace->Desc));
+      pFace->Desc.FileStatus = pFile->FileStatus;
+      if (!FcFontDescriptionRead(hLib, pSfnt, &pFace->Desc, pFile->pchFileName, lCurFace))
+      {
+        /* Could not load the font or get its names, skip this font! */
+#ifdef FONTCONFIG_DEBUG_PRINTF
+        fprintf(stderr, "XX: Could not create cache for Font [%s] : [%s]-%ld\n", pFile->pchFontName, pFile->pchFileName, lCurFace);
+#endif
+        continue;
+      }
+    }
+    pFile->iNumFaces++;
+  }
+  FcSfntClose(pSfnt);
+}
+
+/* Take files off the list until none is left */
+static void ScanProfileFiles(FcProfileScan_t *pScan, FT_Library hLib)
+{
+  int i;
+
+  while ((i = FcAtomicInc(&pScan->iNextFile) - 1) < pScan->iNumFiles)
+    if (!pScan->pFiles[i].bReuse)
+      ScanProfileFile(hLib, pScan->pFiles + i);
+}
+
+/* FreeType libraries must not be shared between threads, so every scan
+ * thread brings its own */
+static void ScanProfileThread(void *pArg)
+{
+  FT_Library hLib;
+
+  if (FT_Init_FreeType(&hLib))
+    return;
+  ScanProfileFiles((FcProfileScan_t *) pArg, hLib);
+  FT_Done_FreeType(hLib);
+}
+
+/* Read all files that are not taken over, then link all of them in order */
+static void ScanAndLinkProfileFiles(FcProfileScan_t *pScan)
+{
+  TID atidThreads[MAX_SCAN_THREADS];
+  FcProfileFile_t *pFile;
+  FcProfileFace_t *pFace;
+  int iNumToScan, iNumThreads, iStarted, iThread;
+  int i, j;
+
+  for (i = 0, iNumToScan = 0; i < pScan->iNumFiles; i++)
+    if (!pScan->pFiles[i].bReuse)
+      iNumToScan++;
+
+  if (iNumToScan)
+  {
+    iNumThreads = FcScanThreadCount(iNumToScan);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+    fprintf(stderr, "XX: Scanning %d font files with %d threads\n", iNumToScan, iNumThreads);
+#endif
+
+    pScan->iNextFile = 0;
+    /* the calling thread is one of the scanners */
+    for (iStarted = 0; iStarted < iNumThreads - 1; iStarted++)
+    {
+      iThread = _beginthread(ScanProfileThread, NULL, 256 * 1024, pScan);
+      if (iThread == -1)
+        break;
+      atidThreads[iStarted] = iThread;
+    }
+    ScanProfileFiles(pScan, hFtLib);
+    for (i = 0; i < iStarted; i++)
+      DosWaitThread(atidThreads + i, DCWW_WAIT);
+  }
+
+  for (i = 0; i < pScan->iNumFiles; i++)
+  {
+    pFile = pScan->pFiles + i;
+    /* if the old faces cannot be copied after all, read them now */
+    if (pFile->bReuse &&
+        (FcFontDescriptionReuse(pFile->pchFileName, &pFile->FileStatus) < 0))
+      ScanProfileFile(hFtLib, pFile);
+    for (j = 0; j < pFile->iNumFaces; j++)
+    {
+      pFace = pFile->pFaces + j;
+      if (!pFace->bCached)
+        StoreCache(&pFace->Desc, pFile->pchFileName);
+      /* Link this font to the list of available fonts */
+      if (!FcFontDescriptionLink(&pFace->Desc) && pFace->Desc.pCharSet)
+        free(pFace->Desc.pCharSet);
+    }
+    if (pFile->pFaces)
+      free(pFile->pFaces);
+    free(pFile->pchFontName);
+    free(pFile->pchFileName);
+  }
+  if (pScan->pFiles)
+    free(pScan->pFiles);
+  pScan->pFiles = NULL;
+  pScan->iNumFiles = 0;
+}
+
+static void OpenCacheStorageIniFile()
+{
+  char achCacheStorageFilename[CCHMAXPATH];
+  char *pchEnvVar;
+
+  // Get home directory of current user
   pchEnvVar = getenv("HOME");
 
   hiniFontCacheStorage = NULLHANDLE;
@@ -582,28 +1380,31 @@ static void CloseCacheStorageIniFile()
     hiniFontCacheStorage = HINI_USER;
   }
 }
+#endif /* OS2 */
 
-// we need to do case insensitive comparison a lot
+// we need to do case insensitive comparison a lot, so do it in place
+// instead of uppercasing copies of both strings
 char *stristr(const char *str1, const char *str2)
 {
-  char *upper1, *upper2, *retval;
-
-  // as strupr does in place modification, copy the strings first
-  upper1 = strdup(str1);
-  upper2 = strdup(str2);
-  strupr(upper1);
-  strupr(upper2);
+  const char *pchStart, *pch1, *pch2;
 
-  // now call the original strstr on the uppercase strings
-  retval = strstr(upper1, upper2);
-
-  // and clean up before returning
-  free(upper1);
-  free(upper2);
-  return retval;
+  for (pchStart = str1; ; pchStart++)
+  {
+    for (pch1 = pchStart, pch2 = str2;
+         *pch2 && (FcToLower((FcChar8)*pch1) == FcToLower((FcChar8)*pch2));
+         pch1++, pch2++)
+      ;
+    if (!*pch2)
+      return (char *)pchStart;
+    if (!*pchStart)
+      return NULL;
+  }
 }
 
-fcExport FcBool FcInit()
+#ifdef OS2
+/* Bring the font description list up to date with the PM_Fonts profile
+ * entries, using (and maintaining) the fccache.ini profile as cache */
+static FcBool ScanProfileFonts(void)
 {
   ULONG ulBootDrive;
   char chBootDrive;
@@ -614,22 +1415,13 @@ fcExport FcBool FcInit()
   char achFontFileName[CCHMAXPATH];
   char achAbsFontFileName[CCHMAXPATH];
   char achKeyName[128];
+  FcProfileScan_t Scan;
 
-  if (FT_Init_FreeType(&hFtLib))
-  {
-    /* Could not initialize FreeType */
-    return FcFalse;
-  }
+  memset(&Scan, 0, sizeof(Scan));
 
   /* As the font cache will be stored in our own INI file, let's open that ini file first */
   OpenCacheStorageIniFile();
 
-  /* Go through all the available/installed fonts and
-   * make sure we have an up-to-date description cache
-   * for all of them */
-  pFontDescriptionCacheHead = NULL;
-  pFontDescriptionCacheLast = NULL;
-
   DosQuerySysInfo(QSV_BOOT_DRIVE, QSV_BOOT_DRIVE, &ulBootDrive, sizeof(ULONG));
   chBootDrive = (char)( ulBootDrive + '@' );
 
@@ -696,8 +1488,8 @@ fcExport FcBool FcInit()
     fprintf(stderr, "XX: Font in PM_Fonts: [%s] [%s]\n", pchCurrentFont, achAbsFontFileName);
 #endif
 
-    // Create a cache entry for this font
-    CacheFontDescription(pchCurrentFont, achAbsFontFileName);
+    // Remember this font, it is read below
+    AddProfileFile(&Scan, pchCurrentFont, achAbsFontFileName);
 
     // Go for next font
     pchCurrentFont += strlen(pchCurrentFont)+1;
@@ -705,6 +1497,9 @@ fcExport FcBool FcInit()
   // Free resources
   free(pchFontNameList);
 
+  // Create the missing cache entries and link all fonts
+  ScanAndLinkProfileFiles(&Scan);
+
   /* Another step for cleanup:
    * Make sure that we have no entry in the font cache ini file, which is not in our current active cache.
    * If there is one, delete that cache entry.
@@ -719,7 +1514,6 @@ fcExport FcBool FcInit()
     fprintf(stderr, "XX: Out of memory at cache cleanup\n");
 #endif
     CloseCacheStorageIniFile();
-    pConfig = (void *)malloc(sizeof(void)); // we now have a config
     return FcTrue;
   }
 
@@ -801,6 +1595,8 @@ fcExport FcBool FcInit()
 #endif
     PrfWriteProfileData(hiniFontCacheStorage, (PSZ)"PM_Fonts_FontConfig_Cache_"FC_CACHE_VERSION_STRING,
                         (PSZ)pchCurrentFont, NULL, 0);
+    PrfWriteProfileData(hiniFontCacheStorage, (PSZ)CHARSET_CACHE_APP_NAME,
+                        (PSZ)pchCurrentFont, NULL, 0);
 
     // Go for next font
     pchCurrentFont += strlen(pchCurrentFont)+1;
@@ -813,30 +1609,177 @@ fcExport FcBool FcInit()
   free(pchFontNameList);
   CloseCacheStorageIniFile();
 
-  // store the time for FcInitReinitialize
-  initTime = time(NULL);
+  return FcTrue;
+}
+#endif /* OS2 */
+
+/* Make a snapshot of the font list from the fonts installed on the system */
+static FcCatalog_t *ScanFonts(void)
+{
+  FontDescriptionCache_p pToDelete;
+  FcCatalog_t *pCatalog = NULL;
+  FcBool rc;
+
+  pFontDescriptionCacheHead = NULL;
+  pFontDescriptionCacheLast = NULL;
+
+  NameConvBegin();
+  FcWatchBegin();
+#ifdef OS2
+  rc = ScanProfileFonts();
+#else
+  rc = FcDirScanFonts(hFtLib);
+#endif
+  FcWatchEnd();
+  NameConvEnd();
+  /* the snapshot copies the list into its own compact records, it also
+   * indexes the families for FcFontMatch(); the list is not needed anymore
+   * after that */
+  if (rc)
+    pCatalog = FcCatalogCreate(pFontDescriptionCacheHead);
+  while (pFontDescriptionCacheHead)
+  {
+    pToDelete = pFontDescriptionCacheHead;
+    pFontDescriptionCacheHead = pFontDescriptionCacheHead->pNext;
+    FcFontDescriptionFree(pToDelete);
+  }
+  pFontDescriptionCacheLast = NULL;
+  return pCatalog;
+}
+
+/* Initialize FreeType and the font list, hInitLock must be held */
+static FcBool InitFonts(void)
+{
+  FcCatalog_t *pCatalog;
+  unsigned long long ullStart = FcStatsNow();
+
+  if (!hFtLib && FT_Init_FreeType(&hFtLib))
+  {
+    /* Could not initialize FreeType */
+    hFtLib = NULL;
+    return FcFalse;
+  }
+
+  /* The family substitution rules, read only once */
+  FcSubstLoad();
+
+  /* Go through all the available/installed fonts and
+   * make sure we have an up-to-date description cache
+   * for all of them */
+  pCatalog = ScanFonts();
+  if (!pCatalog)
+    return FcFalse;
+  FcCatalogPublish(pCatalog);
+  FcMatchMemoClear();
 
   pConfig = (void *)malloc(sizeof(void)); // we now have a config
+  FcStatsInitDone(FcFalse, ullStart);
   return FcTrue;
 }
 
+fcExport FcBool FcInit()
+{
+  FcBool rc = FcTrue;
+
+  FcLockAcquire(&hInitLock);
+  // another thread may have done it already
+  if (!pConfig)
+    rc = InitFonts();
+  FcLockRelease(&hInitLock);
+  return rc;
+}
+
+/*
+ * Bring the font list up to date without starting over: only fonts that
+ * are new or changed are opened, the descriptions of all other fonts are
+ * taken over. The current snapshot stays in use until the new one is
+ * complete, and if nothing changed, it stays current, so patterns and
+ * memoized matches of it stay valid. If the list changed (or
+ * bForceNewConfig is set), there is a new config afterwards, so that users
+ * comparing config pointers notice the change. hInitLock must be held.
+ */
+static FcBool RefreshFonts(FcBool bForceNewConfig)
+{
+  FcCatalog_t *pOld, *pNew;
+  void *newConfig;
+  FcBool bChanged;
+  unsigned long long ullStart;
+
+  if (!hFtLib)
+    return InitFonts();
+  ullStart = FcStatsNow();
 
+  // allocate new config while the old one is still active, so that we
+  // get a new address for the new config
+  newConfig = (void *)malloc(sizeof(void));
+
+  pOld = FcCatalogAcquire();
+  FcFontDescriptionReuseBegin(pOld);
+  pNew = ScanFonts();
+  bChanged = FcFontDescriptionReuseEnd() || !pOld;
+  FcCatalogRelease(pOld);
+#ifdef FONTCONFIG_DEBUG_PRINTF
+  fprintf(stderr, "XX: Font list refreshed, %d fonts scanned, %s\n",
+          iNumNewFonts, bChanged ? "changed" : "unchanged");
+#endif
+
+  if (!pNew)
+  {
+    if (newConfig)
+      free(newConfig);
+    return FcFalse;
+  }
+
+  if (bChanged)
+  {
+    FcCatalogPublish(pNew);
+    /* the memoized matches are from the old snapshot */
+    FcMatchMemoClear();
+  }
+  else
+    FcCatalogRelease(pNew);
+
+  if ((bChanged || bForceNewConfig) && newConfig)
+  {
+    if (pConfig)
+      free(pConfig);
+    pConfig = newConfig;
+  }
+  else if (newConfig)
+    free(newConfig);
+
+  FcStatsInitDone(FcTrue, ullStart);
+  return FcTrue;
+}
+
+// Find the substitution rule for the family of the pattern, matching it
+// then needs no lookup. The pattern itself is left as it is, the rule is
+// only used if no font of its family is installed.
 fcExport FcBool FcConfigSubstitute(FcConfig *config, FcPattern *p, FcMatchKind kind)
 {
-  // STUB
+  if (!pConfig)
+  {
+    if (!FcInit())
+      return FcFalse;
+  }
+
+  if (p && kind == FcMatchPattern)
+    FcSubstApply(p);
   return FcTrue;
 }
 
 
 fcExport void FcDefaultSubstitute(FcPattern *pattern)
 {
-  if (!pattern)
+  if (!FcPatternBeginChange(pattern))
     return;
 
   if (pattern->weight==0)
     pattern->weight = FC_WEIGHT_MEDIUM;
   if (pattern->slant==0)
     pattern->slant = FC_SLANT_ROMAN;
+  if (pattern->width==0)
+    pattern->width = FC_WIDTH_NORMAL;
   if (pattern->spacing==0)
     pattern->spacing = FC_PROPORTIONAL;
   if (pattern->pixelsize==0)
@@ -847,329 +1790,302 @@ fcExport void FcDefaultSubstitute(FcPattern *pattern)
 }
 
 
-fcExport FcPattern *FcFontMatch(FcConfig *config, FcPattern *p, FcResult *result)
+/*
+ * Ranks of the fontconfig weights and widths, so that neighbouring classes
+ * are one step apart no matter how far apart their numerical values are
+ */
+static const int aiWeightRanks[] =
 {
-  FontDescriptionCache_p pFont, pBestMatch;
-  int iBestMatchScore;
-  int bWeightOk;
-  int bSlantOk;
+  FC_WEIGHT_THIN, FC_WEIGHT_EXTRALIGHT, FC_WEIGHT_LIGHT, FC_WEIGHT_BOOK,
+  FC_WEIGHT_REGULAR, FC_WEIGHT_MEDIUM, FC_WEIGHT_DEMIBOLD, FC_WEIGHT_BOLD,
+  FC_WEIGHT_EXTRABOLD, FC_WEIGHT_BLACK, FC_WEIGHT_EXTRABLACK
+};
 
-  if (!p)
-    return NULL;
+static const int aiWidthRanks[] =
+{
+  FC_WIDTH_ULTRACONDENSED, FC_WIDTH_EXTRACONDENSED, FC_WIDTH_CONDENSED,
+  FC_WIDTH_SEMICONDENSED, FC_WIDTH_NORMAL, FC_WIDTH_SEMIEXPANDED,
+  FC_WIDTH_EXPANDED, FC_WIDTH_EXTRAEXPANDED, FC_WIDTH_ULTRAEXPANDED
+};
 
-  pFont = pFontDescriptionCacheHead;
-  pBestMatch = NULL;
-  iBestMatchScore = -1;
+/* return the rank of the class nearest to iValue */
+static int StyleRank(int iValue, const int *piRanks, int iNumRanks)
+{
+  int i;
 
-//#define MATCH_DEBUG
-#ifdef MATCH_DEBUG
-  // print the list of all fonts for debugging
-  printf("\nfull font list\n");
-  while (pFont)
+  for (i = 1; i < iNumRanks; i++)
   {
-    printf("  %s,%s\n", pFont->achFamilyName, pFont->achStyleName);
-    pFont = pFont->pNext;
+    if (iValue < piRanks[i])
+      return (iValue - piRanks[i-1] < piRanks[i] - iValue) ? i-1 : i;
   }
-  // reset to first font
-  pFont = pFontDescriptionCacheHead;
+  return iNumRanks - 1;
+}
 
-  // print input pattern to match
-  printf("input pattern\n  %s,%d,%d,%f\n",
-         p->family, p->weight, p->slant, p->pixelsize);
-#endif
+/* 0 for roman, 1 for italic and 2 for oblique */
+static int SlantClass(int iSlant)
+{
+  if (iSlant > FC_SLANT_ITALIC)
+    return 2;
+  if (iSlant > FC_SLANT_ROMAN)
+    return 1;
+  return 0;
+}
 
-  if (!p->outline)
+/*
+ * Distance between the style asked for in the pattern and a face, 0 being
+ * a perfect match. Weight counts most, then slant, then width. Within a
+ * weight distance bold requests prefer the heavier and normal requests the
+ * lighter face, an oblique face stands in for an italic one (and vice
+ * versa) before an upright one does.
+ */
+static int StyleDistance(const FcPattern *p, const FcFontRecord_t *pFont)
+{
+  int iWanted, iHave, iDistance;
+  int iWeight = p->weight;
+
+  /* up to medium, which FcDefaultSubstitute() puts in, means the normal
+   * face, medium faces are only taken if there is none */
+  if ((iWeight > FC_WEIGHT_REGULAR) && (iWeight <= FC_WEIGHT_MEDIUM))
+    iWeight = FC_WEIGHT_REGULAR;
+
+  iWanted = StyleRank(iWeight, aiWeightRanks, sizeof(aiWeightRanks)/sizeof(int));
+  iHave = StyleRank(pFont->iWeight, aiWeightRanks, sizeof(aiWeightRanks)/sizeof(int));
+  iDistance = FC_ABS(iWanted - iHave) * 16;
+  if ((p->weight > FC_WEIGHT_MEDIUM) ? (iHave < iWanted) : (iHave > iWanted))
+    iDistance += 8;
+
+  iWanted = SlantClass(p->slant);
+  iHave = SlantClass(pFont->iSlant);
+  if (iWanted != iHave)
+    iDistance += (iWanted && iHave) ? 2 : 12;
+
+  // patterns without a width accept any width
+  if (p->width)
   {
-#ifdef MATCH_DEBUG
-    printf("Only outline fonts are supported!!!\n");
-#endif
-    if (result)
-      *result = FcResultNoMatch;
-    return NULL;
+    iWanted = StyleRank(p->width, aiWidthRanks, sizeof(aiWidthRanks)/sizeof(int));
+    iHave = StyleRank(pFont->iWidth, aiWidthRanks, sizeof(aiWidthRanks)/sizeof(int));
+    iDistance += FC_ABS(iWanted - iHave);
   }
 
-  // first try to match the font using an exact match of the family name
-  while (pFont)
-  {
-    if ((p->family) && (stricmp(pFont->achFamilyName, p->family)==0))
-    {
-      // Family found, calculate score for it!
-      if ( p->weight > FC_WEIGHT_MEDIUM )
-      {
-        // Looking for a BOLD font
-        bWeightOk = (stristr(pFont->achStyleName, "BOLD")!=NULL);
-        // - If BOLD not found in the name, try checking other standard
-        //   names for heavier weights  [ALT 20100827]
-        if (!bWeightOk)
-           bWeightOk = (stristr(pFont->achStyleName, "HEAVY")!=NULL);
-        if (!bWeightOk)
-           bWeightOk = (stristr(pFont->achStyleName, "BLACK")!=NULL);
-      } else if ( p->weight < FC_WEIGHT_BOOK )
-      {
-        // Looking for a LIGHT font
-        bWeightOk = (stristr(pFont->achStyleName, "LIGHT")!=NULL);
-        // - If LIGHT not found in the name, try checking other standard
-        // names for lighter weights  [ALT 20100827]
-        if (!bWeightOk)
-           bWeightOk = (stristr(pFont->achStyleName, "THIN")!=NULL);
-        if (!bWeightOk)
-           bWeightOk = (stristr(pFont->achStyleName, "HAIRLINE")!=NULL);
-      } else
-      {
-        //Looking for a non-bold, non-light (normal) font  [ALT 20100827]
-        bWeightOk = ((stristr(pFont->achStyleName, "HAIRLINE")==NULL) &&
-                     (stristr(pFont->achStyleName, "THIN")==NULL)     &&
-                     (stristr(pFont->achStyleName, "LIGHT")==NULL)    &&
-                     (stristr(pFont->achStyleName, "BOLD")==NULL)     &&
-                     (stristr(pFont->achStyleName, "HEAVY")==NULL)    &&
-                     (stristr(pFont->achStyleName, "BLACK")==NULL));
-      }
+  return iDistance;
+}
 
-      if ( p->slant > FC_SLANT_ITALIC )
-      {
-        // Looking for an OBLIQUE font (fall back to ITALIC if necessary)
-        bSlantOk = (stristr(pFont->achStyleName, "OBLIQUE")!=NULL);
-        if (!bSlantOk)
-           bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-      } else if ( p->slant > FC_SLANT_ROMAN )
-      {
-        // Looking for an ITALIC font
-        bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-      } else
-      {
-        // Looking for a non-italic font
-        bSlantOk = (stristr(pFont->achStyleName, "ITALIC")==NULL &&
-                    stristr(pFont->achStyleName, "OBLIQUE")==NULL);
-      }
+/* Create the pattern FcFontMatch() and FcFontSort() return for a font */
+static FcPattern *CreateFontPattern(FcCatalog_t *pCatalog, const FcPattern *p,
+                                    FcFontRecord_p pFont)
+{
+  FcPattern *pResult = FcPatternCreate();
 
-      // Check if this score is better than the previous best one
-      if (iBestMatchScore < bWeightOk*2 + bSlantOk)
-      {
-        pBestMatch = pFont;
-        iBestMatchScore = bWeightOk*2 + bSlantOk;
+  if (pResult)
+  {
+    // in the output pattern set the three properties we use to select
+    pResult->family = strdup(pFont->pchFamilyName);
+
+    pResult->weight = pFont->iWeight;
+    pResult->slant = pFont->iSlant;
+    pResult->width = pFont->iWidth;
+
+    // If we found the font name of generic family the spacing should
+    // be the same as the input, and we don't select on available
+    // sizes, so copy that, too.
+    pResult->spacing = p->spacing;
+    pResult->pixelsize = p->pixelsize;
+
+    pResult->pFontDesc = pFont;
+    pResult->pCatalog = pCatalog;
+    FcCatalogReference(pCatalog);
+  }
+  return pResult;
+}
 
-        // Check if it's a perfect match!
-        if ((bWeightOk) && (bSlantOk))
-        {
-          // Found an exact match!
-          break;
-        }
-      }
+/*
+ * The faces of a family and of the families containing its name, the
+ * candidates of the first and the last matching pass. FcFontMatchBatch()
+ * looks them up once for all patterns of the same family. The families
+ * containing the name are only looked for when they are needed.
+ */
+typedef struct FcFamilyFaces_s
+{
+  const char      *pchFamily;
+  FcFontRecord_p  *ppExact;        /* owned by the family index */
+  int              iNumExact;
+  FcFontRecord_p  *ppSubstring;    /* allocated */
+  int              iNumSubstring;
+  FcBool           bSubstring;     /* ppSubstring was looked for */
+} FcFamilyFaces_t;
+
+static void FamilyFacesInit(FcFamilyFaces_t *pFaces, FcCatalog_t *pCatalog,
+                            const char *pchFamily)
+{
+  memset(pFaces, 0, sizeof(FcFamilyFaces_t));
+  pFaces->pchFamily = pchFamily;
+  pFaces->ppExact = FcFamilyIndexLookup(pCatalog->pFamilyIndex, pchFamily, &pFaces->iNumExact);
+}
+
+static void FamilyFacesDone(FcFamilyFaces_t *pFaces)
+{
+  if (pFaces->ppSubstring)
+    free(pFaces->ppSubstring);
+}
+
+static FcPattern *MatchFont(FcCatalog_t *pCatalog, FcConfig *config, FcPattern *p,
+                            FcFamilyFaces_t *pFamilyFaces, FcResult *result)
+{
+  FcFontRecord_p pFont, pBestMatch;
+  FcFontRecord_p *ppFaces;
+  FcFamilyFaces_t Faces;
+  int iNumFaces;
+  int iBestDistance;
+  int iDistance;
+  int iNumCompared = 0;           // for the statistics
+  int iPass = FC_STAT_MATCH_NONE; // the pass that found the font
+  int i;
+
+  if (!p)
+    return NULL;
+
+  // a single match looks up the faces of the family itself
+  if (!pFamilyFaces)
+  {
+    FamilyFacesInit(&Faces, pCatalog, p->family);
+    pFamilyFaces = &Faces;
+  }
+
+  pBestMatch = NULL;
+  iBestDistance = INT_MAX;
+
+//#define MATCH_DEBUG
+#ifdef MATCH_DEBUG
+  // print the list of all fonts for debugging
+  printf("\nfull font list\n");
+  for (i = 0; i < pCatalog->iNumFonts; i++)
+    printf("  %s,%s\n", pCatalog->pFonts[i].pchFamilyName, pCatalog->pFonts[i].pchStyleName);
+
+  // print input pattern to match
+  printf("input pattern\n  %s,%d,%d,%f\n",
+         p->family, p->weight, p->slant, p->pixelsize);
+#endif
+
+  if (!p->outline)
+  {
+#ifdef MATCH_DEBUG
+    printf("Only outline fonts are supported!!!\n");
+#endif
+    if (pFamilyFaces == &Faces)
+      FamilyFacesDone(&Faces);
+    FcStatsAdd(FC_STAT_MATCH_NONE, 1);
+    if (result)
+      *result = FcResultNoMatch;
+    return NULL;
+  }
+
+  // first try to match the font using an exact match of the family name,
+  // the family index gives us the faces of that family right away
+  ppFaces = pFamilyFaces->ppExact;
+  iNumFaces = pFamilyFaces->iNumExact;
+  for (i = 0; i < iNumFaces; i++)
+  {
+    // Family found, calculate how far its style is from the wanted one
+    iDistance = StyleDistance(p, ppFaces[i]);
+    iNumCompared++;
+
+    // Check if this one is closer than the previous best one
+    if (iDistance < iBestDistance)
+    {
+      pBestMatch = ppFaces[i];
+      iBestDistance = iDistance;
+
+      // Check if it's a perfect match!
+      if (!iDistance)
+        break;
     }
-    pFont = pFont->pNext;
   }
   // Use the one if we've found something
-  if (pBestMatch)
-    pFont = pBestMatch;
+  pFont = pBestMatch;
+  if (pFont)
+    iPass = FC_STAT_MATCH_EXACT;
 
   // Did not find a good one by family name match, search now with
-  // default font families! This includes the OS/2 typical fonts of
-  // Tms Rmn and Helv as well as Swiss
+  // the families of the substitution rule of the pattern! This includes
+  // the generic families and the OS/2 typical fonts of Tms Rmn and Helv
+  // as well as Swiss
   if (!pFont)
   {
-    // 64 seems to be the max font name length on OS/2 already, add some margin
-    char achKey[128] = "";
-    char *achKeySpace = NULL;
+    const FcSubstRule_t *pRule = FcSubstFind(p);
+    int iKey;
 
-    if ( p->spacing == FC_MONO || ((p->family) && (stricmp("MONOSPACE", p->family)==0)))
-    {
-      strncpy(achKey, DEFAULT_MONOSPACED_FONT, sizeof(achKey));
-    }
-    else if (
-        (p->family) &&
-        ((stricmp( p->family, "SWISS" ) == 0 ) ||
-         (stricmp( p->family, "HELV" ) == 0 ) ||
-         (stricmp( p->family, "SANS-SERIF" ) == 0 ) ||
-         (stricmp( p->family, "SANS" ) == 0 )
-        )
-       )
-    {
-      strncpy(achKey, DEFAULT_SANSSERIF_FONT, sizeof(achKey));
-    }
-    else if (
-        (p->family) &&
-        ((stricmp( p->family, "SERIF" ) == 0 ) ||
-         (stricmp( p->family, "TMS RMN" ) == 0 ) ||
-         (stricmp( p->family, DEFAULT_SERIF_FONT ) == 0 )
-        )
-       )
-    {
-      // this of course includes the case of "Tms Rmn"
-      strncpy(achKey, DEFAULT_SERIF_FONT, sizeof(achKey));
-      // we want to match Times New Roman which has an additional trailing
-      // space in the name...
-      achKeySpace = malloc(strlen(achKey) + 2);
-      strcpy(achKeySpace, achKey);
-      strcat(achKeySpace, " ");
-    }
-    else if ((p->family) && (stricmp( p->family, "OPENSYMBOL" ) == 0 ))
-    {
-      strncpy(achKey, DEFAULT_SYMBOL_FONT, sizeof(achKey));
-    }
-    else if (
-        (p->family) &&
-        ((stricmp( p->family, "ZAPFDINGBATS" ) == 0 ) ||
-         (stricmp( p->family, "ZAPF DINGBATS" ) == 0 )))
-    {
-      strncpy(achKey, DEFAULT_DINGBATS_FONT, sizeof(achKey));
-    }
-
-    pFont = pFontDescriptionCacheHead;
     pBestMatch = NULL;
-    iBestMatchScore = -1;
-    // only search font list, if we set a key to search for
-    while (achKey != NULL && achKey[0] && pFont)
+    iBestDistance = INT_MAX;
+    // only search the families, if there is a rule for the pattern
+    for (iKey = 0; pRule && iKey < pRule->iNumFamilies && iBestDistance > 0; iKey++)
     {
-      if (stricmp(pFont->achFamilyName, achKey) == 0 ||
-          (achKeySpace && stricmp(pFont->achFamilyName, achKeySpace) == 0)
-         )
+      ppFaces = FcFamilyIndexLookup(pCatalog->pFamilyIndex, pRule->ppchFamilies[iKey], &iNumFaces);
+      for (i = 0; i < iNumFaces; i++)
       {
-        // Family found, calculate score for it!
-        if ( p->weight > FC_WEIGHT_MEDIUM )
-        {
-          // Looking for a BOLD font
-          bWeightOk = (stristr(pFont->achStyleName, "BOLD")!=NULL);
-        } else
-        {
-          // Looking for a non-bold (normal) font
-          bWeightOk = (stristr(pFont->achStyleName, "BOLD")==NULL);
-        }
-
-        if ( p->slant > FC_SLANT_ITALIC )
-        {
-          // Looking for an OBLIQUE font (fall back to ITALIC if necessary)
-          bSlantOk = (stristr(pFont->achStyleName, "OBLIQUE")!=NULL);
-          if (!bSlantOk)
-             bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-        } else if ( p->slant > FC_SLANT_ROMAN )
-        {
-          // Looking for an ITALIC font
-          bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-        } else
-        {
-          // Looking for a non-italic font
-          bSlantOk = (stristr(pFont->achStyleName, "ITALIC")==NULL &&
-                      stristr(pFont->achStyleName, "OBLIQUE")==NULL);
-        }
-
-        // Check if this score is better than the previous best one
-        if (iBestMatchScore < bWeightOk*2 + bSlantOk)
+        iDistance = StyleDistance(p, ppFaces[i]);
+        iNumCompared++;
+        if (iDistance < iBestDistance)
         {
-          pBestMatch = pFont;
-          iBestMatchScore = bWeightOk*2 + bSlantOk;
-
-          // Check if it's a perfect match!
-          if ((bWeightOk) && (bSlantOk))
-          {
-            // Fount an exact match!
+          pBestMatch = ppFaces[i];
+          iBestDistance = iDistance;
+          if (!iDistance)
             break;
-          }
         }
       }
-      pFont = pFont->pNext;
     }
-    if (achKeySpace)
-      free(achKeySpace);
+    if (pBestMatch)
+      iPass = FC_STAT_MATCH_ALIAS;
   }
   // Use the one if we've found something
   if (pBestMatch)
     pFont = pBestMatch;
 
   // again, if an exact match was not found, now try to find the family
-  // name by substring search
-  if (!pBestMatch)
+  // name by substring search, the trigram index of the families gives us
+  // the faces of all families containing it
+  if (!pBestMatch && p->family)
   {
-    pFont = pFontDescriptionCacheHead;
-    pBestMatch = NULL;
-    iBestMatchScore = -1;
-    while (pFont)
+    iBestDistance = INT_MAX;
+    if (!pFamilyFaces->bSubstring)
+    {
+      pFamilyFaces->ppSubstring = FcFamilyIndexSubstring(pCatalog->pFamilyIndex, p->family,
+                                                         &pFamilyFaces->iNumSubstring);
+      pFamilyFaces->bSubstring = FcTrue;
+    }
+    ppFaces = pFamilyFaces->ppSubstring;
+    iNumFaces = pFamilyFaces->iNumSubstring;
+    for (i = 0; i < iNumFaces; i++)
     {
-      if ((p->family) && (stristr(pFont->achFamilyName, p->family) != NULL))
+      iDistance = StyleDistance(p, ppFaces[i]);
+      iNumCompared++;
+      if (iDistance < iBestDistance)
       {
-        // Family found, calculate score for it!
-        if ( p->weight > FC_WEIGHT_MEDIUM )
-        {
-          // Looking for a BOLD font
-          bWeightOk = (stristr(pFont->achStyleName, "BOLD")!=NULL);
-        } else
-        {
-          // Looking for a non-bold (normal) font
-          bWeightOk = (stristr(pFont->achStyleName, "BOLD")==NULL);
-        }
-
-        if ( p->slant > FC_SLANT_ITALIC )
-        {
-          // Looking for an OBLIQUE font (fall back to ITALIC if necessary)
-          bSlantOk = (stristr(pFont->achStyleName, "OBLIQUE")!=NULL);
-          if (!bSlantOk)
-             bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-        } else if ( p->slant > FC_SLANT_ROMAN )
-        {
-          // Looking for an ITALIC font
-          bSlantOk = (stristr(pFont->achStyleName, "ITALIC")!=NULL);
-        } else
-        {
-          // Looking for a non-italic font
-          bSlantOk = (stristr(pFont->achStyleName, "ITALIC")==NULL &&
-                      stristr(pFont->achStyleName, "OBLIQUE")==NULL);
-        }
-
-        // Check if this score is better than the previous best one
-        if (iBestMatchScore < bWeightOk*2 + bSlantOk)
-        {
-          pBestMatch = pFont;
-          iBestMatchScore = bWeightOk*2 + bSlantOk;
-
-          // Check if it's a perfect match!
-          if ((bWeightOk) && (bSlantOk))
-          {
-            // Found an exact match!
-            break;
-          }
-        }
+        pBestMatch = ppFaces[i];
+        iBestDistance = iDistance;
+        if (!iDistance)
+          break;
       }
-      pFont = pFont->pNext;
     }
+    if (pBestMatch)
+      iPass = FC_STAT_MATCH_SUBSTRING;
   }
   // Use the one if we've found something
   if (pBestMatch)
     pFont = pBestMatch;
+  if (pFamilyFaces == &Faces)
+    FamilyFacesDone(&Faces);
+  FcStatsAdd(FC_STAT_MATCH_FACES, iNumCompared);
+  FcStatsAdd(iPass, 1);
 
   if (pFont)
   {
 #ifdef MATCH_DEBUG
     // print the font representing the best match
-    printf("best match\n  %s,%s\n", pFont->achFamilyName, pFont->achStyleName);
+    printf("best match\n  %s,%s\n", pFont->pchFamilyName, pFont->pchStyleName);
 #endif
 
     // If a font is found, then return with it!
-    FcPattern *pResult = FcPatternCreate();
-    if (pResult)
-    {
-      // in the output pattern set the three properties we use to select
-      if (pFont->achFamilyName)
-        pResult->family = strdup(pFont->achFamilyName);
-
-      if (stristr(pFont->achStyleName, "BOLD")!=NULL)
-        pResult->weight = FC_WEIGHT_BOLD;
-      else
-        pResult->weight = FC_WEIGHT_REGULAR;
-
-      if (stristr(pFont->achStyleName, "ITALIC")!=NULL)
-        pResult->slant = FC_SLANT_ITALIC;
-      else if (stristr(pFont->achStyleName, "OBLIQUE")!=NULL)
-        pResult->slant = FC_SLANT_OBLIQUE;
-      else
-        pResult->slant = FC_SLANT_ROMAN;
-
-      // If we found the font name of generic family the spacing should
-      // be the same as the input, and we don't select on available
-      // sizes, so copy that, too.
-      pResult->spacing = p->spacing;
-      pResult->pixelsize = p->pixelsize;
-
-      pResult->pFontDesc = pFont;
-    }
+    FcPattern *pResult = CreateFontPattern(pCatalog, p, pFont);
     if (result)
       *result = FcResultMatch;
     return pResult;
@@ -1183,12 +2099,155 @@ fcExport FcPattern *FcFontMatch(FcConfig *config, FcPattern *p, FcResult *result
 }
 
 
-fcExport FcObjectSet *FcObjectSetBuild(const char *first, ...)
+/* FcFontMatch() in a snapshot of the font list, pFamilyFaces may be NULL */
+static FcPattern *MatchCatalog(FcCatalog_t *pCatalog, FcConfig *config, FcPattern *p,
+                               FcFamilyFaces_t *pFamilyFaces)
 {
-  // This is a stub.
-  // We assume that the object sets are always created for
-  // FC_FAMILY parameters, as Mozilla uses only that.
+  FcPattern *pResult;
+
+  FcStatsAdd(FC_STAT_MATCH_CALLS, 1);
+  // the same patterns are asked for again and again, so remember the results
+  if (!FcMatchMemoLookup(pCatalog, p, &pResult))
+  {
+    pResult = MatchFont(pCatalog, config, p, pFamilyFaces, NULL);
+    FcMatchMemoInsert(pCatalog, p, pResult);
+  }
+  else
+    FcStatsAdd(FC_STAT_MATCH_MEMO_HITS, 1);
+  return pResult;
+}
+
+fcExport FcPattern *FcFontMatch(FcConfig *config, FcPattern *p, FcResult *result)
+{
+  FcCatalog_t *pCatalog;
+  FcPattern *pResult = NULL;
+
+  if (!p)
+    return NULL;
+
+  pCatalog = FcCatalogAcquire();
+  if (pCatalog)
+  {
+    pResult = MatchCatalog(pCatalog, config, p, NULL);
+    FcCatalogRelease(pCatalog);
+  }
+
+  if (result)
+    *result = pResult ? FcResultMatch : FcResultNoMatch;
+  return pResult;
+}
+
+
+/* Patterns FcFontMatchBatch() gives the same result, see FcMatchMemoLookup() */
+static FcBool SameMatch(const FcPattern *pa, const FcPattern *pb)
+{
+  return FcPatternEqual(pa, pb) && (FcSubstFind(pa) == FcSubstFind(pb));
+}
+
+/*
+ * Match a number of patterns at once, like a text with many style runs
+ * needs it. results[i] is set to the match of patterns[i], or NULL if it
+ * has none, and the caller destroys the results. All matches come from the
+ * same snapshot of the font list, identical patterns are only matched
+ * once, and the faces of a family are only looked up once for all the
+ * patterns asking for it. Returns the number of patterns that matched.
+ */
+fcExport int FcFontMatchBatch(FcConfig *config, FcPattern **patterns, int npatterns,
+                              FcPattern **results)
+{
+  FcCatalog_t *pCatalog;
+  FcFamilyFaces_t *pFamilies;
+  int *piPatternSlots, *piFamilySlots;
+  int iNumFamilies = 0, iNumMatched = 0;
+  int iSlots, iSlot, i;
+
+  for (i = 0; i < npatterns; i++)
+    results[i] = NULL;
+  if (npatterns <= 0)
+    return 0;
+
+  pCatalog = FcCatalogAcquire();
+  if (!pCatalog)
+    return 0;
+
+  // hash tables of the patterns and of their families, entry + 1
+  for (iSlots = 16; iSlots < npatterns * 2; iSlots *= 2)
+    ;
+  piPatternSlots = (int *) calloc(2 * iSlots, sizeof(int));
+  pFamilies = (FcFamilyFaces_t *) malloc(npatterns * sizeof(FcFamilyFaces_t));
+  if (!piPatternSlots || !pFamilies)
+  {
+    // one by one then
+    for (i = 0; i < npatterns; i++)
+      if (patterns[i] && (results[i] = MatchCatalog(pCatalog, config, patterns[i], NULL)))
+        iNumMatched++;
+    if (piPatternSlots)
+      free(piPatternSlots);
+    if (pFamilies)
+      free(pFamilies);
+    FcCatalogRelease(pCatalog);
+    return iNumMatched;
+  }
+  piFamilySlots = piPatternSlots + iSlots;
+
+  for (i = 0; i < npatterns; i++)
+  {
+    FcPattern *p = patterns[i];
+    FcFamilyFaces_t *pFamily;
+    FcChar32 ulHash;
+
+    if (!p)
+      continue;
+
+    // an identical pattern gets the same result
+    ulHash = FcPatternHash(p);
+    for (iSlot = ulHash & (iSlots - 1); piPatternSlots[iSlot]; iSlot = (iSlot + 1) & (iSlots - 1))
+      if (SameMatch(patterns[piPatternSlots[iSlot] - 1], p))
+        break;
+    if (piPatternSlots[iSlot])
+    {
+      results[i] = results[piPatternSlots[iSlot] - 1];
+      if (results[i])
+      {
+        FcPatternReference(results[i]);
+        iNumMatched++;
+      }
+      continue;
+    }
+    piPatternSlots[iSlot] = i + 1;
+
+    // the faces of the family may be known from another pattern
+    ulHash = FcStringHashIgnoreCase((const FcChar8 *) p->family);
+    for (iSlot = ulHash & (iSlots - 1); piFamilySlots[iSlot]; iSlot = (iSlot + 1) & (iSlots - 1))
+    {
+      const char *pchFamily = pFamilies[piFamilySlots[iSlot] - 1].pchFamily;
+
+      if ((!pchFamily && !p->family) ||
+          (pchFamily && p->family && !stricmp(pchFamily, p->family)))
+        break;
+    }
+    if (!piFamilySlots[iSlot])
+    {
+      FamilyFacesInit(pFamilies + iNumFamilies, pCatalog, p->family);
+      piFamilySlots[iSlot] = ++iNumFamilies;
+    }
+    pFamily = pFamilies + piFamilySlots[iSlot] - 1;
+
+    results[i] = MatchCatalog(pCatalog, config, p, pFamily);
+    if (results[i])
+      iNumMatched++;
+  }
 
+  for (i = 0; i < iNumFamilies; i++)
+    FamilyFacesDone(pFamilies + i);
+  free(pFamilies);
+  free(piPatternSlots);
+  FcCatalogRelease(pCatalog);
+  return iNumMatched;
+}
+
+fcExport FcObjectSet *FcObjectSetCreate(void)
+{
   FcObjectSet *result = (FcObjectSet *)malloc(sizeof(FcObjectSet));
 
   if (result)
@@ -1197,12 +2256,111 @@ fcExport FcObjectSet *FcObjectSetBuild(const char *first, ...)
   return result;
 }
 
-fcExport void FcObjectSetDestroy(FcObjectSet *os)
+// Objects this library doesn't know are not recorded, the patterns of
+// FcFontList() couldn't have them anyway.
+fcExport FcBool FcObjectSetAdd(FcObjectSet *os, const char *object)
+{
+  const char *pchName = FcObjectName(FcObjectFromName(object));
+  int i;
+
+  if (!pchName)
+    return FcTrue;
+  for (i = 0; i < os->nobject; i++)
+    if (os->objects[i] == pchName)
+      return FcTrue;
+
+  if (os->nobject >= os->sobject)
+  {
+    const char **newptr = realloc(os->objects, (os->sobject + 4) * sizeof(const char *));
+    if (!newptr)
+      return FcFalse;
+    os->objects = newptr;
+    os->sobject += 4;
+  }
+  os->objects[os->nobject++] = pchName;
+  return FcTrue;
+}
+
+fcExport FcObjectSet *FcObjectSetVaBuild(const char *first, va_list va)
 {
-  // This is a stub.
+  FcObjectSet *result = FcObjectSetCreate();
+  const char *object;
 
+  if (!result)
+    return NULL;
+
+  for (object = first; object; object = va_arg(va, const char *))
+  {
+    if (!FcObjectSetAdd(result, object))
+    {
+      FcObjectSetDestroy(result);
+      return NULL;
+    }
+  }
+  return result;
+}
+
+fcExport FcObjectSet *FcObjectSetBuild(const char *first, ...)
+{
+  FcObjectSet *result;
+  va_list va;
+
+  va_start(va, first);
+  result = FcObjectSetVaBuild(first, va);
+  va_end(va);
+  return result;
+}
+
+fcExport void FcObjectSetDestroy(FcObjectSet *os)
+{
   if (os)
+  {
+    if (os->objects)
+      free(os->objects);
     free(os);
+  }
+}
+
+/*
+ * The fonts of a snapshot that are good for the languages of a pattern, one
+ * bit per font of the list, NULL if the pattern doesn't ask for a language
+ */
+static FcChar32 *PatternLangFaces(const FcCatalog_t *pCatalog, const FcPattern *p)
+{
+  FcChar32 *pulFaces;
+
+  if (!p->langset || !FcPatternHasObject(p, FC_LANG_OBJECT))
+    return NULL;
+  pulFaces = (FcChar32 *) malloc((pCatalog->iLangWords + 1) * sizeof(FcChar32));
+  if (pulFaces && !FcLangSetFaces(p->langset, pCatalog, pulFaces))
+  {
+    free(pulFaces);
+    pulFaces = NULL;
+  }
+  return pulFaces;
+}
+
+static FcBool FontHasLang(const FcCatalog_t *pCatalog, const FcChar32 *pulLangFaces,
+                          FcFontRecord_p pFont)
+{
+  int iFont = pFont - pCatalog->pFonts;
+
+  return !pulLangFaces || (pulLangFaces[iFont / 32] & ((FcChar32) 1 << (iFont % 32)));
+}
+
+// The objects of an object set as the FcPattern::ullObjects of the patterns
+// FcFontList() returns. A set without objects doesn't restrict the patterns.
+static unsigned long long ObjectSetMask(const FcObjectSet *os)
+{
+  unsigned long long ullObjects;
+  int i;
+
+  if (!os || !os->nobject)
+    return 0;
+  ullObjects = FcObjectBit(FC_INVALID_OBJECT);
+  for (i = 0; i < os->nobject; i++)
+    ullObjects |= FcObjectBit(FcObjectFromName(os->objects[i]));
+  return ullObjects;
 }
 
 fcExport FcFontSet *FcFontSetCreate(void)
@@ -1255,9 +2413,9 @@ fcExport FcBool FcFontSetAdd(FcFontSet *fs, FcPattern *pat)
 fcExport FcFontSet *FcFontList(FcConfig *config, FcPattern *p, FcObjectSet *os)
 {
   // We assume that the we either have to list all fonts (pat.family==NULL),
-  // or we have to list a given family (pat.family!=NULL),
-  // and only their FC_FAMILY property will be queried before
-  // the font list is destroyed.
+  // or we have to list a given family (pat.family!=NULL).
+  // The patterns are views of the fonts in the font list, allocated in
+  // one block, and only have the objects of os.
     if (!pConfig)
     {
 	if (!FcInitBringUptoDate ())
@@ -1269,89 +2427,352 @@ fcExport FcFontSet *FcFontList(FcConfig *config, FcPattern *p, FcObjectSet *os)
   if (!p)
     return result;
 
-  // same logic as in FcFontMatch
-  FcBool wantsMono = p->spacing == FC_MONO || ((p->family) && (stricmp("MONOSPACE", p->family)==0));
-  FcBool wantsSans = ((p->family) &&
-                      ((stricmp( p->family, "SWISS" ) == 0 ) ||
-                       (stricmp( p->family, "HELV" ) == 0 ) ||
-                       (stricmp( p->family, "SANS-SERIF" ) == 0 ) ||
-                       (stricmp( p->family, "SANS" ) == 0 )
-                      ));
-  FcBool wantsSerif = ((p->family) &&
-                       ((stricmp( p->family, "SERIF" ) == 0 ) ||
-                        (stricmp( p->family, "TMS RMN" ) == 0 ) ||
-                        (stricmp( p->family, DEFAULT_SERIF_FONT ) == 0 )
-                       ));
+  // the patterns keep the snapshot of the font list they are from alive
+  FcCatalog_t *pCatalog = FcCatalogAcquire();
 
-  if (result)
+  if (result && pCatalog)
   {
-    FontDescriptionCache_p pFont;
-
-    pFont = pFontDescriptionCacheHead;
-    while (pFont)
+    FcFontRecord_p pFont;
+    FcFontRecord_p pDefault = NULL;
+    FcFontRecord_p *ppFaces = NULL;
+    FcPattern *pPatterns;
+    int iNumFaces = pCatalog->iNumFonts;
+    int iNumCandidates, iNumListed;
+    unsigned long long ullObjects = ObjectSetMask(os);
+    // a pattern with a language only lists the fonts covering it
+    FcChar32 *pulLangFaces = PatternLangFaces(pCatalog, p);
+    int i, j;
+
+    if (p->family)
     {
-      if ((p->family==NULL) ||
-          (stristr(pFont->achFamilyName, p->family)))
-      {
-        FcPattern *newPattern = FcPatternCreate();
-        newPattern->pFontDesc = pFont;
+      // the faces of all families containing the wanted one
+      ppFaces = FcFamilyIndexSubstring(pCatalog->pFamilyIndex, p->family, &iNumFaces);
 
-        FcFontSetAdd(result, newPattern);
-      }
-      else if ((wantsMono && stricmp(pFont->achFamilyName, DEFAULT_MONOSPACED_FONT)==0) ||
-               (wantsSans && stricmp(pFont->achFamilyName, DEFAULT_SANSSERIF_FONT)==0) ||
-               (wantsSerif && (stricmp(pFont->achFamilyName, DEFAULT_SERIF_FONT)==0 ||
-                               stricmp(pFont->achFamilyName, DEFAULT_SERIF_FONT" ")==0))
-              )
+      // the first face of a family of the substitution rule (same as in
+      // FcFontMatch), unless that family contains the wanted one anyway
+      const FcSubstRule_t *pRule = FcSubstFind(p);
+
+      for (i = 0; pRule && i < pRule->iNumFamilies; i++)
       {
-        FcPattern *newPattern = FcPatternCreate();
-        newPattern->pFontDesc = pFont;
-        FcFontSetAdd(result, newPattern);
-        // here, we were obviously only searching for one
-        // specific (default) font, so we can return early
-        return result;
+        int iNumDefaultFaces;
+        FcFontRecord_p *ppDefaults = FcFamilyIndexLookup(pCatalog->pFamilyIndex,
+                                                         pRule->ppchFamilies[i], &iNumDefaultFaces);
+        if (ppDefaults && !stristr(ppDefaults[0]->pchFamilyName, p->family) &&
+            FontHasLang(pCatalog, pulLangFaces, ppDefaults[0]) &&
+            (!pDefault || (ppDefaults[0] < pDefault)))
+          pDefault = ppDefaults[0];
       }
+    }
 
-      pFont = pFont->pNext;
+    // the fonts are listed in the order of the font list, up to
+    // the default font
+    for (iNumCandidates = 0, iNumListed = 0; iNumCandidates < iNumFaces; iNumCandidates++)
+    {
+      pFont = ppFaces ? ppFaces[iNumCandidates] : pCatalog->pFonts + iNumCandidates;
+      if (pDefault && (pFont > pDefault))
+        break;
+      if (FontHasLang(pCatalog, pulLangFaces, pFont))
+        iNumListed++;
+    }
+    // here, we were obviously only searching for one
+    // specific (default) font, so the list ends with it
+    if (pDefault)
+      iNumListed++;
+
+    pPatterns = FcPatternArenaCreate(pCatalog, iNumListed);
+    result->fonts = pPatterns ? (FcPattern **)malloc(iNumListed * sizeof(FcPattern *)) : NULL;
+    if (result->fonts)
+    {
+      result->sfont = iNumListed;
+      for (i = 0, j = 0; i < iNumListed; i++)
+      {
+        if (pDefault && (i == iNumListed - 1))
+          pFont = pDefault;
+        else
+        {
+          do
+            pFont = ppFaces ? ppFaces[j++] : pCatalog->pFonts + j++;
+          while (!FontHasLang(pCatalog, pulLangFaces, pFont));
+        }
+
+        pPatterns[i].pFontDesc = pFont;
+        pPatterns[i].weight = pFont->iWeight;
+        pPatterns[i].slant = pFont->iSlant;
+        pPatterns[i].width = pFont->iWidth;
+        pPatterns[i].ullObjects = ullObjects;
+        result->fonts[i] = pPatterns + i;
+      }
+      result->nfont = iNumListed;
     }
+    else
+    {
+      // every pattern holds a reference to the block
+      for (i = 0; i < iNumListed && pPatterns; i++)
+        FcPatternDestroy(pPatterns + i);
+    }
+    if (ppFaces)
+      free(ppFaces);
+    if (pulLangFaces)
+      free(pulLangFaces);
   }
 
+  FcCatalogRelease(pCatalog);
   return result;
 }
 
+/* a candidate of FcFontSort(), with the keys it is sorted by */
+typedef struct FcSortFont_s
+{
+  FcFontRecord_p pFont;
+  int            iFamily;     /* 0 same family, 1 similar name, 2 other */
+  int            iLang;       /* 0 covers the languages asked for, 1 not */
+  int            iDistance;   /* see StyleDistance() */
+  FcChar32       ulCoverage;  /* number of characters in the font */
+  FcChar32       ulGain;      /* characters it adds, at most, see SortTier() */
+  int            iOrder;      /* position in the font list */
+} FcSortFont_t;
+
+static int CompareSortFonts(const void *p1, const void *p2)
+{
+  const FcSortFont_t *pA = (const FcSortFont_t *) p1;
+  const FcSortFont_t *pB = (const FcSortFont_t *) p2;
+
+  if (pA->iFamily != pB->iFamily)
+    return pA->iFamily - pB->iFamily;
+  if (pA->iLang != pB->iLang)
+    return pA->iLang - pB->iLang;
+  return pA->iDistance - pB->iDistance;
+}
+
+/* Within a tier, the font adding the most characters goes first */
+static int CompareGain(const FcSortFont_t *pA, const FcSortFont_t *pB)
+{
+  if (pA->ulGain != pB->ulGain)
+    return (pA->ulGain > pB->ulGain) ? -1 : 1;
+  if (pA->ulCoverage != pB->ulCoverage)
+    return (pA->ulCoverage > pB->ulCoverage) ? -1 : 1;
+  return pA->iOrder - pB->iOrder;
+}
+
+static void SiftDown(const FcSortFont_t *pSortFonts, int *piHeap, int iNum, int i)
+{
+  int iChild, iTemp;
+
+  for (;;)
+  {
+    iChild = 2 * i + 1;
+    if (iChild >= iNum)
+      break;
+    if ((iChild + 1 < iNum) &&
+        (CompareGain(pSortFonts + piHeap[iChild + 1], pSortFonts + piHeap[iChild]) < 0))
+      iChild++;
+    if (CompareGain(pSortFonts + piHeap[i], pSortFonts + piHeap[iChild]) <= 0)
+      break;
+    iTemp = piHeap[i];
+    piHeap[i] = piHeap[iChild];
+    piHeap[iChild] = iTemp;
+    i = iChild;
+  }
+}
+
+/*
+ * Order the fonts of a tier (same family rank, language coverage and style
+ * distance) greedily: the next one is the one adding the most characters
+ * to pCoverage, which grows with every font taken. What a font adds only
+ * shrinks as pCoverage grows, so the heap holds upper bounds and a font is
+ * only counted again when it comes out on top. Returns the indices into
+ * pSortFonts in piOrder.
+ */
+static void SortTier(FcSortFont_t *pSortFonts, int iFirst, int iEnd,
+                     FcCharSet *pCoverage, int *piHeap, int *piOrder)
+{
+  FcSortFont_t *pTop;
+  int iNumHeap = iEnd - iFirst;
+  int iTop, i;
+
+  for (i = 0; i < iNumHeap; i++)
+  {
+    pSortFonts[iFirst + i].ulGain = pSortFonts[iFirst + i].ulCoverage;
+    piHeap[i] = iFirst + i;
+  }
+  for (i = iNumHeap / 2 - 1; i >= 0; i--)
+    SiftDown(pSortFonts, piHeap, iNumHeap, i);
+
+  while (iNumHeap)
+  {
+    iTop = piHeap[0];
+    pTop = pSortFonts + iTop;
+    pTop->ulGain = FcCharSetSubtractCount(pTop->pFont->pCharSet, pCoverage);
+    SiftDown(pSortFonts, piHeap, iNumHeap, 0);
+    if (piHeap[0] != iTop)
+      continue;
+
+    *piOrder++ = iTop;
+    piHeap[0] = piHeap[--iNumHeap];
+    SiftDown(pSortFonts, piHeap, iNumHeap, 0);
+    if (pCoverage)
+      FcCharSetMerge(pCoverage, pTop->pFont->pCharSet, NULL);
+  }
+}
+
+/*
+ * Return the fonts in the order they should be tried for the pattern: the
+ * one FcFontMatch() picks comes first, then the other fonts ranked by
+ * family (same, similar, other), then by whether they cover the languages
+ * of the pattern, then by style distance. Among equally ranked fonts the
+ * one adding the most characters to the fonts before it goes first. With
+ * trim the fonts which don't cover anything the fonts before them haven't
+ * already covered are left out. If csp is given, it returns the union of
+ * the coverage of the returned fonts.
+ */
 fcExport FcFontSet *FcFontSort(FcConfig *config, FcPattern *p, FcBool trim,
                                FcCharSet **csp, FcResult *result)
 {
-  // Enhanced for poppler usage.  According to docs fcfontsort brings back
-  // the fonts matching the pattern, so we use FcFontMatch  if FcFontMatch
-  // has no font found we try the default ones
-
-  *result = FcResultMatch;
-  FcFontSet *fs = FcFontSetCreate();
+  FcFontRecord_p pFont, pMatch = NULL;
+  FcFontRecord_p *ppSimilar = NULL;
+  FcSortFont_t *pSortFonts = NULL;
+  int *piHeap = NULL, *piOrder = NULL;
+  FcChar32 *pulLangFaces = NULL;
+  FcCatalog_t *pCatalog;
+  FcCharSet *pCoverage = NULL;
+  FcPattern *pPattern;
+  FcFontSet *fs;
+  int iNumSimilar = 0, iSimilar = 0;
+  int iNumFonts, iTier, i;
+
+  if (csp)
+    *csp = NULL;
+  if (result)
+    *result = FcResultMatch;
+  fs = FcFontSetCreate();
+  if (!fs || !p)
+    return fs;
 
-  if (!p)
+  // the match and the other fonts have to come from the same snapshot
+  pCatalog = FcCatalogAcquire();
+  if (!pCatalog)
+  {
+    if (result)
+      *result = FcResultNoMatch;
     return fs;
+  }
 
-  FcPattern *newPattern = FcFontMatch(config, p, result);
-  if (!newPattern)
+  // The best match goes first. If FcFontMatch has no font found we try
+  // the default ones, like poppler expects us to do
+  pPattern = MatchCatalog(pCatalog, config, p, NULL);
+  if (!pPattern)
   {
-     FcPattern *pDup = FcPatternDuplicate(p);
-     if (p->lang && (stristr(p->lang, "JA") != NULL))
-        {
-           FcPatternAddString(pDup, FC_FAMILY, (const FcChar8 *)DEFAULT_SERIF_FONTJA);
-        }
-        else
-        {
-           FcPatternAddString(pDup, FC_FAMILY, (const FcChar8 *)DEFAULT_SERIF_FONT);
-        }
-     newPattern = FcFontMatch(config, pDup, result);
+     const FcSubstRule_t *pRule = FcSubstFallback(p);
+     FcPattern *pDup = pRule ? FcPatternDuplicate(p) : NULL;
+
+     for (i = 0; pDup && !pPattern && i < pRule->iNumFamilies; i++)
+     {
+        FcPatternAddString(pDup, FC_FAMILY, (const FcChar8 *)pRule->ppchFamilies[i]);
+        pPattern = MatchCatalog(pCatalog, config, pDup, NULL);
+     }
      FcPatternDestroy(pDup);
   }
+  if (pPattern)
+  {
+    pMatch = pPattern->pFontDesc;
+    FcFontSetAdd(fs, pPattern);
+  }
+
+  // the coverage so far ranks the fonts, and is needed for trimming and
+  // for the caller
+  pCoverage = FcCharSetCreate();
+  if (pCoverage && pMatch)
+    FcCharSetMerge(pCoverage, pMatch->pCharSet, NULL);
 
-  if (newPattern && fs)
+  // rank all other fonts
+  if (pCatalog->iNumFonts)
   {
-    FcFontSetAdd(fs, newPattern);
+    pSortFonts = (FcSortFont_t *) malloc(pCatalog->iNumFonts * sizeof(FcSortFont_t));
+    piHeap = (int *) malloc(pCatalog->iNumFonts * sizeof(int));
+    piOrder = (int *) malloc(pCatalog->iNumFonts * sizeof(int));
+    if (!piHeap || !piOrder)
+    {
+      free(pSortFonts);
+      pSortFonts = NULL;
+    }
   }
+
+  // the fonts with a family containing the wanted one, in list order
+  if (pSortFonts && p->family)
+    ppSimilar = FcFamilyIndexSubstring(pCatalog->pFamilyIndex, p->family, &iNumSimilar);
+
+  // and the fonts covering the languages, from the index of the snapshot
+  if (pSortFonts)
+    pulLangFaces = PatternLangFaces(pCatalog, p);
+
+  if (pSortFonts)
+  {
+    for (iNumFonts = 0, i = 0; i < pCatalog->iNumFonts; i++)
+    {
+      pFont = pCatalog->pFonts + i;
+      while ((iSimilar < iNumSimilar) && (ppSimilar[iSimilar] < pFont))
+        iSimilar++;
+      if (pFont == pMatch)
+        continue;
+      pSortFonts[iNumFonts].pFont = pFont;
+      if (p->family && !stricmp(pFont->pchFamilyName, p->family))
+        pSortFonts[iNumFonts].iFamily = 0;
+      else if (pMatch && !stricmp(pFont->pchFamilyName, pMatch->pchFamilyName))
+        pSortFonts[iNumFonts].iFamily = 0;
+      else if ((iSimilar < iNumSimilar) && (ppSimilar[iSimilar] == pFont))
+        pSortFonts[iNumFonts].iFamily = 1;
+      else
+        pSortFonts[iNumFonts].iFamily = 2;
+      pSortFonts[iNumFonts].iLang = FontHasLang(pCatalog, pulLangFaces, pFont) ? 0 : 1;
+      pSortFonts[iNumFonts].iDistance = StyleDistance(p, pFont);
+      pSortFonts[iNumFonts].ulCoverage = FcCharSetCount(pFont->pCharSet);
+      pSortFonts[iNumFonts].iOrder = iNumFonts;
+      iNumFonts++;
+    }
+    qsort(pSortFonts, iNumFonts, sizeof(FcSortFont_t), CompareSortFonts);
+
+    // the tiers in turn, SortTier() merges the coverage of their fonts
+    for (iTier = 0; iTier < iNumFonts; iTier = i)
+    {
+      for (i = iTier + 1;
+           (i < iNumFonts) && !CompareSortFonts(pSortFonts + iTier, pSortFonts + i); i++)
+        ;
+      SortTier(pSortFonts, iTier, i, pCoverage, piHeap, piOrder + iTier);
+    }
+
+    for (i = 0; i < iNumFonts; i++)
+    {
+      pFont = pSortFonts[piOrder[i]].pFont;
+      // what it adds was counted when SortTier() took it
+      if (trim && !pSortFonts[piOrder[i]].ulGain)
+        continue;
+      pPattern = CreateFontPattern(pCatalog, p, pFont);
+      if (!pPattern || !FcFontSetAdd(fs, pPattern))
+      {
+        FcPatternDestroy(pPattern);
+        break;
+      }
+    }
+    free(pSortFonts);
+  }
+  if (piHeap)
+    free(piHeap);
+  if (piOrder)
+    free(piOrder);
+  if (ppSimilar)
+    free(ppSimilar);
+  if (pulLangFaces)
+    free(pulLangFaces);
+
+  FcCatalogRelease(pCatalog);
+
+  if (!fs->nfont && result)
+    *result = FcResultNoMatch;
+
+  if (csp)
+    *csp = pCoverage;
+  else
+    FcCharSetDestroy(pCoverage);
   return fs;
 }
 
@@ -1361,18 +2782,23 @@ fcExport FcFontSet *FcFontSort(FcConfig *config, FcPattern *p, FcBool trim,
 fcExport FcPattern *FcFreeTypeQuery(const FcChar8 *file, int id, FcBlanks *blanks, int *count)
 {
   FcPattern *pattern = NULL;
-  FT_Face ftface;
-
-  if (FT_New_Face(hFtLib, (const char *)file, id, &ftface))
+  FcFaceEntry_t *pEntry = NULL;
+  struct stat statBuf;
+
+  // the face comes from the face pool, and stays there for the next
+  // query or match of the font
+  if (stat((const char *)file, &statBuf) == 0)
+    pEntry = FcFaceAcquire((const char *)file, id, statBuf.st_mtime, statBuf.st_size);
+  if (!pEntry)
   {
     /* Could not load font. */
     *count = 0;
     return NULL;
   }
-  *count = ftface->num_faces;
+  *count = FcFaceGet(pEntry)->num_faces;
 
-  pattern = FcFreeTypeQueryFace(ftface, file, id, blanks);
-  FT_Done_Face(ftface);
+  pattern = FcFreeTypeQueryFace(FcFaceGet(pEntry), file, id, blanks);
+  FcFaceRelease(pEntry);
 
   return pattern;
 }
@@ -1385,10 +2811,10 @@ fcExport FcPattern *FcFreeTypeQueryFace(const FT_Face face, const FcChar8 *file,
 {
   FcPattern *pattern = FcPatternCreate();
   FcDefaultSubstitute(pattern);
-  pattern->family = (char*)malloc(strlen(face->family_name));
-  strcpy(pattern->family, face->family_name);
-  pattern->style = (char*)malloc(strlen(face->style_name));
-  strcpy(pattern->style, face->style_name);
+  if (face->family_name)
+    pattern->family = strdup(face->family_name);
+  if (face->style_name)
+    pattern->style = strdup(face->style_name);
   return pattern;
 }
 
@@ -1400,40 +2826,37 @@ fcExport FT_UInt FcFreeTypeCharIndex(FT_Face face, FcChar32 ucs4)
 
 fcExport FcBool FcInitReinitialize(void)
 {
-  // allocate new config while the old one is still active, so that we
-  // get a new address for the new config
-  void *newConfig = (void *)malloc(sizeof(void));
-
-  FcFini();
-  FcBool rc = FcInit();
-
-  if (pConfig)
-    free(pConfig);
-  pConfig = newConfig;
+  FcBool rc;
 
+  FcLockAcquire(&hInitLock);
+  rc = RefreshFonts(FcTrue);
+  FcLockRelease(&hInitLock);
   return rc;
 }
 
-// The FC docs say that this function should only reinit the configuration
-// if a certain time passed. For now set this timer to a fixed value of 60s.
+// Only rescan when a font directory or font file was
+// noticed to have changed since the last scan (see fcwatch.c)
 fcExport FcBool FcInitBringUptoDate(void)
 {
-  time_t now = time(NULL);
-  double dtime = difftime(now, initTime);
-  if (dtime <= FC_TIMER_DEFAULT)
-    return FcTrue;
+  FcBool rc;
 
-  // allocate new config while the old one is still active, so that we
-  // get a new address for the new config
-  void *newConfig = (void *)malloc(sizeof(void));
-
-  FcFini();
-  FcBool rc = FcInit();
-
-  if (pConfig)
-    free(pConfig);
-  pConfig = newConfig;
+  if (pConfig && FcWatchUptoDate())
+    return FcTrue;
 
+  // if another thread is at it already, the current fonts will do, but
+  // without any fonts yet, wait for it to finish
+  if (!FcLockTry(&hInitLock))
+  {
+    if (pConfig)
+      return FcTrue;
+    FcLockAcquire(&hInitLock);
+  }
+  // the other thread may have brought them up to date meanwhile
+  if (pConfig && FcWatchUptoDate())
+    rc = FcTrue;
+  else
+    rc = RefreshFonts(FcFalse);
+  FcLockRelease(&hInitLock);
   return rc;
 }
 
@@ -1447,10 +2870,10 @@ fcExport FcConfig *FcInitLoadConfigAndFonts(void)
 
 fcExport FcBool FcConfigUptoDate(FcConfig *config)
 {
-  // Stub
-  // It could be done, but it's not a short thingie.
-  // We should do something like we do at FcInit()...
-  return FcTrue;
+  // a config replaced by a refresh is out of date for good
+  if (config && (config != pConfig))
+    return FcFalse;
+  return FcWatchUptoDate();
 }
 
 fcExport FcConfig *FcConfigGetCurrent(void)
@@ -1483,10 +2906,12 @@ fcExport FcFontSet *FcConfigGetFonts(FcConfig *config, FcSetName set)
 
 fcExport void FcConfigDestroy(FcConfig *config)
 {
+  FcLockAcquire(&hInitLock);
   if (pConfig) {
     free(pConfig); // don't need this config any more
     pConfig = NULL;
   }
+  FcLockRelease(&hInitLock);
 }
 
 